@@ -0,0 +1,304 @@
+#include "AllocationTracker.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+
+#if defined(_MSC_VER)
+#define GPS_NOINLINE __declspec(noinline)
+#else
+#define GPS_NOINLINE __attribute__((noinline))
+#endif
+
+namespace gps {
+
+	//in front of every tracked block; frees are charged to the tag that allocated
+	struct AllocationHeader {
+		size_t size;
+		unsigned int tag;
+	};
+	//keeps the blocks aligned as malloc returns them
+	static const size_t HEADER_SIZE = 16;
+	static_assert(sizeof(AllocationHeader) <= HEADER_SIZE, "the header must fit in front of the block");
+
+	//zero initialized before any constructor runs, operator new may be called that early
+	static std::atomic<unsigned long long> allocations[ALLOCATION_TAG_COUNT];
+	static std::atomic<unsigned long long> frees[ALLOCATION_TAG_COUNT];
+	static std::atomic<unsigned long long> allocatedBytes[ALLOCATION_TAG_COUNT];
+	static std::atomic<long long> liveBytes[ALLOCATION_TAG_COUNT];
+	static std::atomic<long long> peakBytes[ALLOCATION_TAG_COUNT];
+	//all tags together, and the tag that allocated the byte that made the peak
+	static std::atomic<long long> totalLiveBytes;
+	static std::atomic<long long> totalPeakBytes;
+	static std::atomic<int> totalPeakTag;
+
+	static std::atomic<unsigned long long> frameAllocations;
+	static std::atomic<unsigned long long> frameBytes;
+	static std::atomic<unsigned long long> frameSteadyAllocations[ALLOCATION_TAG_COUNT];
+	static std::atomic<bool> steadyState;
+	static std::atomic<unsigned long long> steadyStateAllocations;
+	static std::atomic<unsigned long long> lastSteadySize;
+	static std::atomic<int> lastSteadyTag;
+	static unsigned long long steadyFrames = 0;
+	static unsigned long long maxFrameAllocations = 0;
+	static int warnings = 0;
+
+	static thread_local int currentTag = ALLOCATION_OTHER;
+	//set while printing, what the report itself allocates is not flagged
+	static thread_local bool reporting = false;
+
+	static void raisePeak(std::atomic<long long>& peak, long long value)
+	{
+		long long previous = peak.load(std::memory_order_relaxed);
+		while (value > previous && !peak.compare_exchange_weak(previous, value, std::memory_order_relaxed))
+			;
+	}
+
+	static void countAllocation(int tag, size_t size)
+	{
+		allocations[tag].fetch_add(1, std::memory_order_relaxed);
+		allocatedBytes[tag].fetch_add(size, std::memory_order_relaxed);
+		raisePeak(peakBytes[tag], liveBytes[tag].fetch_add((long long)size, std::memory_order_relaxed) + (long long)size);
+		long long total = totalLiveBytes.fetch_add((long long)size, std::memory_order_relaxed) + (long long)size;
+		if (total > totalPeakBytes.load(std::memory_order_relaxed)) {
+			raisePeak(totalPeakBytes, total);
+			totalPeakTag.store(tag, std::memory_order_relaxed);
+		}
+		frameAllocations.fetch_add(1, std::memory_order_relaxed);
+		frameBytes.fetch_add(size, std::memory_order_relaxed);
+		if (steadyState.load(std::memory_order_relaxed) && !reporting) {
+			steadyStateAllocations.fetch_add(1, std::memory_order_relaxed);
+			frameSteadyAllocations[tag].fetch_add(1, std::memory_order_relaxed);
+			AllocationTracker::steadyStateAllocation((ALLOCATION_TAG)tag, size);
+		}
+	}
+
+	static void countFree(const AllocationHeader* header)
+	{
+		frees[header->tag].fetch_add(1, std::memory_order_relaxed);
+		liveBytes[header->tag].fetch_sub((long long)header->size, std::memory_order_relaxed);
+		totalLiveBytes.fetch_sub((long long)header->size, std::memory_order_relaxed);
+	}
+
+	bool AllocationTracker::isCompiledIn()
+	{
+#ifdef GPS_TRACK_ALLOCATIONS
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	ALLOCATION_TAG AllocationTracker::getTag()
+	{
+		return (ALLOCATION_TAG)currentTag;
+	}
+
+	void AllocationTracker::setTag(ALLOCATION_TAG tag)
+	{
+		currentTag = tag;
+	}
+
+	const char* AllocationTracker::getTagName(ALLOCATION_TAG tag)
+	{
+		static const char* names[ALLOCATION_TAG_COUNT] = { "other", "loader", "textures", "shaders", "frame" };
+		return names[tag];
+	}
+
+	void* AllocationTracker::allocate(size_t size)
+	{
+		unsigned char* block = (unsigned char*)std::malloc(HEADER_SIZE + size);
+		if (!block)
+			return NULL;
+		AllocationHeader* header = (AllocationHeader*)block;
+		header->size = size;
+		header->tag = (unsigned int)currentTag;
+		countAllocation(currentTag, size);
+		return block + HEADER_SIZE;
+	}
+
+	void* AllocationTracker::reallocate(void* block, size_t size)
+	{
+		if (!block)
+			return allocate(size);
+		AllocationHeader* header = (AllocationHeader*)((unsigned char*)block - HEADER_SIZE);
+		AllocationHeader previous = *header;
+		unsigned char* moved = (unsigned char*)std::realloc(header, HEADER_SIZE + size);
+		if (!moved)
+			return NULL;
+		//a resize counts as freeing the old block and allocating the new one
+		countFree(&previous);
+		header = (AllocationHeader*)moved;
+		header->size = size;
+		header->tag = (unsigned int)currentTag;
+		countAllocation(currentTag, size);
+		return moved + HEADER_SIZE;
+	}
+
+	void AllocationTracker::release(void* block)
+	{
+		if (!block)
+			return;
+		AllocationHeader* header = (AllocationHeader*)((unsigned char*)block - HEADER_SIZE);
+		countFree(header);
+		std::free(header);
+	}
+
+	void AllocationTracker::beginFrame()
+	{
+		frameAllocations.store(0, std::memory_order_relaxed);
+		frameBytes.store(0, std::memory_order_relaxed);
+		for (int t = 0; t < ALLOCATION_TAG_COUNT; t++)
+			frameSteadyAllocations[t].store(0, std::memory_order_relaxed);
+	}
+
+	void AllocationTracker::endFrame()
+	{
+		if (!steadyState.load(std::memory_order_relaxed))
+			return;
+		steadyFrames++;
+		unsigned long long count = frameAllocations.load(std::memory_order_relaxed);
+		if (count > maxFrameAllocations)
+			maxFrameAllocations = count;
+		if (count == 0 || warnings >= MAX_WARNINGS)
+			return;
+
+		reporting = true;
+		std::cerr << "Allocations in steady state frame " << steadyFrames << ": " << count << " blocks, "
+			<< frameBytes.load(std::memory_order_relaxed) << " bytes (";
+		for (int t = 0, shown = 0; t < ALLOCATION_TAG_COUNT; t++) {
+			unsigned long long tagCount = frameSteadyAllocations[t].load(std::memory_order_relaxed);
+			if (tagCount > 0)
+				std::cerr << (shown++ ? ", " : "") << getTagName((ALLOCATION_TAG)t) << " " << tagCount;
+		}
+		std::cerr << ")" << std::endl;
+		if (++warnings == MAX_WARNINGS)
+			std::cerr << "Further steady state allocations are only counted" << std::endl;
+		reporting = false;
+	}
+
+	void AllocationTracker::setSteadyState(bool steady)
+	{
+		steadyState.store(steady, std::memory_order_relaxed);
+	}
+
+	GPS_NOINLINE void AllocationTracker::steadyStateAllocation(ALLOCATION_TAG tag, size_t size)
+	{
+		//the stores keep the call from being optimized away, so the breakpoint has somewhere to stop
+		lastSteadySize.store(size, std::memory_order_relaxed);
+		lastSteadyTag.store(tag, std::memory_order_relaxed);
+	}
+
+	AllocationCounters AllocationTracker::getCounters(ALLOCATION_TAG tag)
+	{
+		AllocationCounters counters;
+		counters.allocations = allocations[tag].load(std::memory_order_relaxed);
+		counters.frees = frees[tag].load(std::memory_order_relaxed);
+		counters.bytes = allocatedBytes[tag].load(std::memory_order_relaxed);
+		counters.liveBytes = liveBytes[tag].load(std::memory_order_relaxed);
+		counters.peakBytes = peakBytes[tag].load(std::memory_order_relaxed);
+		return counters;
+	}
+
+	unsigned long long AllocationTracker::getFrameAllocations()
+	{
+		return frameAllocations.load(std::memory_order_relaxed);
+	}
+
+	unsigned long long AllocationTracker::getSteadyStateAllocations()
+	{
+		return steadyStateAllocations.load(std::memory_order_relaxed);
+	}
+
+	void AllocationTracker::writeReport(std::ostream& out)
+	{
+		if (!isCompiledIn()) {
+			out << "Allocation tracking needs a build with GPS_TRACK_ALLOCATIONS defined" << std::endl;
+			return;
+		}
+		reporting = true;
+		out << std::fixed << std::setprecision(2);
+		out << "Allocations by subsystem, in MB" << std::endl;
+		out << "  tag            blocks       freed  allocated       live       peak" << std::endl;
+		for (int t = 0; t < ALLOCATION_TAG_COUNT; t++) {
+			AllocationCounters counters = getCounters((ALLOCATION_TAG)t);
+			out << "  " << std::left << std::setw(10) << getTagName((ALLOCATION_TAG)t) << std::right
+				<< std::setw(12) << counters.allocations << std::setw(12) << counters.frees
+				<< std::setw(11) << counters.bytes / 1048576.0 << std::setw(11) << counters.liveBytes / 1048576.0
+				<< std::setw(11) << counters.peakBytes / 1048576.0 << std::endl;
+		}
+		out << "  peak of all tags " << totalPeakBytes.load(std::memory_order_relaxed) / 1048576.0 << " MB, reached by "
+			<< getTagName((ALLOCATION_TAG)totalPeakTag.load(std::memory_order_relaxed)) << std::endl;
+		if (steadyFrames > 0) {
+			out << "  " << getSteadyStateAllocations() << " allocations in " << steadyFrames << " steady state frames, at most "
+				<< maxFrameAllocations << " in one frame" << std::endl;
+		}
+		if (getSteadyStateAllocations() > 0) {
+			out << "  the last one " << lastSteadySize.load(std::memory_order_relaxed) << " bytes, charged to "
+				<< getTagName((ALLOCATION_TAG)lastSteadyTag.load(std::memory_order_relaxed)) << std::endl;
+		}
+		out.unsetf(std::ios::floatfield);
+		reporting = false;
+	}
+}
+
+#ifdef GPS_TRACK_ALLOCATIONS
+//the replaceable global forms; the aligned ones keep their default pair, they never reach these
+void* operator new(std::size_t size)
+{
+	void* block = gps::AllocationTracker::allocate(size);
+	if (!block)
+		throw std::bad_alloc();
+	return block;
+}
+
+void* operator new[](std::size_t size)
+{
+	void* block = gps::AllocationTracker::allocate(size);
+	if (!block)
+		throw std::bad_alloc();
+	return block;
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	return gps::AllocationTracker::allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+	return gps::AllocationTracker::allocate(size);
+}
+
+void operator delete(void* block) noexcept
+{
+	gps::AllocationTracker::release(block);
+}
+
+void operator delete[](void* block) noexcept
+{
+	gps::AllocationTracker::release(block);
+}
+
+void operator delete(void* block, std::size_t) noexcept
+{
+	gps::AllocationTracker::release(block);
+}
+
+void operator delete[](void* block, std::size_t) noexcept
+{
+	gps::AllocationTracker::release(block);
+}
+
+void operator delete(void* block, const std::nothrow_t&) noexcept
+{
+	gps::AllocationTracker::release(block);
+}
+
+void operator delete[](void* block, const std::nothrow_t&) noexcept
+{
+	gps::AllocationTracker::release(block);
+}
+#endif
@@ -0,0 +1,76 @@
+#ifndef AllocationTracker_hpp
+#define AllocationTracker_hpp
+
+#include <cstddef>
+#include <ostream>
+
+namespace gps {
+
+    //the subsystem an allocation is charged to, set per thread with AllocationScope
+    enum ALLOCATION_TAG {
+        ALLOCATION_OTHER,
+        ALLOCATION_LOADER,
+        ALLOCATION_TEXTURES,
+        ALLOCATION_SHADERS,
+        ALLOCATION_FRAME,
+        ALLOCATION_TAG_COUNT
+    };
+
+    struct AllocationCounters {
+        unsigned long long allocations, frees;
+        //everything allocated so far, what is still allocated and the most that ever was at once
+        unsigned long long bytes;
+        long long liveBytes, peakBytes;
+    };
+
+    //counts every operator new and delete and every stb_image allocation by subsystem. Opt-in: the hooks
+    //are only compiled with GPS_TRACK_ALLOCATIONS defined, they put a 16 byte header in front of each block;
+    //without it the tags cost a thread local write and every counter stays 0
+    class AllocationTracker
+    {
+    public:
+        //steady state frames with allocations that are printed, later ones are only counted
+        static const int MAX_WARNINGS = 10;
+
+        static bool isCompiledIn();
+        static ALLOCATION_TAG getTag();
+        static void setTag(ALLOCATION_TAG tag);
+        static const char* getTagName(ALLOCATION_TAG tag);
+
+        //malloc, realloc and free with a header that remembers size and tag, used by the hooks
+        static void* allocate(size_t size);
+        static void* reallocate(void* block, size_t size);
+        static void release(void* block);
+
+        //around one frame of the render loop; allocations of every thread in between count for the frame
+        static void beginFrame();
+        //warns about allocations of a steady state frame on stderr
+        static void endFrame();
+        //once set, every allocation on any thread is a leak or a stall in the making and is flagged
+        static void setSteadyState(bool steady);
+        //called for every flagged allocation, put a breakpoint here to see who allocates
+        static void steadyStateAllocation(ALLOCATION_TAG tag, size_t size);
+
+        static AllocationCounters getCounters(ALLOCATION_TAG tag);
+        static unsigned long long getFrameAllocations();
+        static unsigned long long getSteadyStateAllocations();
+
+        //one line per tag, the peak of all tags together and the frames since the steady state began
+        static void writeReport(std::ostream& out);
+    };
+
+    //charges the allocations of the enclosing block on this thread to tag
+    class AllocationScope
+    {
+    public:
+        AllocationScope(ALLOCATION_TAG tag) : previous(AllocationTracker::getTag()) { AllocationTracker::setTag(tag); }
+        ~AllocationScope() { AllocationTracker::setTag(previous); }
+
+    private:
+        ALLOCATION_TAG previous;
+        AllocationScope(const AllocationScope&);
+        AllocationScope& operator=(const AllocationScope&);
+    };
+}
+
+#endif /* AllocationTracker_hpp */
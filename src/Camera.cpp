@@ -19,7 +19,14 @@ namespace gps {
         return glm::lookAt(cameraPosition, cameraPosition + cameraFrontDirection, cameraUpDirection);
     }
 
-    void Camera::previewAnimation() {
+    glm::mat4 Camera::getViewMatrix(const Camera& previous, float alpha) {
+        glm::vec3 position = glm::mix(previous.cameraPosition, cameraPosition, alpha);
+        glm::vec3 front = glm::normalize(glm::mix(previous.cameraFrontDirection, cameraFrontDirection, alpha));
+        glm::vec3 up = glm::normalize(glm::mix(previous.cameraUpDirection, cameraUpDirection, alpha));
+        return glm::lookAt(position, position + front, up);
+    }
+
+    void Camera::previewAnimation(float time) {
         // set the camera to look straight ahead on x coordinate
         this->cameraPosition = glm::vec3(0.0, 5.0, 0.0);
         this->cameraTarget = glm::vec3(0.0, 5.0, -1.0);
@@ -28,8 +35,8 @@ namespace gps {
         this->cameraRightDirection = glm::cross(cameraUpDirection, this->cameraFrontDirection);
         //animate while moving the camera left and right a bit, no loops since  this gets called continuously
         float radius = 3.0f;
-        float camX = sin(glfwGetTime()) * radius;
-        float camZ = cos(glfwGetTime()) * radius;
+        float camX = sin(time) * radius;
+        float camZ = cos(time) * radius;
         this->cameraPosition = glm::vec3(camX, 5.0f, camZ);
         this->cameraTarget = glm::vec3(0.0f, 5.0f, 0.0f);
         this->cameraUpDirection = glm::vec3(0.0f, 1.0f, 0.0f);
@@ -77,4 +84,9 @@ namespace gps {
         this->cameraRightDirection = glm::normalize(glm::cross(this->cameraFrontDirection, glm::vec3(0.0f, 1.0f, 0.0f)));
         this->cameraUpDirection = glm::normalize(glm::cross(this->cameraRightDirection, this->cameraFrontDirection));
     }
+
+    void Camera::setPose(glm::vec3 position, float pitch, float yaw) {
+        this->cameraPosition = position;
+        rotate(pitch, yaw);
+    }
 }
\ No newline at end of file
@@ -17,16 +17,21 @@ namespace gps {
         Camera(glm::vec3 cameraPosition, glm::vec3 cameraTarget, glm::vec3 cameraUp);
         //return the view matrix, using the glm::lookAt() function
         glm::mat4 getViewMatrix();
+        //view matrix between a previous state of this camera (alpha 0) and the current one (alpha 1)
+        glm::mat4 getViewMatrix(const Camera& previous, float alpha);
         //update the camera internal parameters following a camera move event
         void move(MOVE_DIRECTION direction, float speed);
         //update the camera internal parameters following a camera rotate event
         //yaw - camera rotation around the y axis
         //pitch - camera rotation around the x axis
         void rotate(float pitch, float yaw);
+        //moves the camera to position and turns it like rotate
+        void setPose(glm::vec3 position, float pitch, float yaw);
         glm::vec3 getCameraFrontDirection() { return this->cameraFrontDirection; }
         glm::vec3 getCameraPosition() { return this->cameraPosition; }
         glm::vec3 getCameraTarget() { return this->cameraTarget; }
-        void previewAnimation();
+        //circles the stage, time in seconds
+        void previewAnimation(float time);
     private:
         glm::vec3 cameraPosition;
         glm::vec3 cameraFrontDirection;
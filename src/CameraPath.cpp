@@ -0,0 +1,75 @@
+#include "CameraPath.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace gps {
+
+	bool CameraPath::Load(const std::string& fileName)
+	{
+		std::ifstream file(fileName);
+		if (!file.is_open()) {
+			std::cerr << "Could not open camera path " << fileName << std::endl;
+			return false;
+		}
+
+		keys.clear();
+		std::string line;
+		while (std::getline(file, line)) {
+			size_t comment = line.find('#');
+			if (comment != std::string::npos)
+				line.erase(comment);
+			std::istringstream fields(line);
+			CameraKey key;
+			if (fields >> key.time >> key.position.x >> key.position.y >> key.position.z >> key.yaw >> key.pitch)
+				keys.push_back(key);
+		}
+		std::stable_sort(keys.begin(), keys.end(), [](const CameraKey& a, const CameraKey& b) {
+			return a.time < b.time;
+		});
+
+		if (!isLoaded()) {
+			std::cerr << "Camera path " << fileName << " needs at least two keys" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	//centripetal weights are not worth it for hand placed keys, uniform Catmull-Rom
+	static float catmullRom(float p0, float p1, float p2, float p3, float t)
+	{
+		float t2 = t * t, t3 = t2 * t;
+		return 0.5f * (2.0f * p1 + (p2 - p0) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 + (3.0f * p1 - p0 - 3.0f * p2 + p3) * t3);
+	}
+
+	void CameraPath::apply(float time, gps::Camera& camera)
+	{
+		if (!isLoaded())
+			return;
+
+		float duration = getDuration();
+		if (duration > 0.0f)
+			time = std::fmod(std::max(time, 0.0f), duration);
+
+		//the segment holding time, its end points are repeated past both ends of the path
+		size_t segment = 0;
+		while (segment + 2 < keys.size() && keys[segment + 1].time <= time)
+			segment++;
+		const CameraKey& k0 = keys[segment > 0 ? segment - 1 : 0];
+		const CameraKey& k1 = keys[segment];
+		const CameraKey& k2 = keys[segment + 1];
+		const CameraKey& k3 = keys[std::min(segment + 2, keys.size() - 1)];
+		float length = k2.time - k1.time;
+		float t = length > 0.0f ? std::min(std::max((time - k1.time) / length, 0.0f), 1.0f) : 0.0f;
+
+		glm::vec3 position;
+		for (int c = 0; c < 3; c++)
+			position[c] = catmullRom(k0.position[c], k1.position[c], k2.position[c], k3.position[c], t);
+		float yaw = catmullRom(k0.yaw, k1.yaw, k2.yaw, k3.yaw, t);
+		float pitch = catmullRom(k0.pitch, k1.pitch, k2.pitch, k3.pitch, t);
+		camera.setPose(position, pitch, yaw);
+	}
+}
@@ -0,0 +1,38 @@
+#ifndef CameraPath_hpp
+#define CameraPath_hpp
+
+#include "glm/glm.hpp"
+
+#include "Camera.hpp"
+
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    //one control point of a camera path, angles in degrees as taken by Camera::rotate
+    struct CameraKey {
+        float time;
+        glm::vec3 position;
+        float yaw;
+        float pitch;
+    };
+
+    //a Catmull-Rom spline through timed camera poses, read from a text file with one
+    //"time x y z yaw pitch" line per key; # starts a comment
+    class CameraPath
+    {
+    public:
+        bool Load(const std::string& fileName);
+        bool isLoaded() { return keys.size() >= 2; }
+        float getDuration() { return keys.empty() ? 0.0f : keys.back().time; }
+
+        //places the camera at the given time, the path repeats after its duration
+        void apply(float time, gps::Camera& camera);
+
+    private:
+        std::vector<CameraKey> keys;
+    };
+}
+
+#endif /* CameraPath_hpp */
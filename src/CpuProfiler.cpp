@@ -0,0 +1,159 @@
+#include "CpuProfiler.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gps {
+
+	//written only by its thread; head counts every zone ever recorded and is published after the zone
+	struct CpuZoneRing {
+		std::atomic<unsigned long long> head;
+		CpuZoneRecord zones[CpuProfiler::RING_SIZE];
+		unsigned int threadId;
+		std::string threadName;
+	};
+
+	std::atomic<bool> CpuProfiler::enabled(false);
+
+	//rings are never freed, the zones of finished threads stay in the trace
+	static std::mutex ringsMutex;
+	static std::vector<CpuZoneRing*> rings;
+	static thread_local CpuZoneRing* threadRing = NULL;
+
+	//the counter and the clock at the moment of enabling, to turn ticks into microseconds
+	static unsigned long long originTicks = 0;
+	static std::chrono::steady_clock::time_point originTime;
+
+	static CpuZoneRing* getThreadRing()
+	{
+		if (!threadRing) {
+			threadRing = new CpuZoneRing();
+			threadRing->head.store(0);
+			std::lock_guard<std::mutex> lock(ringsMutex);
+			threadRing->threadId = (unsigned int)rings.size() + 1;
+			rings.push_back(threadRing);
+		}
+		return threadRing;
+	}
+
+	void CpuProfiler::setEnabled(bool enabled)
+	{
+		if (enabled && !isEnabled()) {
+			originTicks = now();
+			originTime = std::chrono::steady_clock::now();
+		}
+		CpuProfiler::enabled.store(enabled, std::memory_order_relaxed);
+	}
+
+	void CpuProfiler::setThreadName(const char* name)
+	{
+		//threads of a run without profiling get no ring
+		if (!isEnabled())
+			return;
+		CpuZoneRing* ring = getThreadRing();
+		std::lock_guard<std::mutex> lock(ringsMutex);
+		ring->threadName = name;
+	}
+
+	void CpuProfiler::record(const char* name, const char* detail, unsigned long long begin, unsigned long long end)
+	{
+		CpuZoneRing* ring = getThreadRing();
+		unsigned long long head = ring->head.load(std::memory_order_relaxed);
+		CpuZoneRecord& zone = ring->zones[head & (RING_SIZE - 1)];
+		zone.name = name;
+		zone.begin = begin;
+		zone.end = end;
+		zone.detail[0] = '\0';
+		if (detail) {
+			std::strncpy(zone.detail, detail, sizeof(zone.detail) - 1);
+			zone.detail[sizeof(zone.detail) - 1] = '\0';
+		}
+		ring->head.store(head + 1, std::memory_order_release);
+	}
+
+	static void writeJsonString(std::ofstream& file, const char* text)
+	{
+		file << '"';
+		for (const char* c = text; *c; c++) {
+			if (*c == '"' || *c == '\\')
+				file << '\\' << *c;
+			else if ((unsigned char)*c >= 0x20)
+				file << *c;
+		}
+		file << '"';
+	}
+
+	bool CpuProfiler::writeTrace(const std::string& fileName)
+	{
+		//ticks per microsecond, measured over everything since enabling
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		double elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - originTime).count();
+		double ticksPerMicrosecond = (double)(now() - originTicks) / elapsed;
+
+		std::vector<CpuZoneRing*> threads;
+		{
+			std::lock_guard<std::mutex> lock(ringsMutex);
+			threads = rings;
+		}
+
+		std::ofstream file(fileName, std::ios::trunc);
+		if (!file) {
+			std::cerr << "Could not write the trace " << fileName << std::endl;
+			return false;
+		}
+		file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+		file << std::fixed << std::setprecision(3);
+		bool first = true;
+		size_t zoneCount = 0;
+		std::vector<CpuZoneRecord> zones;
+		for (size_t t = 0; t < threads.size(); t++) {
+			CpuZoneRing* ring = threads[t];
+			{
+				std::lock_guard<std::mutex> lock(ringsMutex);
+				if (!ring->threadName.empty()) {
+					file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << ring->threadId << ",\"args\":{\"name\":";
+					writeJsonString(file, ring->threadName.c_str());
+					file << "}}";
+					first = false;
+				}
+			}
+
+			//copy first, then drop whatever the owner may have overwritten during the copy
+			unsigned long long head = ring->head.load(std::memory_order_acquire);
+			unsigned long long oldest = head > RING_SIZE ? head - RING_SIZE : 0;
+			zones.clear();
+			for (unsigned long long i = oldest; i < head; i++)
+				zones.push_back(ring->zones[i & (RING_SIZE - 1)]);
+			unsigned long long newHead = ring->head.load(std::memory_order_acquire);
+			size_t skip = newHead > RING_SIZE && newHead - RING_SIZE > oldest ? (size_t)std::min(newHead - RING_SIZE - oldest, head - oldest) : 0;
+
+			for (size_t i = skip; i < zones.size(); i++) {
+				const CpuZoneRecord& zone = zones[i];
+				if (zone.begin < originTicks)
+					continue;
+				file << (first ? "" : ",\n") << "{\"name\":";
+				writeJsonString(file, zone.name);
+				file << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << ring->threadId
+					<< ",\"ts\":" << (double)(zone.begin - originTicks) / ticksPerMicrosecond
+					<< ",\"dur\":" << (double)(zone.end - zone.begin) / ticksPerMicrosecond;
+				if (zone.detail[0]) {
+					file << ",\"args\":{\"detail\":";
+					writeJsonString(file, zone.detail);
+					file << "}";
+				}
+				file << "}";
+				first = false;
+				zoneCount++;
+			}
+		}
+		file << "\n]}\n";
+		std::cout << "Trace: " << zoneCount << " zones of " << threads.size() << " threads written to " << fileName << std::endl;
+		return (bool)file;
+	}
+}
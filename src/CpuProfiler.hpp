@@ -0,0 +1,79 @@
+#ifndef CpuProfiler_hpp
+#define CpuProfiler_hpp
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define GPS_PROFILER_TSC 1
+#endif
+
+namespace gps {
+
+    //one finished zone; name points to a string literal, detail is copied and may be cut short
+    struct CpuZoneRecord {
+        const char* name;
+        unsigned long long begin, end;
+        char detail[40];
+    };
+
+    //scoped CPU zones of every thread on one timeline; each thread writes its own ring without locks
+    //and the rings are dumped as Chrome trace_event JSON, for chrome://tracing or Perfetto
+    class CpuProfiler
+    {
+    public:
+        //zones per thread ring, older zones are overwritten
+        static const unsigned int RING_SIZE = 1 << 15;
+
+        //zones are only recorded while enabled; enabling calibrates the clock
+        static void setEnabled(bool enabled);
+        static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+        //shown as the thread's row in the trace, call from the thread itself once enabled
+        static void setThreadName(const char* name);
+
+        //the time stamp counter where there is one, steady_clock nanoseconds otherwise
+        static unsigned long long now() {
+#ifdef GPS_PROFILER_TSC
+            return __rdtsc();
+#else
+            return (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+        }
+        static void record(const char* name, const char* detail, unsigned long long begin, unsigned long long end);
+
+        //everything the rings still hold; safe while other threads keep recording
+        static bool writeTrace(const std::string& fileName);
+
+    private:
+        static std::atomic<bool> enabled;
+    };
+
+    //records the enclosing block as a zone when the profiler is enabled
+    class CpuZone
+    {
+    public:
+        CpuZone(const char* name, const char* detail = NULL) : name(CpuProfiler::isEnabled() ? name : NULL), detail(detail) {
+            if (this->name)
+                begin = CpuProfiler::now();
+        }
+        ~CpuZone() {
+            if (name)
+                CpuProfiler::record(name, detail, begin, CpuProfiler::now());
+        }
+
+    private:
+        const char* name;
+        const char* detail;
+        unsigned long long begin = 0;
+        CpuZone(const CpuZone&);
+        CpuZone& operator=(const CpuZone&);
+    };
+}
+
+#endif /* CpuProfiler_hpp */
@@ -0,0 +1,273 @@
+#include "Crowd.hpp"
+#include "MemoryStats.hpp"
+#include "RenderStats.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace gps {
+
+	//the cull shader reads and writes instances as 5 words
+	static_assert(sizeof(CrowdInstance) == 5 * sizeof(GLuint), "CrowdInstance must be tightly packed");
+
+	GLuint Crowd::hash(GLuint x)
+	{
+		x ^= x >> 16;
+		x *= 0x7feb352dU;
+		x ^= x >> 15;
+		x *= 0x846ca68bU;
+		x ^= x >> 16;
+		return x;
+	}
+
+	float Crowd::hashToUnit(GLuint x)
+	{
+		return (float)(hash(x) >> 8) / 16777216.0f;
+	}
+
+	void Crowd::Init(gps::Model3D* model, glm::vec3 origin, int rows, int columns, float spacing, float maxAngle)
+	{
+		this->model = model;
+		//one instanced or indirect draw per material instead of one per mesh
+		model->mergeMeshes();
+
+		instances.resize(rows * columns);
+		for (int i = 0; i < rows; i++) {
+			for (int j = 0; j < columns; j++) {
+				CrowdInstance& instance = instances[i * columns + j];
+				//every person gets its own seed, the rotation comes from the same hash as the jump
+				instance.seed = hash((GLuint)(i * columns + j) + 1u);
+				float angle = glm::radians(maxAngle * hashToUnit(instance.seed + 3u));
+				instance.placement = glm::vec4(origin + glm::vec3(i * spacing, 0.0f, j * spacing), angle);
+			}
+		}
+
+		//both buffers can hold everyone, until the first upload all of them are near
+		glGenBuffers(1, &nearBuffer);
+		glGenBuffers(1, &farBuffer);
+		uploadInstances(nearBuffer, instances);
+		uploadInstances(farBuffer, std::vector<CrowdInstance>());
+		//re-orphaned at the same size by every upload
+		MemoryStats::trackBuffer(nearBuffer, instances.size() * sizeof(CrowdInstance), "crowd");
+		MemoryStats::trackBuffer(farBuffer, instances.size() * sizeof(CrowdInstance), "crowd");
+		nearCount = (GLsizei)instances.size();
+		farCount = 0;
+		model->setInstanceBuffer(nearBuffer);
+	}
+
+	void Crowd::Delete()
+	{
+		MemoryStats::deleteBuffers(1, &nearBuffer);
+		MemoryStats::deleteBuffers(1, &farBuffer);
+		MemoryStats::deleteBuffers(1, &instanceStorage);
+		MemoryStats::deleteBuffers(1, &boundsBuffer);
+		MemoryStats::deleteBuffers(1, &commandBuffer);
+		nearBuffer = farBuffer = instanceStorage = boundsBuffer = commandBuffer = 0;
+		gpuCulling = false;
+		nearCount = farCount = 0;
+		instances.clear();
+	}
+
+	void Crowd::setImpostor(gps::Impostor* impostor, float distance)
+	{
+		this->impostor = impostor;
+		this->impostorDistance = distance;
+		impostor->setInstanceBuffer(farBuffer);
+	}
+
+	void Crowd::partition(glm::vec3 eye, std::vector<CrowdInstance>& nearInstances, std::vector<CrowdInstance>& farInstances)
+	{
+		nearInstances.clear();
+		farInstances.clear();
+		if (gpuCulling)
+			return;
+		if (!impostor) {
+			nearInstances = instances;
+			return;
+		}
+		//room for everyone on either side, the split moves with the camera
+		nearInstances.reserve(instances.size());
+		farInstances.reserve(instances.size());
+		//one distance test per person, the animation itself stays on the GPU
+		float distanceSquared = impostorDistance * impostorDistance;
+		for (size_t i = 0; i < instances.size(); i++) {
+			glm::vec3 offset = glm::vec3(instances[i].placement) - eye;
+			if (offset.x * offset.x + offset.y * offset.y + offset.z * offset.z > distanceSquared)
+				farInstances.push_back(instances[i]);
+			else
+				nearInstances.push_back(instances[i]);
+		}
+	}
+
+	void Crowd::uploadInstances(GLuint buffer, const std::vector<CrowdInstance>& source)
+	{
+		//orphan the whole buffer so the draws of the previous frame keep their data
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(CrowdInstance), NULL, GL_STREAM_DRAW);
+		if (!source.empty())
+			RenderStats::bufferSubData(GL_ARRAY_BUFFER, 0, source.size() * sizeof(CrowdInstance), source.data());
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	void Crowd::Upload(const std::vector<CrowdInstance>& nearInstances, const std::vector<CrowdInstance>& farInstances)
+	{
+		uploadInstances(nearBuffer, nearInstances);
+		nearCount = (GLsizei)nearInstances.size();
+		if (impostor) {
+			uploadInstances(farBuffer, farInstances);
+			farCount = (GLsizei)farInstances.size();
+		}
+	}
+
+	void Crowd::enableGpuCulling(gps::Shader cullShader)
+	{
+		this->cullShader = cullShader;
+		GLsizeiptr count = (GLsizeiptr)instances.size();
+
+		//a sphere around every person standing and at the top of the jump
+		glm::vec3 boundsMin = model->getBoundsMin();
+		glm::vec3 boundsMax = model->getBoundsMax();
+		float extentX = std::max(std::fabs(boundsMin.x), std::fabs(boundsMax.x));
+		float extentZ = std::max(std::fabs(boundsMin.z), std::fabs(boundsMax.z));
+		float halfHeight = (boundsMax.y - boundsMin.y + MAX_JUMP) * 0.5f;
+		float radius = std::sqrt(extentX * extentX + extentZ * extentZ + halfHeight * halfHeight);
+		std::vector<glm::vec4> bounds(instances.size());
+		for (size_t i = 0; i < instances.size(); i++)
+			bounds[i] = glm::vec4(glm::vec3(instances[i].placement) + glm::vec3(0.0f, boundsMin.y + halfHeight, 0.0f), radius);
+
+		glGenBuffers(1, &instanceStorage);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, instanceStorage);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, count * sizeof(CrowdInstance), instances.data(), GL_STATIC_DRAW);
+		glGenBuffers(1, &boundsBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, boundsBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, count * sizeof(glm::vec4), bounds.data(), GL_STATIC_DRAW);
+		MemoryStats::trackBuffer(instanceStorage, count * sizeof(CrowdInstance), "crowd");
+		MemoryStats::trackBuffer(boundsBuffer, count * sizeof(glm::vec4), "crowd");
+
+		//the shader compacts into these, view v starts at instance v * count through baseInstance
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, nearBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, CROWD_VIEW_COUNT * count * sizeof(CrowdInstance), NULL, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, farBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, CROWD_VIEW_COUNT * count * sizeof(CrowdInstance), NULL, GL_DYNAMIC_COPY);
+		MemoryStats::trackBuffer(nearBuffer, CROWD_VIEW_COUNT * count * sizeof(CrowdInstance), "crowd");
+		MemoryStats::trackBuffer(farBuffer, CROWD_VIEW_COUNT * count * sizeof(CrowdInstance), "crowd");
+
+		//DrawElementsIndirectCommand per sub mesh: count, instanceCount, firstIndex, baseVertex, baseInstance;
+		//then DrawArraysIndirectCommand of the impostor: count, instanceCount, first, baseInstance
+		commandTemplate.clear();
+		for (int view = 0; view < CROWD_VIEW_COUNT; view++) {
+			for (int mesh = 0; mesh < model->getSubMeshCount(); mesh++) {
+				const SubMesh& subMesh = model->getSubMesh(mesh);
+				GLuint command[5] = { (GLuint)subMesh.indexCount, 0, subMesh.firstIndex, 0, (GLuint)(view * count) };
+				commandTemplate.insert(commandTemplate.end(), command, command + 5);
+			}
+			GLuint impostorCommand[4] = { 4, 0, 0, (GLuint)(view * count) };
+			commandTemplate.insert(commandTemplate.end(), impostorCommand, impostorCommand + 4);
+		}
+		glGenBuffers(1, &commandBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, commandTemplate.size() * sizeof(GLuint), commandTemplate.data(), GL_DYNAMIC_COPY);
+		MemoryStats::trackBuffer(commandBuffer, commandTemplate.size() * sizeof(GLuint), "crowd");
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		gpuCulling = true;
+	}
+
+	void Crowd::cull(CROWD_VIEW view, const glm::mat4& viewProjection, glm::vec3 eye, gps::DepthPyramid* occlusion)
+	{
+		if (!gpuCulling || instances.empty())
+			return;
+
+		//the shader only counts up, so the view starts from its template every frame
+		GLsizeiptr viewWords = commandTemplate.size() / CROWD_VIEW_COUNT;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+		RenderStats::bufferSubData(GL_SHADER_STORAGE_BUFFER, getCommandOffset(view), viewWords * sizeof(GLuint), &commandTemplate[view * viewWords]);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		//frustum planes as rows of the clip matrix, normalized for the sphere test
+		glm::vec4 planes[6];
+		for (int p = 0; p < 6; p++) {
+			int axis = p / 2;
+			float side = (p % 2 == 0) ? 1.0f : -1.0f;
+			for (int c = 0; c < 4; c++)
+				planes[p][c] = viewProjection[c][3] + side * viewProjection[c][axis];
+			planes[p] = planes[p] * (1.0f / glm::length(glm::vec3(planes[p])));
+		}
+
+		cullShader.useShaderProgram();
+		GLuint program = cullShader.shaderProgram;
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instanceStorage);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, boundsBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, commandBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, nearBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, farBuffer);
+		glUniform1ui(glGetUniformLocation(program, "instanceCount"), (GLuint)instances.size());
+		glUniform4fv(glGetUniformLocation(program, "frustumPlanes"), 6, &planes[0][0]);
+		glUniform3f(glGetUniformLocation(program, "eye"), eye.x, eye.y, eye.z);
+		glUniform1f(glGetUniformLocation(program, "impostorDistance"), impostor ? impostorDistance : 0.0f);
+		glUniform1ui(glGetUniformLocation(program, "meshCount"), (GLuint)model->getSubMeshCount());
+		glUniform1ui(glGetUniformLocation(program, "firstCommand"), (GLuint)(view * viewWords));
+		glUniform1ui(glGetUniformLocation(program, "firstInstance"), (GLuint)(view * instances.size()));
+
+		bool useOcclusion = occlusion && occlusion->isValid();
+		glUniform1i(glGetUniformLocation(program, "occlusion"), useOcclusion);
+		if (useOcclusion) {
+			occlusion->Bind(PYRAMID_UNIT);
+			glUniform1i(glGetUniformLocation(program, "depthPyramid"), PYRAMID_UNIT);
+			glUniformMatrix4fv(glGetUniformLocation(program, "occlusionViewProjection"), 1, GL_FALSE, &occlusion->getViewProjection()[0][0]);
+		}
+
+		glDispatchCompute((GLuint)((instances.size() + 63) / 64), 1, 1);
+		//the draws read the counts as commands and the lists as instance attributes
+		glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+	}
+
+	void Crowd::readVisibleCounts(CROWD_VIEW view, GLuint& nearVisible, GLuint& farVisible)
+	{
+		nearVisible = farVisible = 0;
+		if (!gpuCulling || instances.empty())
+			return;
+		//every sub mesh command counts the same near people, the first one is enough
+		GLsizeiptr offset = getCommandOffset(view);
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, offset + sizeof(GLuint), sizeof(GLuint), &nearVisible);
+		if (impostor)
+			glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, offset + (model->getSubMeshCount() * 5 + 1) * sizeof(GLuint), sizeof(GLuint), &farVisible);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	void Crowd::Draw(CROWD_VIEW view, gps::Shader shader, gps::Shader impostorShader)
+	{
+		if (gpuCulling) {
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+			GLintptr offset = getCommandOffset(view);
+			model->DrawIndirect(shader, offset, 5 * sizeof(GLuint));
+			if (impostor)
+				impostor->DrawIndirect(impostorShader, offset + model->getSubMeshCount() * 5 * sizeof(GLuint));
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+			return;
+		}
+		if (nearCount > 0)
+			model->Draw(shader, nearCount);
+		if (impostor && farCount > 0)
+			impostor->Draw(impostorShader, farCount);
+	}
+
+	void Crowd::Draw(CROWD_VIEW view, gps::ShaderPermutations& permutations, unsigned int features)
+	{
+		if (gpuCulling) {
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+			GLintptr offset = getCommandOffset(view);
+			model->DrawIndirect(permutations, features | FEATURE_CROWD, offset, 5 * sizeof(GLuint));
+			if (impostor)
+				impostor->DrawIndirect(permutations, features, offset + model->getSubMeshCount() * 5 * sizeof(GLuint));
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+			return;
+		}
+		if (nearCount > 0)
+			model->Draw(permutations, features | FEATURE_CROWD, nearCount);
+		if (impostor && farCount > 0)
+			impostor->Draw(permutations, features, farCount);
+	}
+}
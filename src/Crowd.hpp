@@ -0,0 +1,91 @@
+#ifndef Crowd_hpp
+#define Crowd_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include "Model3D.hpp"
+#include "Impostor.hpp"
+#include "DepthPyramid.hpp"
+#include "Shader.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    //every view has its own culled instance lists and indirect commands
+    enum CROWD_VIEW {
+        CROWD_VIEW_CAMERA = 0,
+        CROWD_VIEW_SHADOW = 1,
+        CROWD_VIEW_COUNT = 2
+    };
+
+    //a grid of people drawn with instanced calls; the jump is computed in the vertex shader
+    //from the seed and the frame time, so the CPU never animates a single person
+    class Crowd
+    {
+    public:
+        //rows x columns people starting at origin, spacing apart, each turned by up to maxAngle degrees
+        void Init(gps::Model3D* model, glm::vec3 origin, int rows, int columns, float spacing, float maxAngle);
+        void Delete();
+
+        //people further than distance from the eye are drawn as impostor quads
+        void setImpostor(gps::Impostor* impostor, float distance);
+        //splits the people by their distance from the eye, thread safe; everyone is near without an impostor
+        void partition(glm::vec3 eye, std::vector<CrowdInstance>& nearInstances, std::vector<CrowdInstance>& farInstances);
+        //streams the split of this frame to the instance buffers, once per frame before drawing
+        void Upload(const std::vector<CrowdInstance>& nearInstances, const std::vector<CrowdInstance>& farInstances);
+
+        //moves culling and the near/far split into cullShader, after this partition and Upload are unused;
+        //needs a 4.3 context and the impostor, if any, set before
+        void enableGpuCulling(gps::Shader cullShader);
+        bool isGpuCulled() { return gpuCulling; }
+        //frustum culls against viewProjection, and against the previous frame's depth when occlusion is given,
+        //then writes the instance lists and indirect commands of the view; once per view and frame before drawing
+        void cull(CROWD_VIEW view, const glm::mat4& viewProjection, glm::vec3 eye, gps::DepthPyramid* occlusion);
+        //the people the last cull of view left as meshes and as impostors, read back from the commands;
+        //stalls until the GPU has culled, meant for the regression only
+        void readVisibleCounts(CROWD_VIEW view, GLuint& nearVisible, GLuint& farVisible);
+
+        //the view only matters with GPU culling, otherwise both views draw the split from Upload
+        void Draw(CROWD_VIEW view, gps::Shader shader, gps::Shader impostorShader);
+        //the mesh variant is picked with FEATURE_CROWD added, the impostor one with FEATURE_IMPOSTOR
+        void Draw(CROWD_VIEW view, gps::ShaderPermutations& permutations, unsigned int features);
+
+        int getCount() { return (int)instances.size(); }
+
+        //lowbias32 integer hash, the CROWD shaders use the same one
+        static GLuint hash(GLuint x);
+        //hash mapped to [0, 1)
+        static float hashToUnit(GLuint x);
+        //highest jump of crowdModel in the shaders
+        static constexpr float MAX_JUMP = 0.6f;
+        //texture unit of the depth pyramid while culling
+        static const GLuint PYRAMID_UNIT = 9;
+
+    private:
+        gps::Model3D* model = nullptr;
+        gps::Impostor* impostor = nullptr;
+        float impostorDistance = 0.0f;
+        std::vector<CrowdInstance> instances;
+        //instances drawn as meshes and as impostors this frame
+        GLuint nearBuffer = 0;
+        GLuint farBuffer = 0;
+        GLsizei nearCount = 0;
+        GLsizei farCount = 0;
+
+        //GPU culling: the instances and their bounding spheres as storage buffers, and per view the mesh
+        //commands followed by the impostor command; near and far buffers hold a list per view
+        bool gpuCulling = false;
+        gps::Shader cullShader;
+        GLuint instanceStorage = 0;
+        GLuint boundsBuffer = 0;
+        GLuint commandBuffer = 0;
+        std::vector<GLuint> commandTemplate;
+
+        GLsizeiptr getCommandOffset(CROWD_VIEW view) { return view * (commandTemplate.size() / CROWD_VIEW_COUNT) * sizeof(GLuint); }
+        void uploadInstances(GLuint buffer, const std::vector<CrowdInstance>& source);
+    };
+}
+
+#endif /* Crowd_hpp */
@@ -0,0 +1,112 @@
+#include "DepthPyramid.hpp"
+#include "MemoryStats.hpp"
+#include "RenderStats.hpp"
+
+#include <algorithm>
+
+namespace gps {
+
+	GLenum DepthPyramid::sourceDepthFormat(GLuint framebuffer)
+	{
+		//depth blits need identical depth and stencil formats on both sides
+		GLint depthBits = 0, stencilBits = 0, type = GL_UNSIGNED_NORMALIZED;
+		GLenum depth = framebuffer == 0 ? GL_DEPTH : GL_DEPTH_ATTACHMENT;
+		GLenum stencil = framebuffer == 0 ? GL_STENCIL : GL_STENCIL_ATTACHMENT;
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+		glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, depth, GL_FRAMEBUFFER_ATTACHMENT_DEPTH_SIZE, &depthBits);
+		glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, stencil, GL_FRAMEBUFFER_ATTACHMENT_STENCIL_SIZE, &stencilBits);
+		glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, depth, GL_FRAMEBUFFER_ATTACHMENT_COMPONENT_TYPE, &type);
+		if (depthBits == 32 && type == GL_FLOAT)
+			return stencilBits > 0 ? GL_DEPTH32F_STENCIL8 : GL_DEPTH_COMPONENT32F;
+		if (depthBits == 16)
+			return GL_DEPTH_COMPONENT16;
+		return stencilBits > 0 ? GL_DEPTH24_STENCIL8 : GL_DEPTH_COMPONENT24;
+	}
+
+	void DepthPyramid::Init(int width, int height, gps::Shader copyShader, gps::Shader reduceShader, GLuint sourceFramebuffer)
+	{
+		this->sourceFramebuffer = sourceFramebuffer;
+		this->width = width;
+		this->height = height;
+		this->copyShader = copyShader;
+		this->reduceShader = reduceShader;
+		levels = 1;
+		while ((std::max(width, height) >> levels) > 0)
+			levels++;
+
+		GLenum format = sourceDepthFormat(sourceFramebuffer);
+		glGenTextures(1, &depthCopy);
+		glBindTexture(GL_TEXTURE_2D, depthCopy);
+		glTexStorage2D(GL_TEXTURE_2D, 1, format, width, height);
+		MemoryStats::trackTexture(depthCopy, MemoryStats::textureBytes(format, width, height, 1, 1), "depth pyramid");
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glGenFramebuffers(1, &copyFramebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, copyFramebuffer);
+		GLenum attachment = (format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH32F_STENCIL8) ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+		glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, depthCopy, 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		glBindFramebuffer(GL_FRAMEBUFFER, sourceFramebuffer);
+
+		glGenTextures(1, &pyramid);
+		glBindTexture(GL_TEXTURE_2D, pyramid);
+		glTexStorage2D(GL_TEXTURE_2D, levels, GL_R32F, width, height);
+		MemoryStats::trackTexture(pyramid, MemoryStats::textureBytes(GL_R32F, width, height, 1, levels), "depth pyramid");
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		valid = false;
+	}
+
+	void DepthPyramid::Delete()
+	{
+		glDeleteFramebuffers(1, &copyFramebuffer);
+		MemoryStats::deleteTextures(1, &depthCopy);
+		MemoryStats::deleteTextures(1, &pyramid);
+		copyFramebuffer = depthCopy = pyramid = 0;
+		valid = false;
+	}
+
+	void DepthPyramid::Build(const glm::mat4& viewProjection)
+	{
+		if (pyramid == 0)
+			return;
+
+		//resolves the (multisampled) scene depth into the copy
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, sourceFramebuffer);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, copyFramebuffer);
+		glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, sourceFramebuffer);
+
+		//level 0 from the copy, then every level from the one below
+		RenderStats::activeTexture(GL_TEXTURE0);
+		copyShader.useShaderProgram();
+		RenderStats::bindTexture(GL_TEXTURE_2D, depthCopy);
+		glBindImageTexture(0, pyramid, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		glDispatchCompute((width + 7) / 8, (height + 7) / 8, 1);
+
+		reduceShader.useShaderProgram();
+		RenderStats::bindTexture(GL_TEXTURE_2D, pyramid);
+		GLint sourceLevelLoc = glGetUniformLocation(reduceShader.shaderProgram, "sourceLevel");
+		for (int level = 1; level < levels; level++) {
+			glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+			int levelWidth = std::max(width >> level, 1);
+			int levelHeight = std::max(height >> level, 1);
+			RenderStats::uniform1i(sourceLevelLoc, level - 1);
+			glBindImageTexture(0, pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+			glDispatchCompute((levelWidth + 7) / 8, (levelHeight + 7) / 8, 1);
+		}
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+		RenderStats::bindTexture(GL_TEXTURE_2D, 0);
+
+		this->viewProjection = viewProjection;
+		valid = true;
+	}
+
+	void DepthPyramid::Bind(GLuint unit)
+	{
+		RenderStats::activeTexture(GL_TEXTURE0 + unit);
+		RenderStats::bindTexture(GL_TEXTURE_2D, pyramid);
+	}
+}
@@ -0,0 +1,47 @@
+#ifndef DepthPyramid_hpp
+#define DepthPyramid_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include "Shader.hpp"
+
+namespace gps {
+
+    //hierarchical Z of the framebuffer the scene is rendered to: every mip level keeps the farthest depth of the
+    //texels below it, so one fetch tells whether a screen rectangle was covered; needs a 4.3 context
+    class DepthPyramid
+    {
+    public:
+        //copyShader turns the depth into level 0, reduceShader builds every further level;
+        //sourceFramebuffer is where the frame is rendered, 0 for the window
+        void Init(int width, int height, gps::Shader copyShader, gps::Shader reduceShader, GLuint sourceFramebuffer);
+        void Delete();
+
+        //copies the depth of the frame just rendered with viewProjection and reduces it
+        void Build(const glm::mat4& viewProjection);
+        bool isValid() { return valid; }
+        //the view projection the pyramid was built with
+        const glm::mat4& getViewProjection() { return viewProjection; }
+        void Bind(GLuint unit);
+
+    private:
+        int width = 0;
+        GLuint sourceFramebuffer = 0;
+        int height = 0;
+        int levels = 0;
+        bool valid = false;
+        glm::mat4 viewProjection = glm::mat4(1.0f);
+        //single sampled copy of the scene depth, in the format of the source so it can be blitted
+        GLuint depthCopy = 0;
+        GLuint copyFramebuffer = 0;
+        //R32F with a full mip chain
+        GLuint pyramid = 0;
+        gps::Shader copyShader;
+        gps::Shader reduceShader;
+
+        static GLenum sourceDepthFormat(GLuint framebuffer);
+    };
+}
+
+#endif /* DepthPyramid_hpp */
@@ -0,0 +1,175 @@
+#include "FrameBenchmark.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+
+namespace gps {
+
+	void FrameBenchmark::Init(int frameCount, int warmupFrames)
+	{
+		this->frameCount = frameCount;
+		this->warmupFrames = std::min(warmupFrames, frameCount / 2);
+		frames.clear();
+		frames.reserve(frameCount);
+		for (int i = 0; i < QUERY_FRAMES; i++) {
+			glGenQueries(2, queries[i]);
+			queryFrame[i] = -1;
+		}
+		nextQuery = 0;
+		started = false;
+	}
+
+	void FrameBenchmark::Delete()
+	{
+		for (int i = 0; i < QUERY_FRAMES; i++)
+			glDeleteQueries(2, queries[i]);
+	}
+
+	void FrameBenchmark::beginFrame()
+	{
+		if (isDone())
+			return;
+		collect(false);
+		//every pair is in flight: wait for the oldest instead of dropping a frame
+		if (queryFrame[nextQuery] != -1)
+			collect(true);
+
+		frameStart = std::chrono::steady_clock::now();
+		glQueryCounter(queries[nextQuery][0], GL_TIMESTAMP);
+	}
+
+	void FrameBenchmark::endFrame()
+	{
+		if (isDone())
+			return;
+		glQueryCounter(queries[nextQuery][1], GL_TIMESTAMP);
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+		//the frame time runs from one frame start to the next, so it includes the swap
+		Frame frame;
+		frame.cpuTime = std::chrono::duration<double, std::milli>(end - frameStart).count();
+		frame.frameTime = started ? std::chrono::duration<double, std::milli>(frameStart - lastFrameStart).count() : frame.cpuTime;
+		frame.gpuTime = 0.0;
+		lastFrameStart = frameStart;
+		started = true;
+
+		queryFrame[nextQuery] = (int)frames.size();
+		nextQuery = (nextQuery + 1) % QUERY_FRAMES;
+		frames.push_back(frame);
+	}
+
+	void FrameBenchmark::collect(bool wait)
+	{
+		//oldest first, stops at the first pair that is not ready unless waiting
+		for (int k = 0; k < QUERY_FRAMES; k++) {
+			int i = (nextQuery + k) % QUERY_FRAMES;
+			if (queryFrame[i] == -1)
+				continue;
+			GLint available = 0;
+			glGetQueryObjectiv(queries[i][1], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available && !wait)
+				return;
+			GLuint64 begin = 0, end = 0;
+			glGetQueryObjectui64v(queries[i][0], GL_QUERY_RESULT, &begin);
+			glGetQueryObjectui64v(queries[i][1], GL_QUERY_RESULT, &end);
+			frames[queryFrame[i]].gpuTime = (double)(end - begin) / 1000000.0;
+			queryFrame[i] = -1;
+			if (wait)
+				return;
+		}
+	}
+
+	void FrameBenchmark::finish()
+	{
+		for (int i = 0; i < QUERY_FRAMES; i++)
+			collect(true);
+	}
+
+	bool FrameBenchmark::writeCsv(const std::string& fileName)
+	{
+		std::ofstream file(fileName, std::ios::trunc);
+		if (!file.is_open())
+			return false;
+		file << "frame,frame_ms,cpu_ms,gpu_ms,warmup\n";
+		file << std::fixed << std::setprecision(4);
+		for (size_t i = 0; i < frames.size(); i++) {
+			file << i << "," << frames[i].frameTime << "," << frames[i].cpuTime << "," << frames[i].gpuTime << ","
+				<< ((int)i < warmupFrames ? 1 : 0) << "\n";
+		}
+		return true;
+	}
+
+	FrameTimeStats FrameBenchmark::computeStats(std::vector<double> values)
+	{
+		FrameTimeStats stats = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+		if (values.empty())
+			return stats;
+		std::sort(values.begin(), values.end());
+		//nearest rank
+		auto percentile = [&values](double p) {
+			size_t rank = (size_t)std::ceil(p / 100.0 * values.size());
+			return values[std::min(std::max(rank, (size_t)1), values.size()) - 1];
+		};
+		stats.min = values.front();
+		stats.max = values.back();
+		double sum = 0.0;
+		for (size_t i = 0; i < values.size(); i++)
+			sum += values[i];
+		stats.mean = sum / values.size();
+		stats.p50 = percentile(50.0);
+		stats.p95 = percentile(95.0);
+		stats.p99 = percentile(99.0);
+		return stats;
+	}
+
+	int FrameBenchmark::countStutters(double median)
+	{
+		int stutters = 0;
+		for (size_t i = warmupFrames; i < frames.size(); i++) {
+			if (frames[i].frameTime > 2.0 * median)
+				stutters++;
+		}
+		return stutters;
+	}
+
+	std::vector<double> FrameBenchmark::column(int index)
+	{
+		std::vector<double> values;
+		for (size_t i = warmupFrames; i < frames.size(); i++)
+			values.push_back(index == 0 ? frames[i].frameTime : index == 1 ? frames[i].cpuTime : frames[i].gpuTime);
+		return values;
+	}
+
+	void FrameBenchmark::writeSummary(std::ostream& out, const std::string& fileName)
+	{
+		std::vector<double> columns[3] = { column(0), column(1), column(2) };
+		const char* names[3] = { "frame_ms", "cpu_ms", "gpu_ms" };
+		FrameTimeStats stats[3];
+		for (int c = 0; c < 3; c++)
+			stats[c] = computeStats(columns[c]);
+		int stutters = countStutters(stats[0].p50);
+
+		out << std::fixed << std::setprecision(3);
+		out << "Benchmark: " << columns[0].size() << " frames after " << warmupFrames << " warmup frames, "
+			<< stutters << " stutters (frames over twice the median)" << std::endl;
+		out << "              min      p50      p95      p99      max     mean" << std::endl;
+		for (int c = 0; c < 3; c++) {
+			out << "  " << std::left << std::setw(8) << names[c] << std::right
+				<< std::setw(9) << stats[c].min << std::setw(9) << stats[c].p50 << std::setw(9) << stats[c].p95
+				<< std::setw(9) << stats[c].p99 << std::setw(9) << stats[c].max << std::setw(9) << stats[c].mean << std::endl;
+		}
+		out.unsetf(std::ios::floatfield);
+
+		if (fileName.empty())
+			return;
+		std::ofstream file(fileName, std::ios::trunc);
+		file << "metric,min,p50,p95,p99,max,mean,frames,stutters\n";
+		file << std::fixed << std::setprecision(4);
+		for (int c = 0; c < 3; c++) {
+			file << names[c] << "," << stats[c].min << "," << stats[c].p50 << "," << stats[c].p95 << "," << stats[c].p99 << ","
+				<< stats[c].max << "," << stats[c].mean << "," << columns[c].size() << "," << stutters << "\n";
+		}
+	}
+}
@@ -0,0 +1,74 @@
+#ifndef FrameBenchmark_hpp
+#define FrameBenchmark_hpp
+
+#include <GL/glew.h>
+
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    //distribution of one per frame measurement, in milliseconds
+    struct FrameTimeStats {
+        double min, max, mean;
+        double p50, p95, p99;
+    };
+
+    //per frame timings of a benchmark run: the wall time of the whole frame, the CPU time the render
+    //thread spent submitting it, and the GPU time between two timestamps around the same commands
+    class FrameBenchmark
+    {
+    public:
+        //frames are counted up to frameCount, the first warmupFrames are written but left out of the statistics
+        void Init(int frameCount, int warmupFrames);
+        void Delete();
+
+        //around the commands of one frame, on the thread that owns the context
+        void beginFrame();
+        void endFrame();
+        bool isDone() { return (int)frames.size() >= frameCount; }
+
+        //waits for the outstanding GPU timestamps; call once after the last frame
+        void finish();
+        //one line per frame
+        bool writeCsv(const std::string& fileName);
+        //percentiles, extremes and stutters of every column, to out and, as CSV, to fileName when not empty
+        void writeSummary(std::ostream& out, const std::string& fileName);
+
+        //statistics of the frames after the warmup
+        FrameTimeStats getFrameTimeStats() { return computeStats(column(0)); }
+        FrameTimeStats getGpuTimeStats() { return computeStats(column(2)); }
+
+        static FrameTimeStats computeStats(std::vector<double> values);
+
+    private:
+        struct Frame {
+            double frameTime;
+            double cpuTime;
+            double gpuTime;
+        };
+        //timestamps in flight, read back a few frames later so the CPU never waits for them
+        static const int QUERY_FRAMES = 4;
+
+        int frameCount = 0;
+        int warmupFrames = 0;
+        std::vector<Frame> frames;
+        GLuint queries[QUERY_FRAMES][2];
+        //frame each query pair was issued for, -1 when free
+        int queryFrame[QUERY_FRAMES];
+        int nextQuery = 0;
+        std::chrono::steady_clock::time_point frameStart;
+        std::chrono::steady_clock::time_point lastFrameStart;
+        bool started = false;
+
+        void collect(bool wait);
+        //frame, cpu or gpu times of the frames after the warmup
+        std::vector<double> column(int index);
+        //a frame is a stutter when it takes more than twice the median
+        int countStutters(double median);
+    };
+}
+
+#endif /* FrameBenchmark_hpp */
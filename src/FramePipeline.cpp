@@ -0,0 +1,118 @@
+#include "FramePipeline.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+namespace gps {
+
+	long long FramePipeline::now()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	void FramePipeline::Init(PIPELINE_MODE mode)
+	{
+		this->mode = mode;
+		state.store(0);
+		stopped.store(false);
+		writing = -1;
+		nextWrite = 0;
+		renderStart.store(0);
+		renderInterval.store(0);
+		simulationTime = 0;
+	}
+
+	int FramePipeline::beginWrite()
+	{
+		int slot = nextWrite;
+		//the render thread may still be reading this slot, or not have taken it yet
+		for (;;) {
+			if (stopped.load(std::memory_order_acquire))
+				return -1;
+			int current = state.load(std::memory_order_acquire);
+			if (publishedSlot(current) != slot && readingSlot(current) != slot)
+				break;
+			std::this_thread::yield();
+		}
+
+		if (mode == PIPELINE_LOW_LATENCY) {
+			//start so the frame is done just before the render thread wants it, with a quarter of margin
+			long long interval = renderInterval.load(std::memory_order_relaxed);
+			long long start = renderStart.load(std::memory_order_relaxed);
+			if (interval > 0 && start > 0) {
+				long long target = start + interval - simulationTime * 5 / 4 - 500000;
+				long long latest = now() + interval;
+				target = std::min(target, latest);
+				while (!stopped.load(std::memory_order_relaxed)) {
+					long long remaining = target - now();
+					if (remaining <= 0)
+						break;
+					//sleep is coarse, spin the last millisecond
+					if (remaining > 2000000)
+						std::this_thread::sleep_for(std::chrono::nanoseconds(remaining - 1000000));
+					else
+						std::this_thread::yield();
+				}
+			}
+		}
+
+		writing = slot;
+		nextWrite = (slot + 1) % SLOT_COUNT;
+		writeStart = now();
+		return slot;
+	}
+
+	void FramePipeline::endWrite()
+	{
+		long long elapsed = now() - writeStart;
+		simulationTime = simulationTime == 0 ? elapsed : (simulationTime * 7 + elapsed) / 8;
+
+		//wait for the render thread to take the previous frame, then publish this one
+		int current = state.load(std::memory_order_acquire);
+		for (;;) {
+			if (stopped.load(std::memory_order_acquire))
+				return;
+			if (publishedSlot(current) != -1) {
+				std::this_thread::yield();
+				current = state.load(std::memory_order_acquire);
+				continue;
+			}
+			int next = (current & ~3) | (writing + 1);
+			if (state.compare_exchange_weak(current, next, std::memory_order_acq_rel, std::memory_order_acquire))
+				break;
+		}
+		writing = -1;
+	}
+
+	int FramePipeline::beginRead()
+	{
+		int current = state.load(std::memory_order_acquire);
+		int slot;
+		do {
+			slot = publishedSlot(current);
+			if (slot == -1)
+				return -1;
+		} while (!state.compare_exchange_weak(current, (slot + 1) << 2, std::memory_order_acq_rel, std::memory_order_acquire));
+
+		long long start = now();
+		long long last = renderStart.exchange(start, std::memory_order_relaxed);
+		if (last > 0) {
+			long long interval = renderInterval.load(std::memory_order_relaxed);
+			long long elapsed = start - last;
+			renderInterval.store(interval == 0 ? elapsed : (interval * 7 + elapsed) / 8, std::memory_order_relaxed);
+		}
+		return slot;
+	}
+
+	void FramePipeline::endRead()
+	{
+		int current = state.load(std::memory_order_acquire);
+		while (!state.compare_exchange_weak(current, current & 3, std::memory_order_acq_rel, std::memory_order_acquire));
+	}
+
+	void FramePipeline::stop()
+	{
+		stopped.store(true, std::memory_order_release);
+	}
+}
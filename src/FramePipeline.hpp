@@ -0,0 +1,66 @@
+#ifndef FramePipeline_hpp
+#define FramePipeline_hpp
+
+#include <atomic>
+
+namespace gps {
+
+    enum PIPELINE_MODE {
+        //simulate and render on one thread, one after the other
+        PIPELINE_SERIAL,
+        //the simulation thread starts the next frame as soon as a slot is free
+        PIPELINE_OVERLAPPED,
+        //like overlapped, but the simulation starts as late as it can and still be ready
+        //for the next render, so input is sampled close to presentation
+        PIPELINE_LOW_LATENCY
+    };
+
+    //hands two frame state slots back and forth between one simulation and one render thread;
+    //the slots themselves live with the caller, this only decides who may touch which one
+    class FramePipeline
+    {
+    public:
+        static const int SLOT_COUNT = 2;
+
+        void Init(PIPELINE_MODE mode);
+        PIPELINE_MODE getMode() { return mode; }
+
+        //simulation side: blocks until a slot is free (and paces in low latency mode),
+        //returns -1 once the pipeline is stopped
+        int beginWrite();
+        //publishes the slot from beginWrite to the render thread
+        void endWrite();
+
+        //render side: takes the newest published slot, -1 if none is ready yet; never blocks
+        //so the caller can keep polling window events
+        int beginRead();
+        //the slot from beginRead may be overwritten again
+        void endRead();
+
+        //wakes up and ends the simulation side
+        void stop();
+        bool isStopped() { return stopped.load(std::memory_order_acquire); }
+
+    private:
+        PIPELINE_MODE mode;
+        //published slot + 1 in bits 0-1, slot being read + 1 in bits 2-3; both change together
+        //in one compare-exchange so the simulation never sees a slot between the two states
+        std::atomic<int> state;
+        std::atomic<bool> stopped;
+        int writing = -1;
+        int nextWrite = 0;
+
+        //pacing state in nanoseconds: when the render thread last started a frame,
+        //its average frame interval and the average simulation time
+        std::atomic<long long> renderStart;
+        std::atomic<long long> renderInterval;
+        long long simulationTime = 0;
+        long long writeStart = 0;
+
+        static long long now();
+        static int publishedSlot(int state) { return (state & 3) - 1; }
+        static int readingSlot(int state) { return ((state >> 2) & 3) - 1; }
+    };
+}
+
+#endif /* FramePipeline_hpp */
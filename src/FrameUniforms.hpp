@@ -0,0 +1,42 @@
+#ifndef FrameUniforms_hpp
+#define FrameUniforms_hpp
+
+#include "glm/glm.hpp"
+
+namespace gps {
+
+    //uniform block binding points shared by all programs
+    enum UNIFORM_BINDING { FRAME_BINDING = 0, DRAW_BINDING = 1 };
+
+    //std140 mirror of the FrameData block, updated once per frame
+    struct FrameUniforms {
+        glm::mat4 view;
+        glm::mat4 projection;
+        glm::mat4 lightSpaceTrMatrix;
+        //mat3, padded to vec4 columns
+        glm::mat4 lightDirMatrix;
+        glm::vec4 lightDir;
+        glm::vec4 lightColor;
+        //w: cosine of the inner cone
+        glm::vec4 spotLightPosition;
+        //w: cosine of the outer cone
+        glm::vec4 spotLightDirection;
+        //x: fog density, y: PCF radius in texture space
+        glm::vec4 fogAndShadow;
+        //x, y: pixels per light cluster tile, z: near plane, w: cluster slices per log unit of depth
+        glm::vec4 clusterParams;
+        //x: spot light enabled, y: point lights enabled, z: PCF taps
+        glm::ivec4 flags;
+        //x: animation time in seconds, y: crowd jump scale (0 while the animations are stopped)
+        glm::vec4 crowdParams;
+    };
+
+    //std140 mirror of the DrawData block, pushed for every draw
+    struct DrawUniforms {
+        glm::mat4 model;
+        //mat3, padded to vec4 columns
+        glm::mat4 normalMatrix;
+    };
+}
+
+#endif /* FrameUniforms_hpp */
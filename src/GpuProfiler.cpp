@@ -0,0 +1,184 @@
+#include "GpuProfiler.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+
+namespace gps {
+
+	void GpuProfiler::Init()
+	{
+		enabled = true;
+		nodes.clear();
+		roots.clear();
+		for (int i = 0; i < FRAME_LATENCY; i++)
+			frames[i].clear();
+		current = 0;
+		inFrame = false;
+		openScopes.clear();
+		framesRead = 0;
+	}
+
+	void GpuProfiler::Delete()
+	{
+		if (!allQueries.empty())
+			glDeleteQueries((GLsizei)allQueries.size(), allQueries.data());
+		allQueries.clear();
+		freeQueries.clear();
+		enabled = false;
+	}
+
+	void GpuProfiler::beginFrame()
+	{
+		if (!enabled)
+			return;
+		//oldest first; the slot of this frame is the oldest and must be read back before it is reused
+		for (int k = 0; k < FRAME_LATENCY; k++) {
+			int i = (current + k) % FRAME_LATENCY;
+			if (frames[i].empty())
+				continue;
+			if (!collect(i, k == 0))
+				break;
+		}
+
+		inFrame = true;
+		beginScope("frame");
+	}
+
+	void GpuProfiler::endFrame()
+	{
+		if (!inFrame)
+			return;
+		//scopes left open by an early return end with the frame
+		while (!openScopes.empty())
+			endScope();
+		inFrame = false;
+		current = (current + 1) % FRAME_LATENCY;
+	}
+
+	void GpuProfiler::beginScope(const char* name)
+	{
+		if (!inFrame)
+			return;
+		std::vector<Scope>& scopes = frames[current];
+		int parent = openScopes.empty() ? -1 : scopes[openScopes.back()].node;
+		Scope scope = { findNode(parent, name), takeQuery(), 0 };
+		glQueryCounter(scope.begin, GL_TIMESTAMP);
+		openScopes.push_back(scopes.size());
+		scopes.push_back(scope);
+	}
+
+	void GpuProfiler::endScope()
+	{
+		if (!inFrame || openScopes.empty())
+			return;
+		Scope& scope = frames[current][openScopes.back()];
+		scope.end = takeQuery();
+		glQueryCounter(scope.end, GL_TIMESTAMP);
+		openScopes.pop_back();
+	}
+
+	int GpuProfiler::findNode(int parent, const char* name)
+	{
+		std::vector<int>& siblings = parent == -1 ? roots : nodes[parent].children;
+		for (size_t i = 0; i < siblings.size(); i++)
+			if (std::strcmp(nodes[siblings[i]].name.c_str(), name) == 0)
+				return siblings[i];
+
+		Node node;
+		node.name = name;
+		node.parent = parent;
+		node.depth = parent == -1 ? 0 : nodes[parent].depth + 1;
+		node.last = node.average = node.max = 0.0;
+		node.calls = 0;
+		node.frameTime = 0.0;
+		node.frameCalls = 0;
+		node.samples = 0;
+		nodes.push_back(node);
+		//siblings may have moved with nodes
+		int index = (int)nodes.size() - 1;
+		(parent == -1 ? roots : nodes[parent].children).push_back(index);
+		return index;
+	}
+
+	GLuint GpuProfiler::takeQuery()
+	{
+		//the pool grows to what the busiest frames in flight need and stays there
+		if (freeQueries.empty()) {
+			GLuint queries[64];
+			glGenQueries(64, queries);
+			allQueries.insert(allQueries.end(), queries, queries + 64);
+			freeQueries.insert(freeQueries.end(), queries, queries + 64);
+		}
+		GLuint query = freeQueries.back();
+		freeQueries.pop_back();
+		return query;
+	}
+
+	bool GpuProfiler::collect(int frame, bool wait)
+	{
+		std::vector<Scope>& scopes = frames[frame];
+		//the frame scope ends last, once it is available all the others are too
+		GLint available = 0;
+		glGetQueryObjectiv(scopes[0].end, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available && !wait)
+			return false;
+
+		for (size_t i = 0; i < scopes.size(); i++) {
+			GLuint64 begin = 0, end = 0;
+			glGetQueryObjectui64v(scopes[i].begin, GL_QUERY_RESULT, &begin);
+			glGetQueryObjectui64v(scopes[i].end, GL_QUERY_RESULT, &end);
+			Node& node = nodes[scopes[i].node];
+			node.frameTime += (double)(end - begin) / 1000000.0;
+			node.frameCalls++;
+			freeQueries.push_back(scopes[i].begin);
+			freeQueries.push_back(scopes[i].end);
+		}
+		scopes.clear();
+
+		//scopes that did not run this frame count as 0, so culled models fade out of the averages
+		for (size_t i = 0; i < nodes.size(); i++) {
+			Node& node = nodes[i];
+			node.last = node.frameTime;
+			node.calls = node.frameCalls;
+			node.average = node.samples == 0 ? node.last : node.average * 0.95 + node.last * 0.05;
+			node.max = std::max(node.max, node.last);
+			node.samples++;
+			node.frameTime = 0.0;
+			node.frameCalls = 0;
+		}
+		framesRead++;
+		return true;
+	}
+
+	void GpuProfiler::getTimes(std::vector<GpuScopeTime>& times)
+	{
+		times.clear();
+		//depth first, children in the order they first ran
+		std::vector<int> stack(roots.rbegin(), roots.rend());
+		while (!stack.empty()) {
+			const Node& node = nodes[stack.back()];
+			stack.pop_back();
+			GpuScopeTime time = { node.name, node.depth, node.last, node.average, node.max, node.calls };
+			times.push_back(time);
+			stack.insert(stack.end(), node.children.rbegin(), node.children.rend());
+		}
+	}
+
+	void GpuProfiler::writeReport(std::ostream& out)
+	{
+		std::vector<GpuScopeTime> times;
+		getTimes(times);
+
+		out << std::fixed << std::setprecision(3);
+		out << "GPU profile after " << framesRead << " frames, in ms" << std::endl;
+		out << "  scope                                 last  average      max  calls" << std::endl;
+		for (size_t i = 0; i < times.size(); i++) {
+			std::string name = std::string(times[i].depth * 2, ' ') + times[i].name;
+			out << "  " << std::left << std::setw(34) << name << std::right
+				<< std::setw(9) << times[i].last << std::setw(9) << times[i].average << std::setw(9) << times[i].max
+				<< std::setw(7) << times[i].calls << std::endl;
+		}
+		out.unsetf(std::ios::floatfield);
+	}
+}
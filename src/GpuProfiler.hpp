@@ -0,0 +1,112 @@
+#ifndef GpuProfiler_hpp
+#define GpuProfiler_hpp
+
+#include <GL/glew.h>
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    //GPU time of one node of the scope tree, in milliseconds
+    struct GpuScopeTime {
+        std::string name;
+        int depth;
+        //the last frame read back, a running average and the worst frame so far
+        double last, average, max;
+        //how often the scope ran in the last frame, more than 1 for per model scopes
+        int calls;
+    };
+
+    //nested GL_TIMESTAMP scopes per frame, read back FRAME_LATENCY frames later so the CPU never waits
+    //for the GPU; equal paths of different frames add up in one tree node
+    class GpuProfiler
+    {
+    public:
+        //frames between submitting a scope and reading it back
+        static const int FRAME_LATENCY = 4;
+
+        void Init();
+        void Delete();
+        bool isEnabled() { return enabled; }
+        //detailed profiles also time every model and static batch on its own
+        void setDetailed(bool detailed) { this->detailed = detailed; }
+        bool isDetailed() { return enabled && detailed; }
+
+        //around the commands of one frame, the frame is the root scope
+        void beginFrame();
+        void endFrame();
+        //scopes nest like the calls that open them, on the thread that owns the context
+        void beginScope(const char* name);
+        void endScope();
+
+        //the tree in depth first order, as of the newest frame read back
+        void getTimes(std::vector<GpuScopeTime>& times);
+        //the same as an indented table
+        void writeReport(std::ostream& out);
+        long long getFramesRead() { return framesRead; }
+
+    private:
+        struct Node {
+            std::string name;
+            int parent;
+            int depth;
+            std::vector<int> children;
+            double last, average, max;
+            int calls;
+            //time and calls of the frame being read back
+            double frameTime;
+            int frameCalls;
+            //frames read back since the node was first seen
+            long long samples;
+        };
+        struct Scope {
+            int node;
+            GLuint begin, end;
+        };
+
+        bool enabled = false;
+        bool detailed = false;
+        //roots have parent -1, children are found by name so nothing is allocated for known scopes
+        std::vector<Node> nodes;
+        std::vector<int> roots;
+        //the scopes of every frame in flight, in the order they were opened
+        std::vector<Scope> frames[FRAME_LATENCY];
+        int current = 0;
+        bool inFrame = false;
+        //open scopes of the current frame, as indices into its scope list
+        std::vector<size_t> openScopes;
+        //query names not in use by any frame in flight
+        std::vector<GLuint> freeQueries;
+        std::vector<GLuint> allQueries;
+        long long framesRead = 0;
+
+        int findNode(int parent, const char* name);
+        GLuint takeQuery();
+        //reads back the given frame, returns false if its last query is not ready and wait is false
+        bool collect(int frame, bool wait);
+    };
+
+    //times the enclosing block when the profiler is enabled and active is true
+    class GpuScope
+    {
+    public:
+        GpuScope(GpuProfiler& profiler, const char* name, bool active = true) : profiler(profiler), active(active && profiler.isEnabled()) {
+            if (this->active)
+                profiler.beginScope(name);
+        }
+        ~GpuScope() {
+            if (this->active)
+                profiler.endScope();
+        }
+
+    private:
+        GpuProfiler& profiler;
+        bool active;
+        GpuScope(const GpuScope&);
+        GpuScope& operator=(const GpuScope&);
+    };
+}
+
+#endif /* GpuProfiler_hpp */
@@ -0,0 +1,189 @@
+#include "Hud.hpp"
+#include "MemoryStats.hpp"
+#include "RenderStats.hpp"
+
+namespace gps {
+
+	//printable ASCII from space to underscore, one byte per row from the top, bit 7 is the left column
+	static const unsigned char FONT[64][8] = {
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  0x10, 0x10, 0x10, 0x10, 0x10, 0x00, 0x10, 0x00, //space !
+		0x28, 0x28, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  0x28, 0x7C, 0x28, 0x28, 0x28, 0x7C, 0x28, 0x00, //" #
+		0x10, 0x3C, 0x50, 0x38, 0x14, 0x78, 0x10, 0x00,  0x60, 0x64, 0x08, 0x10, 0x20, 0x4C, 0x0C, 0x00, //$ %
+		0x30, 0x48, 0x50, 0x20, 0x54, 0x48, 0x34, 0x00,  0x10, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, //& '
+		0x08, 0x10, 0x20, 0x20, 0x20, 0x10, 0x08, 0x00,  0x20, 0x10, 0x08, 0x08, 0x08, 0x10, 0x20, 0x00, //( )
+		0x00, 0x10, 0x54, 0x38, 0x54, 0x10, 0x00, 0x00,  0x00, 0x10, 0x10, 0x7C, 0x10, 0x10, 0x00, 0x00, //* +
+		0x00, 0x00, 0x00, 0x00, 0x18, 0x10, 0x20, 0x00,  0x00, 0x00, 0x00, 0x7C, 0x00, 0x00, 0x00, 0x00, //, -
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x30, 0x30, 0x00,  0x00, 0x04, 0x08, 0x10, 0x20, 0x40, 0x00, 0x00, //. /
+		0x38, 0x44, 0x4C, 0x54, 0x64, 0x44, 0x38, 0x00,  0x10, 0x30, 0x10, 0x10, 0x10, 0x10, 0x38, 0x00, //0 1
+		0x38, 0x44, 0x04, 0x08, 0x10, 0x20, 0x7C, 0x00,  0x7C, 0x08, 0x10, 0x08, 0x04, 0x44, 0x38, 0x00, //2 3
+		0x08, 0x18, 0x28, 0x48, 0x7C, 0x08, 0x08, 0x00,  0x7C, 0x40, 0x78, 0x04, 0x04, 0x44, 0x38, 0x00, //4 5
+		0x18, 0x20, 0x40, 0x78, 0x44, 0x44, 0x38, 0x00,  0x7C, 0x04, 0x08, 0x10, 0x20, 0x20, 0x20, 0x00, //6 7
+		0x38, 0x44, 0x44, 0x38, 0x44, 0x44, 0x38, 0x00,  0x38, 0x44, 0x44, 0x3C, 0x04, 0x08, 0x30, 0x00, //8 9
+		0x00, 0x30, 0x30, 0x00, 0x30, 0x30, 0x00, 0x00,  0x00, 0x30, 0x30, 0x00, 0x30, 0x10, 0x20, 0x00, //: ;
+		0x08, 0x10, 0x20, 0x40, 0x20, 0x10, 0x08, 0x00,  0x00, 0x00, 0x7C, 0x00, 0x7C, 0x00, 0x00, 0x00, //< =
+		0x20, 0x10, 0x08, 0x04, 0x08, 0x10, 0x20, 0x00,  0x38, 0x44, 0x04, 0x08, 0x10, 0x00, 0x10, 0x00, //> ?
+		0x38, 0x44, 0x04, 0x34, 0x54, 0x54, 0x38, 0x00,  0x38, 0x44, 0x44, 0x7C, 0x44, 0x44, 0x44, 0x00, //@ A
+		0x78, 0x44, 0x44, 0x78, 0x44, 0x44, 0x78, 0x00,  0x38, 0x44, 0x40, 0x40, 0x40, 0x44, 0x38, 0x00, //B C
+		0x70, 0x48, 0x44, 0x44, 0x44, 0x48, 0x70, 0x00,  0x7C, 0x40, 0x40, 0x78, 0x40, 0x40, 0x7C, 0x00, //D E
+		0x7C, 0x40, 0x40, 0x78, 0x40, 0x40, 0x40, 0x00,  0x38, 0x44, 0x40, 0x5C, 0x44, 0x44, 0x3C, 0x00, //F G
+		0x44, 0x44, 0x44, 0x7C, 0x44, 0x44, 0x44, 0x00,  0x38, 0x10, 0x10, 0x10, 0x10, 0x10, 0x38, 0x00, //H I
+		0x1C, 0x08, 0x08, 0x08, 0x08, 0x48, 0x30, 0x00,  0x44, 0x48, 0x50, 0x60, 0x50, 0x48, 0x44, 0x00, //J K
+		0x40, 0x40, 0x40, 0x40, 0x40, 0x40, 0x7C, 0x00,  0x44, 0x6C, 0x54, 0x54, 0x44, 0x44, 0x44, 0x00, //L M
+		0x44, 0x44, 0x64, 0x54, 0x4C, 0x44, 0x44, 0x00,  0x38, 0x44, 0x44, 0x44, 0x44, 0x44, 0x38, 0x00, //N O
+		0x78, 0x44, 0x44, 0x78, 0x40, 0x40, 0x40, 0x00,  0x38, 0x44, 0x44, 0x44, 0x54, 0x48, 0x34, 0x00, //P Q
+		0x78, 0x44, 0x44, 0x78, 0x50, 0x48, 0x44, 0x00,  0x3C, 0x40, 0x40, 0x38, 0x04, 0x04, 0x78, 0x00, //R S
+		0x7C, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x00,  0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x38, 0x00, //T U
+		0x44, 0x44, 0x44, 0x44, 0x44, 0x28, 0x10, 0x00,  0x44, 0x44, 0x44, 0x54, 0x54, 0x54, 0x28, 0x00, //V W
+		0x44, 0x44, 0x28, 0x10, 0x28, 0x44, 0x44, 0x00,  0x44, 0x44, 0x28, 0x10, 0x10, 0x10, 0x10, 0x00, //X Y
+		0x7C, 0x04, 0x08, 0x10, 0x20, 0x40, 0x7C, 0x00,  0x38, 0x20, 0x20, 0x20, 0x20, 0x20, 0x38, 0x00, //Z [
+		0x00, 0x40, 0x20, 0x10, 0x08, 0x04, 0x00, 0x00,  0x38, 0x08, 0x08, 0x08, 0x08, 0x08, 0x38, 0x00, //\ ]
+		0x10, 0x28, 0x44, 0x00, 0x00, 0x00, 0x00, 0x00,  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x7C, 0x00, //^ _
+	};
+	//atlas cells per row; the cell after the glyphs is solid, for rectangles
+	static const int ATLAS_COLUMNS = 16;
+	static const int ATLAS_ROWS = 5;
+	static const int SOLID_CELL = 64;
+
+	void Hud::Init(gps::Shader shader)
+	{
+		//one byte per texel, coverage only
+		const int width = ATLAS_COLUMNS * GLYPH_SIZE, height = ATLAS_ROWS * GLYPH_SIZE;
+		std::vector<unsigned char> atlas(width * height, 0);
+		for (int cell = 0; cell <= SOLID_CELL; cell++) {
+			int cellX = (cell % ATLAS_COLUMNS) * GLYPH_SIZE, cellY = (cell / ATLAS_COLUMNS) * GLYPH_SIZE;
+			for (int y = 0; y < GLYPH_SIZE; y++) {
+				unsigned char row = cell == SOLID_CELL ? 0xFF : FONT[cell][y];
+				for (int x = 0; x < GLYPH_SIZE; x++)
+					atlas[(cellY + y) * width + cellX + x] = (row & (0x80 >> x)) ? 255 : 0;
+			}
+		}
+		glGenTextures(1, &fontTexture);
+		glBindTexture(GL_TEXTURE_2D, fontTexture);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, height, 0, GL_RED, GL_UNSIGNED_BYTE, atlas.data());
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		MemoryStats::trackTexture(fontTexture, MemoryStats::textureBytes(GL_R8, width, height, 1, 1), "hud");
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		glGenVertexArrays(1, &vao);
+		glGenBuffers(1, &vbo);
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(HudVertex), (GLvoid*)offsetof(HudVertex, x));
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(HudVertex), (GLvoid*)offsetof(HudVertex, u));
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(HudVertex), (GLvoid*)offsetof(HudVertex, color));
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		//the font always sits on unit 0
+		shader.useShaderProgram();
+		glUniform1i(glGetUniformLocation(shader.shaderProgram, "font"), 0);
+		//a few thousand glyphs before the first reallocation
+		vertices.reserve(6 * 4096);
+	}
+
+	void Hud::Delete()
+	{
+		MemoryStats::deleteTextures(1, &fontTexture);
+		MemoryStats::deleteBuffers(1, &vbo);
+		glDeleteVertexArrays(1, &vao);
+		fontTexture = vbo = vao = 0;
+		bufferVertices = 0;
+	}
+
+	void Hud::begin(int width, int height)
+	{
+		vertices.clear();
+		scaleX = 2.0f / (float)width;
+		scaleY = 2.0f / (float)height;
+	}
+
+	void Hud::addQuad(float x, float y, float width, float height, float u0, float v0, float u1, float v1, GLuint color)
+	{
+		//pixels from the top left to clip space
+		float left = x * scaleX - 1.0f, right = (x + width) * scaleX - 1.0f;
+		float top = 1.0f - y * scaleY, bottom = 1.0f - (y + height) * scaleY;
+		HudVertex corners[4] = {
+			{ left, top, u0, v0, color }, { right, top, u1, v0, color },
+			{ left, bottom, u0, v1, color }, { right, bottom, u1, v1, color }
+		};
+		const int order[6] = { 0, 2, 1, 1, 2, 3 };
+		for (int i = 0; i < 6; i++)
+			vertices.push_back(corners[order[i]]);
+	}
+
+	size_t Hud::addRect(float x, float y, float width, float height, GLuint color)
+	{
+		size_t quad = vertices.size() / 6;
+		//the middle of the solid cell, away from its neighbours
+		float u = ((SOLID_CELL % ATLAS_COLUMNS) + 0.5f) / ATLAS_COLUMNS;
+		float v = ((SOLID_CELL / ATLAS_COLUMNS) + 0.5f) / ATLAS_ROWS;
+		addQuad(x, y, width, height, u, v, u, v, color);
+		return quad;
+	}
+
+	void Hud::setRectHeight(size_t quad, float height)
+	{
+		//the bottom corners are the 2nd, 5th and 6th vertex of a quad
+		HudVertex* corners = &vertices[quad * 6];
+		float bottom = corners[0].y - height * scaleY;
+		corners[1].y = corners[4].y = corners[5].y = bottom;
+	}
+
+	float Hud::addText(float x, float y, const char* text, GLuint color, float scale)
+	{
+		float size = GLYPH_SIZE * scale;
+		float start = x;
+		for (const char* c = text; *c; c++) {
+			int character = (unsigned char)*c;
+			if (character >= 'a' && character <= 'z')
+				character -= 'a' - 'A';
+			if (character < 32 || character > 95)
+				character = '?';
+			//nothing to draw for a space
+			if (character != ' ') {
+				int cell = character - 32;
+				float u0 = (float)(cell % ATLAS_COLUMNS) / ATLAS_COLUMNS, v0 = (float)(cell / ATLAS_COLUMNS) / ATLAS_ROWS;
+				addQuad(x, y, size, size, u0, v0, u0 + 1.0f / ATLAS_COLUMNS, v0 + 1.0f / ATLAS_ROWS, color);
+			}
+			x += size;
+		}
+		return x - start;
+	}
+
+	void Hud::Draw(gps::Shader shader)
+	{
+		if (vertices.empty() || vao == 0)
+			return;
+
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		if (vertices.size() > bufferVertices) {
+			bufferVertices = vertices.capacity();
+			MemoryStats::trackBuffer(vbo, bufferVertices * sizeof(HudVertex), "hud");
+		}
+		//orphaned every frame so the previous frame's draw keeps its copy
+		glBufferData(GL_ARRAY_BUFFER, bufferVertices * sizeof(HudVertex), NULL, GL_STREAM_DRAW);
+		RenderStats::bufferSubData(GL_ARRAY_BUFFER, 0, vertices.size() * sizeof(HudVertex), vertices.data());
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		glDisable(GL_DEPTH_TEST);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		shader.useShaderProgram();
+		RenderStats::activeTexture(GL_TEXTURE0);
+		RenderStats::bindTexture(GL_TEXTURE_2D, fontTexture);
+		RenderStats::bindVertexArray(vao);
+		RenderStats::drawArrays(GL_TRIANGLES, 0, (GLsizei)vertices.size());
+		RenderStats::bindVertexArray(0);
+		RenderStats::bindTexture(GL_TEXTURE_2D, 0);
+		glDisable(GL_BLEND);
+		glEnable(GL_DEPTH_TEST);
+	}
+}
@@ -0,0 +1,58 @@
+#ifndef Hud_hpp
+#define Hud_hpp
+
+#include <GL/glew.h>
+
+#include "Shader.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    //one corner of a HUD quad, already in clip space
+    struct HudVertex {
+        GLfloat x, y;
+        GLfloat u, v;
+        //RGBA, 8 bits each
+        GLuint color;
+    };
+
+    //screen space overlay: text from a baked 8x8 bitmap font and solid rectangles, collected on the CPU
+    //and submitted as one streamed vertex buffer with a single draw call
+    class Hud
+    {
+    public:
+        //glyph cells of the font, 7 pixels tall with a blank row below
+        static const int GLYPH_SIZE = 8;
+
+        //bakes the font atlas; the shader is the one Draw will be called with
+        void Init(gps::Shader shader);
+        void Delete();
+
+        //starts a new overlay for a framebuffer of the given size in pixels, origin at the top left
+        void begin(int width, int height);
+        //returns the index of the rectangle's quad, for setRectHeight
+        size_t addRect(float x, float y, float width, float height, GLuint color);
+        //moves the bottom edge of a quad added earlier, e.g. a background sized after its contents
+        void setRectHeight(size_t quad, float height);
+        //lowercase letters are drawn as uppercase, returns the width of the text in pixels
+        float addText(float x, float y, const char* text, GLuint color, float scale = 1.0f);
+        //uploads and draws everything added since begin, blended over the bound framebuffer
+        void Draw(gps::Shader shader);
+
+        static GLuint rgba(int r, int g, int b, int a = 255) { return (GLuint)r | ((GLuint)g << 8) | ((GLuint)b << 16) | ((GLuint)a << 24); }
+
+    private:
+        GLuint fontTexture = 0;
+        GLuint vao = 0;
+        GLuint vbo = 0;
+        //capacity of vbo in vertices, it only grows
+        size_t bufferVertices = 0;
+        std::vector<HudVertex> vertices;
+        float scaleX = 0.0f, scaleY = 0.0f;
+
+        void addQuad(float x, float y, float width, float height, float u0, float v0, float u1, float v1, GLuint color);
+    };
+}
+
+#endif /* Hud_hpp */
@@ -0,0 +1,192 @@
+#include "Impostor.hpp"
+#include "MemoryStats.hpp"
+#include "RenderStats.hpp"
+
+#include "glm/gtc/matrix_transform.hpp"
+#include "glm/gtc/type_ptr.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace gps {
+
+	GLuint Impostor::createAtlas(GLenum internalFormat, int width, int height)
+	{
+		GLuint texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		//the mip chain is generated after baking
+		MemoryStats::trackTexture(texture, MemoryStats::textureBytes(internalFormat, width, height, 1, 0), "impostor");
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		return texture;
+	}
+
+	void Impostor::Bake(gps::Model3D* model, gps::Shader bakeShader, int viewCount, int resolution)
+	{
+		this->viewCount = viewCount;
+
+		//a cylinder around Y that holds the model from every view, with a small margin so nothing touches the tile border
+		glm::vec3 boundsMin = model->getBoundsMin();
+		glm::vec3 boundsMax = model->getBoundsMax();
+		float extentX = std::max(std::fabs(boundsMin.x), std::fabs(boundsMax.x));
+		float extentZ = std::max(std::fabs(boundsMin.z), std::fabs(boundsMax.z));
+		float margin = 0.05f * std::max(std::sqrt(extentX * extentX + extentZ * extentZ), boundsMax.y - boundsMin.y);
+		radius = std::sqrt(extentX * extentX + extentZ * extentZ) + margin;
+		bottom = boundsMin.y - margin;
+		top = boundsMax.y + margin;
+
+		colorAtlas = createAtlas(GL_SRGB8_ALPHA8, viewCount * resolution, resolution);
+		normalDepthAtlas = createAtlas(GL_RGBA8, viewCount * resolution, resolution);
+
+		//the window, or the offscreen target of a headless run
+		GLint previousFramebuffer = 0;
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+		GLuint framebuffer, depthBuffer;
+		glGenRenderbuffers(1, &depthBuffer);
+		glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, viewCount * resolution, resolution);
+		glGenFramebuffers(1, &framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorAtlas, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normalDepthAtlas, 0);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+		GLenum drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+		glDrawBuffers(2, drawBuffers);
+
+		//empty texels have zero coverage, the shaders divide the filtered values by it
+		GLfloat clearColor[4];
+		glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+
+		//view k looks at the model from the direction (sin, 0, cos) of k / viewCount of a turn; the depth range
+		//is [0, 4 * radius] from an eye 2 * radius away, so the shaders can recover the offset from the quad
+		float centerY = (bottom + top) * 0.5f;
+		glm::mat4 projection = glm::ortho(-radius, radius, bottom - centerY, top - centerY, 0.0f, 4.0f * radius);
+		bakeShader.useShaderProgram();
+		GLint bakeMatrixLoc = glGetUniformLocation(bakeShader.shaderProgram, "bakeMatrix");
+		for (int k = 0; k < viewCount; k++) {
+			float angle = 6.2831853f * (float)k / (float)viewCount;
+			glm::vec3 center(0.0f, centerY, 0.0f);
+			glm::vec3 direction(std::sin(angle), 0.0f, std::cos(angle));
+			glm::mat4 view = glm::lookAt(center + direction * 2.0f * radius, center, glm::vec3(0.0f, 1.0f, 0.0f));
+			glm::mat4 bakeMatrix = projection * view;
+			glUniformMatrix4fv(bakeMatrixLoc, 1, GL_FALSE, glm::value_ptr(bakeMatrix));
+			glViewport(k * resolution, 0, resolution, resolution);
+			model->Draw(bakeShader);
+		}
+
+		glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)previousFramebuffer);
+		glDeleteFramebuffers(1, &framebuffer);
+		glDeleteRenderbuffers(1, &depthBuffer);
+
+		glBindTexture(GL_TEXTURE_2D, colorAtlas);
+		glGenerateMipmap(GL_TEXTURE_2D);
+		glBindTexture(GL_TEXTURE_2D, normalDepthAtlas);
+		glGenerateMipmap(GL_TEXTURE_2D);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		//unit quad standing on its bottom edge: x from -1 to 1, y from 0 to 1
+		GLfloat quad[] = {
+			-1.0f, 0.0f, 0.0f,
+			1.0f, 0.0f, 0.0f,
+			-1.0f, 1.0f, 0.0f,
+			1.0f, 1.0f, 0.0f
+		};
+		glGenVertexArrays(1, &quadVAO);
+		glGenBuffers(1, &quadVBO);
+		glBindVertexArray(quadVAO);
+		glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+		MemoryStats::trackBuffer(quadVBO, sizeof(quad), "impostor");
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
+		glBindVertexArray(0);
+	}
+
+	void Impostor::Delete()
+	{
+		MemoryStats::deleteTextures(1, &colorAtlas);
+		MemoryStats::deleteTextures(1, &normalDepthAtlas);
+		MemoryStats::deleteBuffers(1, &quadVBO);
+		glDeleteVertexArrays(1, &quadVAO);
+		colorAtlas = normalDepthAtlas = quadVBO = quadVAO = 0;
+	}
+
+	void Impostor::setInstanceBuffer(GLuint buffer)
+	{
+		glBindVertexArray(quadVAO);
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		glEnableVertexAttribArray(3);
+		glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(CrowdInstance), (GLvoid*)offsetof(CrowdInstance, placement));
+		glVertexAttribDivisor(3, 1);
+		glEnableVertexAttribArray(4);
+		glVertexAttribIPointer(4, 1, GL_UNSIGNED_INT, sizeof(CrowdInstance), (GLvoid*)offsetof(CrowdInstance, seed));
+		glVertexAttribDivisor(4, 1);
+		glBindVertexArray(0);
+	}
+
+	void Impostor::Draw(gps::Shader shader, GLsizei instanceCount)
+	{
+		if (instanceCount == 0 || quadVAO == 0)
+			return;
+		bindAtlases(shader);
+		RenderStats::bindVertexArray(quadVAO);
+		RenderStats::drawArrays(GL_TRIANGLE_STRIP, 0, 4, instanceCount);
+		RenderStats::bindVertexArray(0);
+		unbindAtlases();
+	}
+
+	void Impostor::DrawIndirect(gps::Shader shader, GLintptr commandOffset)
+	{
+		if (quadVAO == 0)
+			return;
+		bindAtlases(shader);
+		RenderStats::bindVertexArray(quadVAO);
+		RenderStats::drawArraysIndirect(GL_TRIANGLE_STRIP, (const GLvoid*)commandOffset);
+		RenderStats::bindVertexArray(0);
+		unbindAtlases();
+	}
+
+	void Impostor::bindAtlases(gps::Shader shader)
+	{
+		shader.useShaderProgram();
+
+		RenderStats::activeTexture(GL_TEXTURE0 + COLOR_UNIT);
+		RenderStats::bindTexture(GL_TEXTURE_2D, colorAtlas);
+		RenderStats::uniform1i(glGetUniformLocation(shader.shaderProgram, "impostorColor"), COLOR_UNIT);
+		RenderStats::activeTexture(GL_TEXTURE0 + NORMAL_DEPTH_UNIT);
+		RenderStats::bindTexture(GL_TEXTURE_2D, normalDepthAtlas);
+		RenderStats::uniform1i(glGetUniformLocation(shader.shaderProgram, "impostorNormalDepth"), NORMAL_DEPTH_UNIT);
+		RenderStats::uniform4f(glGetUniformLocation(shader.shaderProgram, "impostorParams"), radius, bottom, top, (float)viewCount);
+	}
+
+	void Impostor::unbindAtlases()
+	{
+		RenderStats::activeTexture(GL_TEXTURE0 + NORMAL_DEPTH_UNIT);
+		RenderStats::bindTexture(GL_TEXTURE_2D, 0);
+		RenderStats::activeTexture(GL_TEXTURE0 + COLOR_UNIT);
+		RenderStats::bindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	unsigned int Impostor::variantFeatures(unsigned int features)
+	{
+		//the atlases replace the material, and the quads carry their own placement
+		return (features & ~(FEATURE_SPECULAR_MAP | FEATURE_CROWD)) | FEATURE_IMPOSTOR;
+	}
+
+	void Impostor::Draw(gps::ShaderPermutations& permutations, unsigned int features, GLsizei instanceCount)
+	{
+		Draw(permutations.getVariant(variantFeatures(features)), instanceCount);
+	}
+
+	void Impostor::DrawIndirect(gps::ShaderPermutations& permutations, unsigned int features, GLintptr commandOffset)
+	{
+		DrawIndirect(permutations.getVariant(variantFeatures(features)), commandOffset);
+	}
+}
@@ -0,0 +1,55 @@
+#ifndef Impostor_hpp
+#define Impostor_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include "Model3D.hpp"
+#include "Shader.hpp"
+
+namespace gps {
+
+    //a model pre-rendered from a ring of views around its Y axis, drawn as one camera facing quad
+    //per instance; the IMPOSTOR shaders pick the two closest views and light them through the baked normals
+    class Impostor
+    {
+    public:
+        //texture units of the color and normal/depth atlases while drawing
+        static const GLuint COLOR_UNIT = 7;
+        static const GLuint NORMAL_DEPTH_UNIT = 8;
+
+        //renders viewCount views of the model side by side into resolution sized tiles, done once at load time
+        void Bake(gps::Model3D* model, gps::Shader bakeShader, int viewCount, int resolution);
+        void Delete();
+
+        //per instance attributes at locations 3 and 4, laid out as a CrowdInstance
+        void setInstanceBuffer(GLuint buffer);
+
+        void Draw(gps::Shader shader, GLsizei instanceCount);
+        //the variant is picked with FEATURE_IMPOSTOR added to the lighting features of the given ones
+        void Draw(gps::ShaderPermutations& permutations, unsigned int features, GLsizei instanceCount);
+        //draws the DrawArraysIndirectCommand at commandOffset in the bound GL_DRAW_INDIRECT_BUFFER, needs 4.3
+        void DrawIndirect(gps::Shader shader, GLintptr commandOffset);
+        void DrawIndirect(gps::ShaderPermutations& permutations, unsigned int features, GLintptr commandOffset);
+
+    private:
+        //rgb: albedo, a: coverage
+        GLuint colorAtlas = 0;
+        //rgb: object space normal, a: depth along the baked view
+        GLuint normalDepthAtlas = 0;
+        GLuint quadVAO = 0;
+        GLuint quadVBO = 0;
+        int viewCount = 0;
+        //half width of the quad and its bottom and top in object space
+        float radius = 0.0f;
+        float bottom = 0.0f;
+        float top = 0.0f;
+
+        GLuint createAtlas(GLenum internalFormat, int width, int height);
+        void bindAtlases(gps::Shader shader);
+        void unbindAtlases();
+        static unsigned int variantFeatures(unsigned int features);
+    };
+}
+
+#endif /* Impostor_hpp */
@@ -0,0 +1,143 @@
+#include "InputLog.hpp"
+
+#include <cstring>
+#include <iostream>
+
+namespace gps {
+
+	//file layout, native byte order: the magic, a version and the step length, then records of
+	//one type byte each followed by FRAME: u32 steps, f32 alpha, f64 time
+	//KEY: u32 step, i32 key, i32 action  CURSOR: u32 step, f64 x, f64 y
+	static const char MAGIC[8] = { 'G', 'P', 'S', 'I', 'N', 'P', 'U', 'T' };
+	static const unsigned int VERSION = 1;
+	static const unsigned char RECORD_FRAME = 0;
+
+	template <typename T>
+	static void writeValue(std::ofstream& file, const T& value)
+	{
+		file.write((const char*)&value, sizeof(T));
+	}
+
+	template <typename T>
+	static bool readValue(std::ifstream& file, T& value)
+	{
+		return (bool)file.read((char*)&value, sizeof(T));
+	}
+
+	bool InputLog::beginRecording(const std::string& fileName, double stepLength)
+	{
+		file.open(fileName, std::ios::binary | std::ios::trunc);
+		if (!file.is_open()) {
+			std::cerr << "Could not create input log " << fileName << std::endl;
+			return false;
+		}
+		file.write(MAGIC, sizeof(MAGIC));
+		writeValue(file, VERSION);
+		writeValue(file, stepLength);
+		recording = true;
+		return true;
+	}
+
+	bool InputLog::loadReplay(const std::string& fileName, double stepLength)
+	{
+		std::ifstream input(fileName, std::ios::binary);
+		char magic[8];
+		unsigned int version = 0;
+		double recordedStep = 0.0;
+		if (!input.read(magic, sizeof(magic)) || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 ||
+			!readValue(input, version) || version != VERSION || !readValue(input, recordedStep)) {
+			std::cerr << "Not an input log: " << fileName << std::endl;
+			return false;
+		}
+		if (recordedStep != stepLength) {
+			std::cerr << "Input log " << fileName << " was recorded with a different simulation step" << std::endl;
+			return false;
+		}
+
+		frames.clear();
+		events.clear();
+		unsigned char type;
+		while (readValue(input, type)) {
+			if (type == RECORD_FRAME) {
+				InputFrame frame;
+				if (!readValue(input, frame.steps) || !readValue(input, frame.alpha) || !readValue(input, frame.time))
+					break;
+				frames.push_back(frame);
+				continue;
+			}
+
+			StampedEvent stamped;
+			stamped.event.type = (INPUT_EVENT_TYPE)type;
+			stamped.event.key = stamped.event.action = 0;
+			stamped.event.x = stamped.event.y = 0.0;
+			bool complete = readValue(input, stamped.step);
+			if (type == INPUT_KEY)
+				complete = complete && readValue(input, stamped.event.key) && readValue(input, stamped.event.action);
+			else if (type == INPUT_CURSOR)
+				complete = complete && readValue(input, stamped.event.x) && readValue(input, stamped.event.y);
+			else
+				complete = false;
+			if (!complete) {
+				std::cerr << "Input log " << fileName << " is truncated or damaged, replaying what was read" << std::endl;
+				break;
+			}
+			events.push_back(stamped);
+		}
+
+		nextFrameIndex = 0;
+		nextEventIndex = 0;
+		replaying = true;
+		std::cout << "Replaying " << frames.size() << " frames and " << events.size() << " input events" << std::endl;
+		return true;
+	}
+
+	void InputLog::Close()
+	{
+		if (recording)
+			file.close();
+		recording = false;
+		replaying = false;
+	}
+
+	void InputLog::recordEvent(unsigned int step, const InputEvent& event)
+	{
+		if (!recording)
+			return;
+		writeValue(file, (unsigned char)event.type);
+		writeValue(file, step);
+		if (event.type == INPUT_KEY) {
+			writeValue(file, event.key);
+			writeValue(file, event.action);
+		}
+		else {
+			writeValue(file, event.x);
+			writeValue(file, event.y);
+		}
+	}
+
+	void InputLog::recordFrame(const InputFrame& frame)
+	{
+		if (!recording)
+			return;
+		writeValue(file, RECORD_FRAME);
+		writeValue(file, frame.steps);
+		writeValue(file, frame.alpha);
+		writeValue(file, frame.time);
+	}
+
+	bool InputLog::nextFrame(InputFrame& frame)
+	{
+		if (nextFrameIndex >= frames.size())
+			return false;
+		frame = frames[nextFrameIndex++];
+		return true;
+	}
+
+	void InputLog::eventsForStep(unsigned int step, std::vector<InputEvent>& events)
+	{
+		while (nextEventIndex < this->events.size() && this->events[nextEventIndex].step < step)
+			nextEventIndex++;
+		while (nextEventIndex < this->events.size() && this->events[nextEventIndex].step == step)
+			events.push_back(this->events[nextEventIndex++].event);
+	}
+}
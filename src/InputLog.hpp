@@ -0,0 +1,70 @@
+#ifndef InputLog_hpp
+#define InputLog_hpp
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    enum INPUT_EVENT_TYPE {
+        //a GLFW key with GLFW_PRESS, GLFW_RELEASE or GLFW_REPEAT
+        INPUT_KEY = 1,
+        //absolute cursor position in screen coordinates
+        INPUT_CURSOR = 2
+    };
+
+    struct InputEvent {
+        INPUT_EVENT_TYPE type;
+        int key;
+        int action;
+        double x;
+        double y;
+    };
+
+    //how the simulation advanced for one rendered frame
+    struct InputFrame {
+        unsigned int steps;
+        float alpha;
+        //seconds since the start of the session
+        double time;
+    };
+
+    //binary log of a session: every input event stamped with the simulation step that applied it,
+    //and the frame clock as steps plus interpolation factor per frame; replaying both rebuilds
+    //the exact sequence of simulated frames
+    class InputLog
+    {
+    public:
+        //stepLength is stored in the header, a replay with a different step is refused
+        bool beginRecording(const std::string& fileName, double stepLength);
+        bool loadReplay(const std::string& fileName, double stepLength);
+        void Close();
+        bool isRecording() { return recording; }
+        bool isReplaying() { return replaying; }
+
+        void recordEvent(unsigned int step, const InputEvent& event);
+        void recordFrame(const InputFrame& frame);
+
+        //the next recorded frame, false once the log is exhausted
+        bool nextFrame(InputFrame& frame);
+        //appends the events recorded at step, steps have to be asked for in increasing order
+        void eventsForStep(unsigned int step, std::vector<InputEvent>& events);
+
+    private:
+        struct StampedEvent {
+            unsigned int step;
+            InputEvent event;
+        };
+
+        bool recording = false;
+        bool replaying = false;
+        std::ofstream file;
+        std::vector<InputFrame> frames;
+        std::vector<StampedEvent> events;
+        size_t nextFrameIndex = 0;
+        size_t nextEventIndex = 0;
+    };
+}
+
+#endif /* InputLog_hpp */
@@ -0,0 +1,363 @@
+#include "JobSystem.hpp"
+#include "CpuProfiler.hpp"
+#include "AllocationTracker.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+namespace gps {
+
+	//index of the worker running on this thread, -1 outside the job system; only one system is active at a time
+	static thread_local int workerIndex = -1;
+	//per thread state for picking steal victims
+	static thread_local unsigned int stealSeed = 0;
+
+	JobQueue::JobQueue() : top(0), bottom(0)
+	{
+		for (int i = 0; i < CAPACITY; i++)
+			jobs[i].store(NULL, std::memory_order_relaxed);
+	}
+
+	bool JobQueue::push(Job* job)
+	{
+		long long b = bottom.load(std::memory_order_relaxed);
+		long long t = top.load(std::memory_order_acquire);
+		if (b - t >= CAPACITY)
+			return false;
+		jobs[b & (CAPACITY - 1)].store(job, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	Job* JobQueue::pop()
+	{
+		long long b = bottom.load(std::memory_order_relaxed) - 1;
+		bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		long long t = top.load(std::memory_order_relaxed);
+
+		if (t > b) {
+			//empty
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return NULL;
+		}
+
+		Job* job = jobs[b & (CAPACITY - 1)].load(std::memory_order_relaxed);
+		if (t == b) {
+			//last job, race the thieves for it
+			if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+				job = NULL;
+			bottom.store(b + 1, std::memory_order_relaxed);
+		}
+		return job;
+	}
+
+	Job* JobQueue::steal()
+	{
+		long long t = top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		long long b = bottom.load(std::memory_order_acquire);
+		if (t >= b)
+			return NULL;
+
+		Job* job = jobs[t & (CAPACITY - 1)].load(std::memory_order_relaxed);
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			return NULL;
+		return job;
+	}
+
+	void JobSystem::Init(unsigned int threadCount)
+	{
+		if (threadCount == 0)
+			threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+		stopping.store(false);
+		sleeping.store(0);
+		for (unsigned int i = 0; i < threadCount; i++) {
+			queues.push_back(std::unique_ptr<JobQueue>(new JobQueue()));
+			pools.push_back(std::unique_ptr<Job[]>(new Job[MAX_JOBS_PER_WORKER]));
+			//every slot starts out finished, createJob only reuses finished ones
+			for (int j = 0; j < MAX_JOBS_PER_WORKER; j++)
+				pools[i][j].unfinished.store(0, std::memory_order_relaxed);
+			poolHeads.push_back(0);
+		}
+
+		workerIndex = 0;
+		stealSeed = 1;
+		for (unsigned int i = 1; i < threadCount; i++)
+			threads.push_back(std::thread(&JobSystem::workerLoop, this, (int)i));
+	}
+
+	void JobSystem::Delete()
+	{
+		stopping.store(true, std::memory_order_release);
+		wakeup.notify_all();
+		for (size_t i = 0; i < threads.size(); i++)
+			threads[i].join();
+		threads.clear();
+		queues.clear();
+		pools.clear();
+		poolHeads.clear();
+		workerIndex = -1;
+	}
+
+	void JobSystem::workerLoop(int index)
+	{
+		workerIndex = index;
+		stealSeed = 2654435761u * (index + 1);
+		std::string name = "worker " + std::to_string(index);
+		CpuProfiler::setThreadName(name.c_str());
+
+		int idle = 0;
+		while (!stopping.load(std::memory_order_acquire)) {
+			Job* job = getJob();
+			if (job) {
+				execute(job);
+				idle = 0;
+			}
+			else if (++idle < 64) {
+				std::this_thread::yield();
+			}
+			else {
+				//the timeout covers a wakeup that is sent between our last look and the wait
+				std::unique_lock<std::mutex> lock(sleepMutex);
+				sleeping++;
+				wakeup.wait_for(lock, std::chrono::milliseconds(1));
+				sleeping--;
+			}
+		}
+	}
+
+	Job* JobSystem::allocateJob()
+	{
+		assert(workerIndex >= 0 && workerIndex < (int)pools.size() && "jobs can only be created on the thread that called Init or on a worker");
+		for (;;) {
+			//the oldest slot is usually finished; live ones are skipped, e.g. a parent still waiting for its children
+			for (int i = 0; i < MAX_JOBS_PER_WORKER; i++) {
+				Job* job = &pools[workerIndex][poolHeads[workerIndex]++ & (MAX_JOBS_PER_WORKER - 1)];
+				if (isFinished(job))
+					return job;
+			}
+			//every job of this worker is alive, run one of the queued ones so a slot frees up
+			Job* next = getJob();
+			if (next)
+				execute(next);
+			else
+				std::this_thread::yield();
+		}
+	}
+
+	Job* JobSystem::createJob(std::function<void()> work, Job* parent)
+	{
+		Job* job = allocateJob();
+		job->work = std::move(work);
+		job->parent = parent;
+		job->allocationTag = AllocationTracker::getTag();
+		job->unfinished.store(1, std::memory_order_relaxed);
+		job->pending.store(1, std::memory_order_relaxed);
+		job->dependentCount = 0;
+		if (parent)
+			parent->unfinished.fetch_add(1, std::memory_order_relaxed);
+		return job;
+	}
+
+	void JobSystem::addDependency(Job* job, Job* dependency)
+	{
+		if (dependency->dependentCount == Job::MAX_DEPENDENTS) {
+			std::cerr << "Job has too many dependents, dependency ignored" << std::endl;
+			return;
+		}
+		job->pending.fetch_add(1, std::memory_order_relaxed);
+		dependency->dependents[dependency->dependentCount++] = job;
+	}
+
+	void JobSystem::run(Job* job)
+	{
+		release(job);
+	}
+
+	void JobSystem::release(Job* job)
+	{
+		if (job->pending.fetch_sub(1, std::memory_order_acq_rel) != 1)
+			return;
+
+		if (!queues[workerIndex]->push(job)) {
+			//our deque is full, nothing is lost by running it right away
+			execute(job);
+			return;
+		}
+		if (sleeping.load(std::memory_order_relaxed) > 0)
+			wakeup.notify_one();
+	}
+
+	void JobSystem::wait(Job* job)
+	{
+		while (!isFinished(job)) {
+			Job* next = getJob();
+			if (next)
+				execute(next);
+			else
+				std::this_thread::yield();
+		}
+	}
+
+	Job* JobSystem::getJob()
+	{
+		Job* job = queues[workerIndex]->pop();
+		if (job)
+			return job;
+
+		//start at a random victim so the thieves spread out
+		int workers = (int)queues.size();
+		stealSeed ^= stealSeed << 13;
+		stealSeed ^= stealSeed >> 17;
+		stealSeed ^= stealSeed << 5;
+		int start = (int)(stealSeed % workers);
+		for (int i = 0; i < workers; i++) {
+			int victim = (start + i) % workers;
+			if (victim == workerIndex)
+				continue;
+			job = queues[victim]->steal();
+			if (job)
+				return job;
+		}
+		return NULL;
+	}
+
+	void JobSystem::execute(Job* job)
+	{
+		if (job->work) {
+			CpuZone zone("job");
+			AllocationScope allocationScope((ALLOCATION_TAG)job->allocationTag);
+			job->work();
+		}
+		finish(job);
+	}
+
+	void JobSystem::finish(Job* job)
+	{
+		//a finished job may be recycled at once, so read everything before the decrement
+		Job* parent = job->parent;
+		int dependentCount = job->dependentCount;
+		Job* dependents[Job::MAX_DEPENDENTS];
+		for (int i = 0; i < dependentCount; i++)
+			dependents[i] = job->dependents[i];
+
+		if (job->unfinished.fetch_sub(1, std::memory_order_acq_rel) != 1)
+			return;
+
+		for (int i = 0; i < dependentCount; i++)
+			release(dependents[i]);
+		if (parent)
+			finish(parent);
+	}
+
+	void JobSystem::parallelFor(size_t count, size_t grain, const std::function<void(size_t first, size_t last)>& body)
+	{
+		if (count == 0)
+			return;
+
+		//keep well inside the job ring
+		size_t maxChunks = MAX_JOBS_PER_WORKER / 4;
+		grain = std::max(grain, std::max((size_t)1, (count + maxChunks - 1) / maxChunks));
+		if (count <= grain || queues.size() == 1) {
+			body(0, count);
+			return;
+		}
+
+		//the chunk jobs capture a reference and an index only, small enough for std::function to store
+		//without allocating; the loop outlives them because it waits for root
+		struct Chunks {
+			const std::function<void(size_t first, size_t last)>* body;
+			size_t grain, count;
+		} chunks = { &body, grain, count };
+		Job* root = createJob(std::function<void()>());
+		for (size_t first = 0; first < count; first += grain) {
+			run(createJob([&chunks, first]() { (*chunks.body)(first, std::min(first + chunks.grain, chunks.count)); }, root));
+		}
+		run(root);
+		wait(root);
+	}
+
+	bool benchmarkJobSystem(unsigned int threadCount)
+	{
+		JobSystem jobs;
+		jobs.Init(threadCount);
+		bool passed = true;
+		std::cout << "Job system, " << jobs.getWorkerCount() << " workers" << std::endl;
+
+		//parallelFor covers every index exactly once
+		std::vector<int> hits(1000003, 0);
+		jobs.parallelFor(hits.size(), 1000, [&hits](size_t first, size_t last) {
+			for (size_t i = first; i < last; i++)
+				hits[i]++;
+		});
+		bool covered = std::count(hits.begin(), hits.end(), 1) == (long)hits.size();
+		std::cout << "  parallelFor coverage : " << (covered ? "ok" : "FAILED") << std::endl;
+		passed = passed && covered;
+
+		//dependencies: 64 producers, one consumer that must see all of them, then a chain of three
+		std::atomic<int> produced(0);
+		std::atomic<int> order(0);
+		bool consumerSawAll = false;
+		int chain[3] = { -1, -1, -1 };
+		Job* root = jobs.createJob(std::function<void()>());
+		Job* consumer = jobs.createJob([&]() { consumerSawAll = produced.load() == 64; chain[0] = order++; }, root);
+		Job* second = jobs.createJob([&]() { chain[1] = order++; }, root);
+		Job* third = jobs.createJob([&]() { chain[2] = order++; }, root);
+		jobs.addDependency(second, consumer);
+		jobs.addDependency(third, second);
+		Job* group = jobs.createJob(std::function<void()>(), root);
+		for (int i = 0; i < 64; i++)
+			jobs.run(jobs.createJob([&produced]() { produced++; }, group));
+		jobs.addDependency(consumer, group);
+		jobs.run(third);
+		jobs.run(second);
+		jobs.run(consumer);
+		jobs.run(group);
+		jobs.run(root);
+		jobs.wait(root);
+		bool ordered = consumerSawAll && chain[0] == 0 && chain[1] == 1 && chain[2] == 2;
+		std::cout << "  dependency order     : " << (ordered ? "ok" : "FAILED") << std::endl;
+		passed = passed && ordered;
+
+		//scheduling overhead of empty jobs
+		const int batches = 200, batchSize = 1000;
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		for (int b = 0; b < batches; b++) {
+			Job* batch = jobs.createJob(std::function<void()>());
+			for (int i = 0; i < batchSize; i++)
+				jobs.run(jobs.createJob([]() {}, batch));
+			jobs.run(batch);
+			jobs.wait(batch);
+		}
+		double overhead = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - start).count() / (batches * batchSize);
+		std::cout << "  empty job            : " << overhead << " ns" << std::endl;
+
+		//compute bound loop, serial against parallelFor
+		std::vector<float> values(1 << 22);
+		start = std::chrono::high_resolution_clock::now();
+		for (size_t i = 0; i < values.size(); i++)
+			values[i] = std::sqrt((float)i) * std::sin((float)i);
+		double serialTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		std::vector<float> parallelValues(values.size());
+		start = std::chrono::high_resolution_clock::now();
+		jobs.parallelFor(parallelValues.size(), 16384, [&parallelValues](size_t first, size_t last) {
+			for (size_t i = first; i < last; i++)
+				parallelValues[i] = std::sqrt((float)i) * std::sin((float)i);
+		});
+		double parallelTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		bool same = values == parallelValues;
+		std::cout << "  serial loop          : " << serialTime << " ms" << std::endl;
+		std::cout << "  parallelFor loop     : " << parallelTime << " ms (" << serialTime / parallelTime << "x)" << (same ? "" : " RESULTS DIFFER") << std::endl;
+		passed = passed && same;
+
+		jobs.Delete();
+		std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+		return passed;
+	}
+}
@@ -0,0 +1,102 @@
+#ifndef JobSystem_hpp
+#define JobSystem_hpp
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gps {
+
+    //unit of work; a job counts as finished once its function and all of its children have run
+    struct Job {
+        static const int MAX_DEPENDENTS = 8;
+
+        std::function<void()> work;
+        Job* parent;
+        //the ALLOCATION_TAG of the thread that created the job, the job runs with it
+        int allocationTag;
+        //the job itself plus its unfinished children
+        std::atomic<int> unfinished;
+        //one submission token plus one per unfinished dependency, the job is queued when this reaches 0
+        std::atomic<int> pending;
+        int dependentCount;
+        Job* dependents[MAX_DEPENDENTS];
+    };
+
+    //Chase-Lev deque: the owning worker pushes and pops at the bottom, thieves steal from the top
+    class JobQueue
+    {
+    public:
+        static const int CAPACITY = 4096;
+
+        JobQueue();
+        //owner only, returns false when full
+        bool push(Job* job);
+        //owner only
+        Job* pop();
+        //any thread
+        Job* steal();
+
+    private:
+        std::atomic<long long> top;
+        std::atomic<long long> bottom;
+        std::atomic<Job*> jobs[CAPACITY];
+    };
+
+    //work-stealing scheduler: one deque per worker, the thread calling Init is worker 0
+    //and helps out while it waits; jobs may only be created and run from worker threads
+    class JobSystem
+    {
+    public:
+        //jobs are recycled from a ring per worker, skipping the ones still alive; with this many alive,
+        //creating another one runs queued jobs until one finishes
+        static const int MAX_JOBS_PER_WORKER = 4096;
+
+        //threadCount includes the calling thread, 0 uses every hardware thread
+        void Init(unsigned int threadCount = 0);
+        void Delete();
+        int getWorkerCount() { return (int)queues.size(); }
+
+        //work may be empty for jobs that only group children
+        Job* createJob(std::function<void()> work, Job* parent = NULL);
+        //job will not start before dependency (and its children) finished; call before running either of them
+        void addDependency(Job* job, Job* dependency);
+        void run(Job* job);
+        //executes other jobs until job has finished
+        void wait(Job* job);
+        bool isFinished(Job* job) { return job->unfinished.load(std::memory_order_acquire) == 0; }
+
+        //splits [0, count) into ranges of at least grain items and runs body on them in parallel, returns when all are done
+        void parallelFor(size_t count, size_t grain, const std::function<void(size_t first, size_t last)>& body);
+
+    private:
+        std::vector<std::unique_ptr<JobQueue>> queues;
+        std::vector<std::unique_ptr<Job[]>> pools;
+        std::vector<unsigned int> poolHeads;
+        std::vector<std::thread> threads;
+        std::atomic<bool> stopping;
+
+        //idle workers sleep here after spinning for a while
+        std::mutex sleepMutex;
+        std::condition_variable wakeup;
+        std::atomic<int> sleeping;
+
+        void workerLoop(int index);
+        Job* getJob();
+        //a finished slot of this worker's ring
+        Job* allocateJob();
+        void execute(Job* job);
+        void finish(Job* job);
+        void release(Job* job);
+    };
+
+    //checks ordering and results of the scheduler and times it against serial loops, needs no window;
+    //returns false if any check failed
+    bool benchmarkJobSystem(unsigned int threadCount);
+}
+
+#endif /* JobSystem_hpp */
@@ -0,0 +1,344 @@
+#include "LightClusters.hpp"
+#include "MemoryStats.hpp"
+#include "RenderStats.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define GPS_CLUSTERS_SSE 1
+#endif
+
+namespace gps {
+
+	void LightClusters::Init()
+	{
+		glGenBuffers(1, &lightBuffer);
+		glGenBuffers(1, &gridBuffer);
+		glGenBuffers(1, &indexBuffer);
+		glGenTextures(1, &lightTexture);
+		glGenTextures(1, &gridTexture);
+		glGenTextures(1, &indexTexture);
+
+		//allocate for the worst case once, uploads only touch the used part
+		glBindBuffer(GL_TEXTURE_BUFFER, lightBuffer);
+		glBufferData(GL_TEXTURE_BUFFER, MAX_LIGHTS * 2 * sizeof(glm::vec4), NULL, GL_STREAM_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, gridBuffer);
+		glBufferData(GL_TEXTURE_BUFFER, CLUSTER_COUNT * 2 * sizeof(GLuint), NULL, GL_STREAM_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, indexBuffer);
+		glBufferData(GL_TEXTURE_BUFFER, CLUSTER_COUNT * MAX_LIGHTS_PER_CLUSTER * sizeof(GLuint), NULL, GL_STREAM_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+		//the buffer textures below are views of these and hold nothing of their own
+		MemoryStats::trackBuffer(lightBuffer, MAX_LIGHTS * 2 * sizeof(glm::vec4), "light clusters");
+		MemoryStats::trackBuffer(gridBuffer, CLUSTER_COUNT * 2 * sizeof(GLuint), "light clusters");
+		MemoryStats::trackBuffer(indexBuffer, CLUSTER_COUNT * MAX_LIGHTS_PER_CLUSTER * sizeof(GLuint), "light clusters");
+
+		glBindTexture(GL_TEXTURE_BUFFER, lightTexture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, lightBuffer);
+		glBindTexture(GL_TEXTURE_BUFFER, gridTexture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, gridBuffer);
+		glBindTexture(GL_TEXTURE_BUFFER, indexTexture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, indexBuffer);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+	}
+
+	void LightClusters::Delete()
+	{
+		glDeleteTextures(1, &lightTexture);
+		glDeleteTextures(1, &gridTexture);
+		glDeleteTextures(1, &indexTexture);
+		MemoryStats::deleteBuffers(1, &lightBuffer);
+		MemoryStats::deleteBuffers(1, &gridBuffer);
+		MemoryStats::deleteBuffers(1, &indexBuffer);
+	}
+
+	void LightClusters::setProjection(float fovY, float aspect, float nearPlane, float farPlane)
+	{
+		this->nearPlane = nearPlane;
+		this->farPlane = farPlane;
+
+		minX.resize(CLUSTER_COUNT); minY.resize(CLUSTER_COUNT); minZ.resize(CLUSTER_COUNT);
+		maxX.resize(CLUSTER_COUNT); maxY.resize(CLUSTER_COUNT); maxZ.resize(CLUSTER_COUNT);
+		clusterCounts.assign(CLUSTER_COUNT, 0);
+		clusterLights.assign(CLUSTER_COUNT * MAX_LIGHTS_PER_CLUSTER, 0);
+		grid.assign(CLUSTER_COUNT * 2, 0);
+		//compact never needs more, so it never allocates
+		indices.reserve(std::max(clusterLights.size(), (size_t)MAX_LIGHTS));
+
+		tanY = std::tan(fovY * 0.5f);
+		tanX = tanY * aspect;
+
+		for (int z = 0; z < CLUSTERS_Z; z++) {
+			//exponential slicing keeps the froxels roughly cubic
+			float d0 = nearPlane * std::pow(farPlane / nearPlane, (float)z / CLUSTERS_Z);
+			float d1 = nearPlane * std::pow(farPlane / nearPlane, (float)(z + 1) / CLUSTERS_Z);
+			for (int y = 0; y < CLUSTERS_Y; y++) {
+				float ny0 = -1.0f + 2.0f * y / CLUSTERS_Y;
+				float ny1 = -1.0f + 2.0f * (y + 1) / CLUSTERS_Y;
+				for (int x = 0; x < CLUSTERS_X; x++) {
+					float nx0 = -1.0f + 2.0f * x / CLUSTERS_X;
+					float nx1 = -1.0f + 2.0f * (x + 1) / CLUSTERS_X;
+					int c = x + CLUSTERS_X * (y + CLUSTERS_Y * z);
+					//bounds of the 8 frustum corners, the camera looks down -z
+					minX[c] = std::min(nx0 * d0, nx0 * d1) * tanX;
+					maxX[c] = std::max(nx1 * d0, nx1 * d1) * tanX;
+					minY[c] = std::min(ny0 * d0, ny0 * d1) * tanY;
+					maxY[c] = std::max(ny1 * d0, ny1 * d1) * tanY;
+					minZ[c] = -d1;
+					maxZ[c] = -d0;
+				}
+			}
+		}
+	}
+
+	int LightClusters::sliceForDepth(float depth)
+	{
+		if (depth <= nearPlane)
+			return 0;
+		int slice = (int)std::floor(std::log(depth / nearPlane) / std::log(farPlane / nearPlane) * CLUSTERS_Z);
+		return std::min(std::max(slice, 0), CLUSTERS_Z - 1);
+	}
+
+	int LightClusters::clusterForPoint(glm::vec3 positionEye)
+	{
+		//the screen tile of the projected position, as gl_FragCoord divided by the pixels per tile
+		float depth = -positionEye.z;
+		float screenX = (positionEye.x / (depth * tanX)) * 0.5f + 0.5f;
+		float screenY = (positionEye.y / (depth * tanY)) * 0.5f + 0.5f;
+		int x = std::min(std::max((int)std::floor(screenX * CLUSTERS_X), 0), CLUSTERS_X - 1);
+		int y = std::min(std::max((int)std::floor(screenY * CLUSTERS_Y), 0), CLUSTERS_Y - 1);
+		return x + CLUSTERS_X * (y + CLUSTERS_Y * sliceForDepth(depth));
+	}
+
+	void LightClusters::prepareLights(const std::vector<PointLight>& lights, const glm::mat4& view)
+	{
+		size_t count = std::min(lights.size(), (size_t)MAX_LIGHTS);
+		viewLights.resize(count);
+		lightData.resize(count * 2);
+		for (size_t i = 0; i < count; i++) {
+			glm::vec4 positionEye = view * glm::vec4(lights[i].position, 1.0f);
+			viewLights[i] = glm::vec4(glm::vec3(positionEye), lights[i].radius);
+			lightData[2 * i] = viewLights[i];
+			lightData[2 * i + 1] = glm::vec4(lights[i].color * lights[i].intensity, 0.0f);
+		}
+		std::fill(clusterCounts.begin(), clusterCounts.end(), 0);
+	}
+
+	void LightClusters::binSlices(int firstSlice, int lastSlice)
+	{
+		for (GLuint l = 0; l < viewLights.size(); l++) {
+			glm::vec4 light = viewLights[l];
+			float r2 = light.w * light.w;
+
+			//slices touched by the sphere, widened by one to stay conservative at the boundaries
+			int z0 = std::max(sliceForDepth(-light.z - light.w) - 1, firstSlice);
+			int z1 = std::min(sliceForDepth(-light.z + light.w) + 1, lastSlice);
+
+			for (int z = z0; z <= z1; z++) {
+				for (int y = 0; y < CLUSTERS_Y; y++) {
+					int row = CLUSTERS_X * (y + CLUSTERS_Y * z);
+					//the y and z extents are shared by the whole row
+					float dy = std::max(minY[row] - light.y, 0.0f) + std::max(light.y - maxY[row], 0.0f);
+					float dz = std::max(minZ[row] - light.z, 0.0f) + std::max(light.z - maxZ[row], 0.0f);
+					float dyz = dy * dy + dz * dz;
+					if (dyz > r2)
+						continue;
+#ifdef GPS_CLUSTERS_SSE
+					__m128 cx = _mm_set1_ps(light.x);
+					__m128 zero = _mm_setzero_ps();
+					__m128 yz = _mm_set1_ps(dyz);
+					__m128 limit = _mm_set1_ps(r2);
+					for (int x = 0; x < CLUSTERS_X; x += 4) {
+						__m128 below = _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minX[row + x]), cx), zero);
+						__m128 above = _mm_max_ps(_mm_sub_ps(cx, _mm_loadu_ps(&maxX[row + x])), zero);
+						__m128 dx = _mm_add_ps(below, above);
+						int mask = _mm_movemask_ps(_mm_cmple_ps(_mm_add_ps(_mm_mul_ps(dx, dx), yz), limit));
+						while (mask) {
+							int lane = 0;
+							while (!(mask & (1 << lane)))
+								lane++;
+							mask &= ~(1 << lane);
+							int c = row + x + lane;
+							if (clusterCounts[c] < MAX_LIGHTS_PER_CLUSTER)
+								clusterLights[c * MAX_LIGHTS_PER_CLUSTER + clusterCounts[c]++] = l;
+						}
+					}
+#else
+					for (int x = 0; x < CLUSTERS_X; x++) {
+						int c = row + x;
+						float dx = std::max(minX[c] - light.x, 0.0f) + std::max(light.x - maxX[c], 0.0f);
+						if (dx * dx + dyz <= r2 && clusterCounts[c] < MAX_LIGHTS_PER_CLUSTER)
+							clusterLights[c * MAX_LIGHTS_PER_CLUSTER + clusterCounts[c]++] = l;
+					}
+#endif
+				}
+			}
+		}
+	}
+
+	void LightClusters::compact()
+	{
+		indices.clear();
+		for (int c = 0; c < CLUSTER_COUNT; c++) {
+			grid[2 * c] = (GLuint)indices.size();
+			grid[2 * c + 1] = clusterCounts[c];
+			indices.insert(indices.end(), clusterLights.begin() + c * MAX_LIGHTS_PER_CLUSTER,
+				clusterLights.begin() + c * MAX_LIGHTS_PER_CLUSTER + clusterCounts[c]);
+		}
+	}
+
+	void LightClusters::listAllLights()
+	{
+		//one list shared by every cluster, the shader then loops over all lights
+		indices.clear();
+		for (GLuint l = 0; l < viewLights.size(); l++)
+			indices.push_back(l);
+		for (int c = 0; c < CLUSTER_COUNT; c++) {
+			grid[2 * c] = 0;
+			grid[2 * c + 1] = (GLuint)viewLights.size();
+		}
+	}
+
+	void LightClusters::Build(const std::vector<PointLight>& lights, const glm::mat4& view, gps::JobSystem& jobs)
+	{
+		if (unclustered) {
+			prepareLights(lights, view);
+			listAllLights();
+			return;
+		}
+		buildClusters(lights, view, jobs);
+	}
+
+	void LightClusters::buildClusters(const std::vector<PointLight>& lights, const glm::mat4& view, gps::JobSystem& jobs)
+	{
+		prepareLights(lights, view);
+
+		//every job owns a range of slices, so no two workers write the same cluster
+		jobs.parallelFor(CLUSTERS_Z, 2, [this](size_t first, size_t last) {
+			binSlices((int)first, (int)last - 1);
+		});
+
+		compact();
+	}
+
+	void LightClusters::BuildReference(const std::vector<PointLight>& lights, const glm::mat4& view)
+	{
+		prepareLights(lights, view);
+
+		for (int c = 0; c < CLUSTER_COUNT; c++) {
+			for (GLuint l = 0; l < viewLights.size(); l++) {
+				glm::vec4 light = viewLights[l];
+				float dx = std::max(minX[c] - light.x, 0.0f) + std::max(light.x - maxX[c], 0.0f);
+				float dy = std::max(minY[c] - light.y, 0.0f) + std::max(light.y - maxY[c], 0.0f);
+				float dz = std::max(minZ[c] - light.z, 0.0f) + std::max(light.z - maxZ[c], 0.0f);
+				if (dx * dx + (dy * dy + dz * dz) <= light.w * light.w && clusterCounts[c] < MAX_LIGHTS_PER_CLUSTER)
+					clusterLights[c * MAX_LIGHTS_PER_CLUSTER + clusterCounts[c]++] = l;
+			}
+		}
+
+		compact();
+	}
+
+	//the point light term of basic.frag without the surface factors, those scale every light the same
+	static glm::vec3 pointLightTerm(glm::vec4 lightEye, glm::vec4 color, glm::vec3 positionEye)
+	{
+		float distance = glm::length(glm::vec3(lightEye) - positionEye);
+		float attenuation = 1.0f / (1.0f + 0.00225f * distance + 0.00375f * distance * distance);
+		float window = std::min(std::max(1.0f - std::pow(distance / lightEye.w, 4.0f), 0.0f), 1.0f);
+		return glm::vec3(color) * attenuation * window * window;
+	}
+
+	bool LightClusters::Validate(const std::vector<PointLight>& lights, const glm::mat4& view, gps::JobSystem& jobs)
+	{
+		BuildReference(lights, view);
+		referenceGrid = grid;
+		referenceIndices = indices;
+		buildClusters(lights, view, jobs);
+
+		//the same lights in the same order, the fast path only skips froxels the reference rejects as well
+		for (int c = 0; c < CLUSTER_COUNT; c++) {
+			if (grid[2 * c + 1] != referenceGrid[2 * c + 1]) {
+				std::cerr << "Light cluster " << c << " has " << grid[2 * c + 1] << " lights, the reference has " << referenceGrid[2 * c + 1] << std::endl;
+				return false;
+			}
+			for (GLuint i = 0; i < grid[2 * c + 1]; i++) {
+				if (indices[grid[2 * c] + i] != referenceIndices[referenceGrid[2 * c] + i]) {
+					std::cerr << "Light cluster " << c << " differs from the reference at entry " << i << std::endl;
+					return false;
+				}
+			}
+		}
+
+		//inside, at the edge of and just past every light's radius, toward the 26 neighbours of a cube cell
+		const float fractions[4] = { 0.25f, 0.6f, 0.95f, 1.05f };
+		for (size_t l = 0; l < viewLights.size(); l++) {
+			for (int f = 0; f < 4; f++) {
+				for (int d = 0; d < 27; d++) {
+					glm::vec3 direction((float)(d % 3 - 1), (float)(d / 3 % 3 - 1), (float)(d / 9 - 1));
+					if (d == 13)
+						continue;
+					glm::vec3 point = glm::vec3(viewLights[l]) + glm::normalize(direction) * viewLights[l].w * fractions[f];
+					float depth = -point.z;
+					if (depth <= nearPlane || depth >= farPlane || std::fabs(point.x) > depth * tanX || std::fabs(point.y) > depth * tanY)
+						continue;
+
+					int c = clusterForPoint(point);
+					glm::vec3 clustered(0.0f), reference(0.0f);
+					for (GLuint i = 0; i < grid[2 * c + 1]; i++) {
+						GLuint light = indices[grid[2 * c] + i];
+						clustered += pointLightTerm(viewLights[light], lightData[2 * light + 1], point);
+					}
+					for (GLuint i = 0; i < viewLights.size(); i++)
+						reference += pointLightTerm(viewLights[i], lightData[2 * i + 1], point);
+
+					if (glm::length(clustered - reference) > 1e-4f * (1.0f + glm::length(reference))) {
+						std::cerr << "Point lights at eye position (" << point.x << ", " << point.y << ", " << point.z << ") in cluster " << c
+							<< " add up to " << glm::length(clustered) << ", all lights give " << glm::length(reference) << std::endl;
+						return false;
+					}
+				}
+			}
+		}
+		return true;
+	}
+
+	void LightClusters::Upload()
+	{
+		glBindBuffer(GL_TEXTURE_BUFFER, lightBuffer);
+		if (!lightData.empty())
+			RenderStats::bufferSubData(GL_TEXTURE_BUFFER, 0, lightData.size() * sizeof(glm::vec4), glm::value_ptr(lightData[0]));
+		glBindBuffer(GL_TEXTURE_BUFFER, gridBuffer);
+		RenderStats::bufferSubData(GL_TEXTURE_BUFFER, 0, grid.size() * sizeof(GLuint), &grid[0]);
+		glBindBuffer(GL_TEXTURE_BUFFER, indexBuffer);
+		if (!indices.empty())
+			RenderStats::bufferSubData(GL_TEXTURE_BUFFER, 0, indices.size() * sizeof(GLuint), &indices[0]);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	}
+
+	void LightClusters::setSamplerUnits(gps::Shader shader, GLuint firstUnit)
+	{
+		shader.useShaderProgram();
+		glUniform1i(glGetUniformLocation(shader.shaderProgram, "clusterLights"), firstUnit);
+		glUniform1i(glGetUniformLocation(shader.shaderProgram, "clusterGrid"), firstUnit + 1);
+		glUniform1i(glGetUniformLocation(shader.shaderProgram, "clusterIndices"), firstUnit + 2);
+	}
+
+	void LightClusters::Bind(GLuint firstUnit)
+	{
+		RenderStats::activeTexture(GL_TEXTURE0 + firstUnit);
+		RenderStats::bindTexture(GL_TEXTURE_BUFFER, lightTexture);
+		RenderStats::activeTexture(GL_TEXTURE0 + firstUnit + 1);
+		RenderStats::bindTexture(GL_TEXTURE_BUFFER, gridTexture);
+		RenderStats::activeTexture(GL_TEXTURE0 + firstUnit + 2);
+		RenderStats::bindTexture(GL_TEXTURE_BUFFER, indexTexture);
+	}
+
+	glm::vec4 LightClusters::getShaderParams(float screenWidth, float screenHeight)
+	{
+		return glm::vec4(screenWidth / CLUSTERS_X, screenHeight / CLUSTERS_Y, nearPlane, CLUSTERS_Z / std::log(farPlane / nearPlane));
+	}
+}
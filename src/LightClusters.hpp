@@ -0,0 +1,107 @@
+#ifndef LightClusters_hpp
+#define LightClusters_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include "Shader.hpp"
+#include "JobSystem.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    //point light with a finite range, positions are in world space
+    struct PointLight {
+        glm::vec3 position;
+        float radius;
+        glm::vec3 color;
+        float intensity;
+    };
+
+    //bins point lights into a view space froxel grid (screen tiles x exponential depth slices)
+    //and uploads the per cluster light lists as buffer textures for the fragment shader
+    class LightClusters
+    {
+    public:
+        //must match the constants in basic.frag
+        static const int CLUSTERS_X = 16;
+        static const int CLUSTERS_Y = 9;
+        static const int CLUSTERS_Z = 24;
+        static const int CLUSTER_COUNT = CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z;
+        static const int MAX_LIGHTS = 256;
+        //lights past this are dropped from a cluster, so it has to cover every light that can overlap one
+        static const int MAX_LIGHTS_PER_CLUSTER = 64;
+
+        //the buffer textures, needs a GL context
+        void Init();
+        void Delete();
+
+        //recomputes the froxel bounds and sizes the CPU lists, only needed when the projection changes;
+        //building and validating need no GL context after this
+        void setProjection(float fovY, float aspect, float nearPlane, float farPlane);
+
+        //fast path: z-slice range per light, SIMD sphere/box tests along the tile rows, slices split across jobs
+        void Build(const std::vector<PointLight>& lights, const glm::mat4& view, gps::JobSystem& jobs);
+        //brute force reference: every light against every froxel, single threaded
+        void BuildReference(const std::vector<PointLight>& lights, const glm::mat4& view);
+        //compares the light list of every froxel with the reference, then shades points in and around every
+        //light's radius the way basic.frag does, once through the cluster the shader would look up and once
+        //with all lights; checks the clustered path even when unclustered, returns false on the first difference
+        bool Validate(const std::vector<PointLight>& lights, const glm::mat4& view, gps::JobSystem& jobs);
+        //fallback for a failed validation: every cluster lists every light, as slow as shading without clusters
+        void setUnclustered(bool unclustered) { this->unclustered = unclustered; }
+        bool isUnclustered() { return unclustered; }
+
+        //uploads the last build into the buffer textures
+        void Upload();
+        //points the cluster samplers of a program at three consecutive units, once per program
+        void setSamplerUnits(gps::Shader shader, GLuint firstUnit);
+        //binds the buffer textures to three consecutive units starting at firstUnit
+        void Bind(GLuint firstUnit);
+        //x, y: pixels per tile, z: near plane, w: slices per log unit of depth
+        glm::vec4 getShaderParams(float screenWidth, float screenHeight);
+
+        const std::vector<GLuint>& getGrid() { return grid; }
+        const std::vector<GLuint>& getIndices() { return indices; }
+
+    private:
+        float nearPlane;
+        float farPlane;
+        //half extents of the view at depth 1
+        float tanX, tanY;
+        bool unclustered = false;
+
+        //froxel bounds in view space, structure of arrays indexed by cluster id
+        std::vector<float> minX, minY, minZ, maxX, maxY, maxZ;
+
+        //lights transformed to view space for the current build
+        std::vector<glm::vec4> viewLights;
+        //per cluster scratch lists filled by the binning pass
+        std::vector<GLuint> clusterCounts;
+        std::vector<GLuint> clusterLights;
+
+        //compacted output: (offset, count) per cluster and the light index list
+        std::vector<GLuint> grid;
+        std::vector<GLuint> indices;
+        std::vector<glm::vec4> lightData;
+        //the reference build kept by Validate
+        std::vector<GLuint> referenceGrid;
+        std::vector<GLuint> referenceIndices;
+
+        GLuint lightBuffer = 0, gridBuffer = 0, indexBuffer = 0;
+        GLuint lightTexture = 0, gridTexture = 0, indexTexture = 0;
+
+        int sliceForDepth(float depth);
+        //the cluster computeClusterLights reads for a fragment at this view space position
+        int clusterForPoint(glm::vec3 positionEye);
+        void prepareLights(const std::vector<PointLight>& lights, const glm::mat4& view);
+        void binSlices(int firstSlice, int lastSlice);
+        void compact();
+        //Build without the fallback, what Validate checks
+        void buildClusters(const std::vector<PointLight>& lights, const glm::mat4& view, gps::JobSystem& jobs);
+        void listAllLights();
+    };
+}
+
+#endif /* LightClusters_hpp */
@@ -0,0 +1,177 @@
+#include "MemoryStats.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace gps {
+
+	struct MemoryEntry {
+		size_t bytes;
+		std::string owner;
+	};
+
+	//never freed, models are released by global destructors that may run after those of this file
+	struct MemoryRegistry {
+		std::map<GLuint, MemoryEntry> buffers;
+		std::map<GLuint, MemoryEntry> textures;
+		std::map<const void*, MemoryEntry> cpu;
+	};
+
+	size_t MemoryStats::gpuBytes = 0;
+	size_t MemoryStats::cpuBytes = 0;
+
+	static MemoryRegistry& getRegistry()
+	{
+		static MemoryRegistry* registry = new MemoryRegistry();
+		return *registry;
+	}
+
+	template <typename Key>
+	static void setEntry(std::map<Key, MemoryEntry>& entries, Key key, size_t bytes, const std::string& owner, size_t& total)
+	{
+		typename std::map<Key, MemoryEntry>::iterator entry = entries.find(key);
+		if (entry != entries.end()) {
+			total -= entry->second.bytes;
+			entry->second.bytes = bytes;
+			//buffers orphaned every frame keep their owner, nothing is copied then
+			if (entry->second.owner != owner)
+				entry->second.owner = owner;
+		}
+		else {
+			MemoryEntry created = { bytes, owner };
+			entries.insert(std::make_pair(key, created));
+		}
+		total += bytes;
+	}
+
+	template <typename Key>
+	static void eraseEntry(std::map<Key, MemoryEntry>& entries, Key key, size_t& total)
+	{
+		typename std::map<Key, MemoryEntry>::iterator entry = entries.find(key);
+		if (entry == entries.end())
+			return;
+		total -= entry->second.bytes;
+		entries.erase(entry);
+	}
+
+	void MemoryStats::trackBuffer(GLuint buffer, size_t bytes, const std::string& owner)
+	{
+		if (buffer != 0)
+			setEntry(getRegistry().buffers, buffer, bytes, owner, gpuBytes);
+	}
+
+	void MemoryStats::trackTexture(GLuint texture, size_t bytes, const std::string& owner)
+	{
+		if (texture != 0)
+			setEntry(getRegistry().textures, texture, bytes, owner, gpuBytes);
+	}
+
+	void MemoryStats::deleteBuffers(GLsizei count, const GLuint* buffers)
+	{
+		for (GLsizei i = 0; i < count; i++)
+			eraseEntry(getRegistry().buffers, buffers[i], gpuBytes);
+		glDeleteBuffers(count, buffers);
+	}
+
+	void MemoryStats::deleteTextures(GLsizei count, const GLuint* textures)
+	{
+		for (GLsizei i = 0; i < count; i++)
+			eraseEntry(getRegistry().textures, textures[i], gpuBytes);
+		glDeleteTextures(count, textures);
+	}
+
+	size_t MemoryStats::getBufferBytes(GLuint buffer)
+	{
+		std::map<GLuint, MemoryEntry>::const_iterator entry = getRegistry().buffers.find(buffer);
+		return entry == getRegistry().buffers.end() ? 0 : entry->second.bytes;
+	}
+
+	size_t MemoryStats::getTextureBytes(GLuint texture)
+	{
+		std::map<GLuint, MemoryEntry>::const_iterator entry = getRegistry().textures.find(texture);
+		return entry == getRegistry().textures.end() ? 0 : entry->second.bytes;
+	}
+
+	void MemoryStats::setCpuBytes(const void* owner, size_t bytes, const std::string& name)
+	{
+		if (bytes == 0)
+			eraseEntry(getRegistry().cpu, owner, cpuBytes);
+		else
+			setEntry(getRegistry().cpu, owner, bytes, name, cpuBytes);
+	}
+
+	size_t MemoryStats::bytesPerTexel(GLenum internalFormat)
+	{
+		switch (internalFormat) {
+		case GL_R8:
+		case GL_RED:
+			return 1;
+		case GL_RG8:
+		case GL_R16F:
+		case GL_DEPTH_COMPONENT16:
+			return 2;
+		case GL_RGBA16F:
+		case GL_RG32F:
+		case GL_DEPTH32F_STENCIL8:
+			return 8;
+		case GL_RGBA32F:
+			return 16;
+		default:
+			//RGB, RGBA, sRGB, R32F and the 24 and 32 bit depth formats
+			return 4;
+		}
+	}
+
+	size_t MemoryStats::textureBytes(GLenum internalFormat, GLsizei width, GLsizei height, GLsizei depth, int levels)
+	{
+		size_t bytes = 0;
+		size_t texel = bytesPerTexel(internalFormat);
+		for (int level = 0; levels == 0 || level < levels; level++) {
+			size_t levelWidth = std::max(width >> level, 1), levelHeight = std::max(height >> level, 1);
+			bytes += levelWidth * levelHeight * (size_t)depth * texel;
+			if (levelWidth == 1 && levelHeight == 1)
+				break;
+		}
+		return bytes;
+	}
+
+	void MemoryStats::writeReport(std::ostream& out)
+	{
+		MemoryRegistry& registry = getRegistry();
+		std::map<std::string, MemoryUsage> owners;
+		MemoryUsage none = {};
+		for (std::map<GLuint, MemoryEntry>::const_iterator i = registry.buffers.begin(); i != registry.buffers.end(); ++i) {
+			MemoryUsage& usage = owners.insert(std::make_pair(i->second.owner, none)).first->second;
+			usage.bufferBytes += i->second.bytes;
+			usage.buffers++;
+		}
+		for (std::map<GLuint, MemoryEntry>::const_iterator i = registry.textures.begin(); i != registry.textures.end(); ++i) {
+			MemoryUsage& usage = owners.insert(std::make_pair(i->second.owner, none)).first->second;
+			usage.textureBytes += i->second.bytes;
+			usage.textures++;
+		}
+		for (std::map<const void*, MemoryEntry>::const_iterator i = registry.cpu.begin(); i != registry.cpu.end(); ++i)
+			owners.insert(std::make_pair(i->second.owner, none)).first->second.cpuBytes += i->second.bytes;
+
+		std::vector<std::pair<std::string, MemoryUsage> > sorted(owners.begin(), owners.end());
+		std::sort(sorted.begin(), sorted.end(), [](const std::pair<std::string, MemoryUsage>& a, const std::pair<std::string, MemoryUsage>& b) {
+			return a.second.bufferBytes + a.second.textureBytes + a.second.cpuBytes > b.second.bufferBytes + b.second.textureBytes + b.second.cpuBytes;
+		});
+
+		out << std::fixed << std::setprecision(1);
+		out << "Memory in KB, buffers and textures are GPU memory" << std::endl;
+		out << "  owner                         buffers   count   textures   count        CPU" << std::endl;
+		for (size_t i = 0; i < sorted.size(); i++) {
+			const MemoryUsage& usage = sorted[i].second;
+			out << "  " << std::left << std::setw(24) << sorted[i].first << std::right
+				<< std::setw(13) << usage.bufferBytes / 1024.0 << std::setw(8) << usage.buffers
+				<< std::setw(11) << usage.textureBytes / 1024.0 << std::setw(8) << usage.textures
+				<< std::setw(11) << usage.cpuBytes / 1024.0 << std::endl;
+		}
+		out << "  total " << gpuBytes / 1048576.0 << " MB GPU, " << cpuBytes / 1048576.0 << " MB CPU" << std::endl;
+		out.unsetf(std::ios::floatfield);
+	}
+}
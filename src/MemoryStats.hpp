@@ -0,0 +1,55 @@
+#ifndef MemoryStats_hpp
+#define MemoryStats_hpp
+
+#include <GL/glew.h>
+
+#include <ostream>
+#include <string>
+
+namespace gps {
+
+    //what one owner holds, owners are model file names or subsystems such as "crowd"
+    struct MemoryUsage {
+        size_t bufferBytes;
+        size_t textureBytes;
+        size_t cpuBytes;
+        int buffers;
+        int textures;
+    };
+
+    //GPU memory per buffer and texture name and CPU memory per owner, as allocated by this program;
+    //the driver may pad or keep shadow copies, so the numbers are a lower bound. Render thread only
+    class MemoryStats
+    {
+    public:
+        //the size of a buffer or texture, replacing what was tracked for the name before
+        static void trackBuffer(GLuint buffer, size_t bytes, const std::string& owner);
+        static void trackTexture(GLuint texture, size_t bytes, const std::string& owner);
+        //glDeleteBuffers and glDeleteTextures, forgetting the names
+        static void deleteBuffers(GLsizei count, const GLuint* buffers);
+        static void deleteTextures(GLsizei count, const GLuint* textures);
+        static size_t getBufferBytes(GLuint buffer);
+        static size_t getTextureBytes(GLuint texture);
+
+        //bytes kept in system memory by owner, e.g. the geometry copies of a model; 0 forgets the owner
+        static void setCpuBytes(const void* owner, size_t bytes, const std::string& name);
+
+        //running totals, cheap enough for every frame
+        static size_t getGpuBytes() { return gpuBytes; }
+        static size_t getCpuBytes() { return cpuBytes; }
+
+        //bytes of width x height x depth texels and their mip chain; levels 0 is the full chain down to 1x1
+        static size_t textureBytes(GLenum internalFormat, GLsizei width, GLsizei height, GLsizei depth, int levels);
+        //what the driver most likely stores per texel, RGB formats are padded to four bytes
+        static size_t bytesPerTexel(GLenum internalFormat);
+
+        //one line per owner, largest first, and the totals
+        static void writeReport(std::ostream& out);
+
+    private:
+        static size_t gpuBytes;
+        static size_t cpuBytes;
+    };
+}
+
+#endif /* MemoryStats_hpp */
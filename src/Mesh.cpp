@@ -1,47 +1,158 @@
 #include "Mesh.hpp"
+#include "MemoryStats.hpp"
+#include "RenderStats.hpp"
 namespace gps {
 
 	/* Mesh Constructor */
-	Mesh::Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures)
+	Mesh::Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures, const std::string& owner)
 	{
 		this->vertices = vertices;
 		this->indices = indices;
 		this->textures = textures;
+		this->indexCount = (GLsizei)indices.size();
+		this->vertexCount = (GLsizei)vertices.size();
 
-		this->setupMesh();
+		this->hasSpecularMap = false;
+		for (size_t i = 0; i < textures.size(); i++) {
+			if (textures[i].type == "specularTexture" || textures[i].type == "specularArray")
+				this->hasSpecularMap = true;
+		}
+
+		this->setupMesh(owner);
 	}
 
 	Buffers Mesh::getBuffers() {
 	    return this->buffers;
 	}
 
+	void Mesh::releaseCpuGeometry()
+	{
+		//swapped with empty vectors, clear alone keeps the capacity
+		std::vector<Vertex>().swap(this->vertices);
+		std::vector<GLuint>().swap(this->indices);
+	}
+
 	/* Mesh drawing function - also applies associated textures */
 	void Mesh::Draw(gps::Shader shader)
+	{
+		Draw(shader, 1);
+	}
+
+	void Mesh::Draw(gps::Shader shader, GLsizei instanceCount)
+	{
+		bindTextures(shader);
+
+		RenderStats::bindVertexArray(this->buffers.VAO);
+		RenderStats::drawElements(GL_TRIANGLES, this->indexCount, GL_UNSIGNED_INT, 0, instanceCount);
+		RenderStats::bindVertexArray(0);
+
+		unbindTextures();
+	}
+
+	void Mesh::DrawIndirect(gps::Shader shader, GLintptr commandOffset, GLsizei drawCount, GLsizei stride)
+	{
+		bindTextures(shader);
+
+		//the commands and their instance counts were written by the GPU
+		RenderStats::bindVertexArray(this->buffers.VAO);
+		RenderStats::multiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const GLvoid*)commandOffset, drawCount, stride);
+		RenderStats::bindVertexArray(0);
+
+		unbindTextures();
+	}
+
+	void Mesh::DrawIndirect(gps::ShaderPermutations& permutations, unsigned int features, GLintptr commandOffset, GLsizei drawCount, GLsizei stride)
+	{
+		DrawIndirect(getVariant(permutations, features), commandOffset, drawCount, stride);
+	}
+
+	void Mesh::DrawRanges(gps::Shader shader, const GLsizei* counts, const GLvoid* const* offsets, GLsizei rangeCount)
+	{
+		if (rangeCount == 0)
+			return;
+		bindTextures(shader);
+
+		RenderStats::bindVertexArray(this->buffers.VAO);
+		RenderStats::multiDrawElements(GL_TRIANGLES, counts, GL_UNSIGNED_INT, offsets, rangeCount);
+		RenderStats::bindVertexArray(0);
+
+		unbindTextures();
+	}
+
+	void Mesh::DrawRanges(gps::ShaderPermutations& permutations, unsigned int features, const GLsizei* counts, const GLvoid* const* offsets, GLsizei rangeCount)
+	{
+		if (rangeCount == 0)
+			return;
+		DrawRanges(getVariant(permutations, features), counts, offsets, rangeCount);
+	}
+
+	void Mesh::bindTextures(gps::Shader shader)
 	{
 		shader.useShaderProgram();
 
 		//set textures
 		for (GLuint i = 0; i < textures.size(); i++)
 		{
-			glActiveTexture(GL_TEXTURE0 + i);
-			glUniform1i(glGetUniformLocation(shader.shaderProgram, this->textures[i].type.c_str()), i);
-			glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
+			RenderStats::activeTexture(GL_TEXTURE0 + i);
+			RenderStats::uniform1i(glGetUniformLocation(shader.shaderProgram, this->textures[i].type.c_str()), i);
+			RenderStats::bindTexture(this->textures[i].target, this->textures[i].id);
 		}
+	}
 
-		glBindVertexArray(this->buffers.VAO);
-		glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
-
+	void Mesh::unbindTextures()
+	{
         for(GLuint i = 0; i < this->textures.size(); i++)
         {
-            glActiveTexture(GL_TEXTURE0 + i);
-            glBindTexture(GL_TEXTURE_2D, 0);
+            RenderStats::activeTexture(GL_TEXTURE0 + i);
+            RenderStats::bindTexture(this->textures[i].target, 0);
         }
+	}
+
+	void Mesh::Draw(gps::ShaderPermutations& permutations, unsigned int features)
+	{
+		Draw(permutations, features, 1);
+	}
+
+	void Mesh::Draw(gps::ShaderPermutations& permutations, unsigned int features, GLsizei instanceCount)
+	{
+		Draw(getVariant(permutations, features), instanceCount);
+	}
+
+	const gps::Shader& Mesh::getVariant(gps::ShaderPermutations& permutations, unsigned int features)
+	{
+		if (this->hasSpecularMap)
+			features |= FEATURE_SPECULAR_MAP;
+		else
+			features &= ~FEATURE_SPECULAR_MAP;
+		return permutations.getVariant(features);
+	}
 
-    }
+	void Mesh::setInstanceBuffer(GLuint buffer)
+	{
+		glBindVertexArray(this->buffers.VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		// Instance placement
+		glEnableVertexAttribArray(3);
+		glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(CrowdInstance), (GLvoid*)offsetof(CrowdInstance, placement));
+		glVertexAttribDivisor(3, 1);
+		// Instance seed, kept as an integer
+		glEnableVertexAttribArray(4);
+		glVertexAttribIPointer(4, 1, GL_UNSIGNED_INT, sizeof(CrowdInstance), (GLvoid*)offsetof(CrowdInstance, seed));
+		glVertexAttribDivisor(4, 1);
+		glBindVertexArray(0);
+	}
+
+	void Mesh::setLayerBuffer(GLuint buffer)
+	{
+		glBindVertexArray(this->buffers.VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		glEnableVertexAttribArray(5);
+		glVertexAttribIPointer(5, 2, GL_UNSIGNED_SHORT, 2 * sizeof(GLushort), (GLvoid*)0);
+		glBindVertexArray(0);
+	}
 
 	// Initializes all the buffer objects/arrays
-	void Mesh::setupMesh(){
+	void Mesh::setupMesh(const std::string& owner){
 		// Create buffers/arrays
 		glGenVertexArrays(1, &this->buffers.VAO);
 		glGenBuffers(1, &this->buffers.VBO);
@@ -51,9 +162,11 @@ namespace gps {
 		// Load data into vertex buffers
 		glBindBuffer(GL_ARRAY_BUFFER, this->buffers.VBO);
 		glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex), &this->vertices[0], GL_STATIC_DRAW);
+		MemoryStats::trackBuffer(this->buffers.VBO, this->vertices.size() * sizeof(Vertex), owner);
 
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->buffers.EBO);
 		glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), &this->indices[0], GL_STATIC_DRAW);
+		MemoryStats::trackBuffer(this->buffers.EBO, this->indices.size() * sizeof(GLuint), owner);
 
 		// Set the vertex attribute pointers
 		// Vertex Positions
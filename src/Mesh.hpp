@@ -19,12 +19,22 @@ struct Vertex
     glm::vec2 TexCoords;
 };
 
+//per instance vertex attributes of an instanced draw, locations 3 and 4
+struct CrowdInstance
+{
+    //xyz: feet position, w: rotation around Y in radians
+    glm::vec4 placement;
+    //feeds the hash that picks phase, height and rate of the jump in the vertex shader
+    GLuint seed;
+};
+
 struct Texture
 {
     GLuint id;
-    //ambientTexture, diffuseTexture, specularTexture
+    //ambientTexture, diffuseTexture, specularTexture, or diffuseArray, specularArray for packed arrays
     std::string type;
     std::string path;
+    GLenum target = GL_TEXTURE_2D;
 };
 
 struct Material
@@ -47,18 +57,52 @@ public:
     std::vector<GLuint> indices;
     std::vector<Texture> textures;
 
-	Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures);
+	//owner names the buffers in the memory report
+	Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures, const std::string& owner = "meshes");
 
 	Buffers getBuffers();
+	//stay valid once the CPU copies are released
+	GLsizei getIndexCount() const { return indexCount; }
+	GLsizei getVertexCount() const { return vertexCount; }
+	//frees vertices and indices, the buffers already hold them; anything that merges or rebuilds meshes needs them
+	void releaseCpuGeometry();
+	bool hasCpuGeometry() const { return !vertices.empty() || !indices.empty(); }
+	size_t getCpuBytes() const { return vertices.capacity() * sizeof(Vertex) + indices.capacity() * sizeof(GLuint); }
+	//fixed when the mesh is created, decides FEATURE_SPECULAR_MAP of every variant it draws with
+	bool usesSpecularMap() const { return hasSpecularMap; }
 
 	void Draw(gps::Shader shader);
+	//picks the variant for the given features, adding FEATURE_SPECULAR_MAP when the mesh has one
+	void Draw(gps::ShaderPermutations& permutations, unsigned int features);
+	//the same, drawing instanceCount instances with glDrawElementsInstanced
+	void Draw(gps::Shader shader, GLsizei instanceCount);
+	void Draw(gps::ShaderPermutations& permutations, unsigned int features, GLsizei instanceCount);
+	//draws drawCount DrawElementsIndirectCommands, stride bytes apart from commandOffset in the bound
+	//GL_DRAW_INDIRECT_BUFFER, in one glMultiDrawElementsIndirect; needs 4.3
+	void DrawIndirect(gps::Shader shader, GLintptr commandOffset, GLsizei drawCount, GLsizei stride);
+	void DrawIndirect(gps::ShaderPermutations& permutations, unsigned int features, GLintptr commandOffset, GLsizei drawCount, GLsizei stride);
+	//draws only the given runs of the index buffer, in one glMultiDrawElements call
+	void DrawRanges(gps::Shader shader, const GLsizei* counts, const GLvoid* const* offsets, GLsizei rangeCount);
+	void DrawRanges(gps::ShaderPermutations& permutations, unsigned int features, const GLsizei* counts, const GLvoid* const* offsets, GLsizei rangeCount);
+
+	//per instance attributes at locations 3 (vec4) and 4 (uint), laid out as a CrowdInstance
+	void setInstanceBuffer(GLuint buffer);
+	//per vertex texture array layers at location 5, two unsigned shorts: diffuse and specular
+	void setLayerBuffer(GLuint buffer);
 
 private:
     /*  Render data  */
     Buffers buffers;
+    bool hasSpecularMap;
+    GLsizei indexCount;
+    GLsizei vertexCount;
 
 	// Initializes all the buffer objects/arrays
-	void setupMesh();
+	void setupMesh(const std::string& owner);
+
+	void bindTextures(gps::Shader shader);
+	void unbindTextures();
+	const gps::Shader& getVariant(gps::ShaderPermutations& permutations, unsigned int features);
 
 };
 
@@ -1,4 +1,8 @@
 #include "Model3D.hpp"
+#include "AllocationTracker.hpp"
+#include "CpuProfiler.hpp"
+
+#include <iomanip>
 
 namespace gps {
 
@@ -20,8 +24,102 @@ namespace gps {
 			meshes[i].Draw(shaderProgram);
 	}
 
+	// Draw each mesh with the shader variant matching its material
+	void Model3D::Draw(gps::ShaderPermutations& permutations, unsigned int features)
+	{
+		for (int i = 0; i < meshes.size(); i++)
+			meshes[i].Draw(permutations, features);
+	}
+
+	void Model3D::Draw(gps::Shader shaderProgram, GLsizei instanceCount)
+	{
+		for (int i = 0; i < meshes.size(); i++)
+			meshes[i].Draw(shaderProgram, instanceCount);
+	}
+
+	void Model3D::Draw(gps::ShaderPermutations& permutations, unsigned int features, GLsizei instanceCount)
+	{
+		for (int i = 0; i < meshes.size(); i++)
+			meshes[i].Draw(permutations, features, instanceCount);
+	}
+
+	void Model3D::DrawIndirect(gps::Shader shaderProgram, GLintptr firstCommand, GLsizei commandStride)
+	{
+		GLintptr command = firstCommand;
+		for (int i = 0; i < meshes.size(); i++) {
+			meshes[i].DrawIndirect(shaderProgram, command, subMeshCounts[i], commandStride);
+			command += subMeshCounts[i] * commandStride;
+		}
+	}
+
+	void Model3D::DrawIndirect(gps::ShaderPermutations& permutations, unsigned int features, GLintptr firstCommand, GLsizei commandStride)
+	{
+		GLintptr command = firstCommand;
+		for (int i = 0; i < meshes.size(); i++) {
+			meshes[i].DrawIndirect(permutations, features, command, subMeshCounts[i], commandStride);
+			command += subMeshCounts[i] * commandStride;
+		}
+	}
+
+	static bool sameTextures(const gps::Mesh& a, const gps::Mesh& b)
+	{
+		if (a.textures.size() != b.textures.size())
+			return false;
+		for (size_t t = 0; t < a.textures.size(); t++) {
+			if (a.textures[t].id != b.textures[t].id || a.textures[t].type != b.textures[t].type)
+				return false;
+		}
+		return true;
+	}
+
+	void Model3D::mergeMeshes()
+	{
+		std::vector<gps::Mesh> merged;
+		std::vector<gps::SubMesh> mergedSubMeshes;
+		std::vector<int> mergedCounts;
+		std::vector<bool> taken(meshes.size(), false);
+		for (size_t i = 0; i < meshes.size(); i++) {
+			if (taken[i])
+				continue;
+			//the indices are rebased, so a plain draw of the merged mesh still draws every part
+			std::vector<gps::Vertex> vertices;
+			std::vector<GLuint> indices;
+			int count = 0;
+			for (size_t j = i; j < meshes.size(); j++) {
+				if (taken[j] || !sameTextures(meshes[i], meshes[j]))
+					continue;
+				GLuint baseVertex = (GLuint)vertices.size();
+				gps::SubMesh subMesh = { (GLsizei)meshes[j].indices.size(), (GLuint)indices.size() };
+				mergedSubMeshes.push_back(subMesh);
+				vertices.insert(vertices.end(), meshes[j].vertices.begin(), meshes[j].vertices.end());
+				for (size_t k = 0; k < meshes[j].indices.size(); k++)
+					indices.push_back(baseVertex + meshes[j].indices[k]);
+				taken[j] = true;
+				count++;
+			}
+			merged.push_back(gps::Mesh(vertices, indices, meshes[i].textures, name));
+			mergedCounts.push_back(count);
+		}
+
+		releaseGeometry();
+		meshes = merged;
+		subMeshes = mergedSubMeshes;
+		subMeshCounts = mergedCounts;
+		updateCpuBytes();
+	}
+
+	// Attaches the per instance attributes to every mesh
+	void Model3D::setInstanceBuffer(GLuint buffer)
+	{
+		for (int i = 0; i < meshes.size(); i++)
+			meshes[i].setInstanceBuffer(buffer);
+	}
+
 	// Does the parsing of the .obj file and fills in the data structure
 	void Model3D::ReadOBJ(std::string fileName, std::string basePath){
+		gps::CpuZone zone("ReadOBJ", fileName.c_str());
+		gps::AllocationScope allocationScope(gps::ALLOCATION_LOADER);
+		name = fileName.substr(fileName.find_last_of('/') + 1);
 
         std::cout << "Loading : " << fileName << std::endl;
 		tinyobj::attrib_t attrib;
@@ -43,6 +141,15 @@ namespace gps {
 		std::cout << "# of shapes    : " << shapes.size() << std::endl;
 		std::cout << "# of materials : " << materials.size() << std::endl;
 
+		// Object space bounding box of all positions
+		boundsMin = glm::vec3(0.0f);
+		boundsMax = glm::vec3(0.0f);
+		for (size_t v = 0; v + 2 < attrib.vertices.size(); v += 3) {
+			glm::vec3 position(attrib.vertices[v], attrib.vertices[v + 1], attrib.vertices[v + 2]);
+			boundsMin = v == 0 ? position : glm::min(boundsMin, position);
+			boundsMax = v == 0 ? position : glm::max(boundsMax, position);
+		}
+
 		// Loop over shapes
 		for (size_t s = 0; s < shapes.size(); s++) {
 			std::vector<gps::Vertex> vertices;
@@ -132,8 +239,12 @@ namespace gps {
 				}
 			}
 
-			meshes.push_back(gps::Mesh(vertices, indices, textures));
+			meshes.push_back(gps::Mesh(vertices, indices, textures, name));
+			gps::SubMesh subMesh = { (GLsizei)indices.size(), 0 };
+			subMeshes.push_back(subMesh);
+			subMeshCounts.push_back(1);
 		}
+		updateCpuBytes();
 	}
 
 	// Retrieves a texture associated with the object - by its name and type
@@ -159,6 +270,8 @@ namespace gps {
 
 	// Reads the pixel data from an image file and loads it into the video memory
 	GLuint Model3D::ReadTextureFromFile(const char* file_name) {
+		gps::CpuZone zone("ReadTextureFromFile", file_name);
+		gps::AllocationScope allocationScope(gps::ALLOCATION_TEXTURES);
 		int x, y, n;
 		int force_channels = 4;
 		unsigned char* image_data = stbi_load(file_name, &x, &y, &n, force_channels);
@@ -206,6 +319,8 @@ namespace gps {
 			image_data
 		);
 		glGenerateMipmap(GL_TEXTURE_2D);
+		stbi_image_free(image_data);
+		MemoryStats::trackTexture(textureID, MemoryStats::textureBytes(GL_SRGB, x, y, 1, 0), name);
 
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
@@ -217,17 +332,75 @@ namespace gps {
 	}
 
 	Model3D::~Model3D() {
+        releaseTextures();
+        releaseGeometry();
+	}
+
+	void Model3D::releaseTextures() {
         for (size_t i = 0; i < loadedTextures.size(); i++) {
-            glDeleteTextures(1, &loadedTextures.at(i).id);
+            MemoryStats::deleteTextures(1, &loadedTextures.at(i).id);
         }
+        loadedTextures.clear();
+	}
 
+	void Model3D::releaseGeometry() {
         for (size_t i = 0; i < meshes.size(); i++) {
             GLuint VBO = meshes.at(i).getBuffers().VBO;
             GLuint EBO = meshes.at(i).getBuffers().EBO;
             GLuint VAO = meshes.at(i).getBuffers().VAO;
-            glDeleteBuffers(1, &VBO);
-            glDeleteBuffers(1, &EBO);
+            MemoryStats::deleteBuffers(1, &VBO);
+            MemoryStats::deleteBuffers(1, &EBO);
             glDeleteVertexArrays(1, &VAO);
         }
+        meshes.clear();
+        subMeshes.clear();
+        subMeshCounts.clear();
+        updateCpuBytes();
+	}
+
+	void Model3D::releaseCpuGeometry() {
+        for (size_t i = 0; i < meshes.size(); i++)
+            meshes[i].releaseCpuGeometry();
+        updateCpuBytes();
+	}
+
+	void Model3D::updateCpuBytes() {
+        size_t bytes = 0;
+        for (size_t i = 0; i < meshes.size(); i++)
+            bytes += meshes[i].getCpuBytes();
+        MemoryStats::setCpuBytes(this, bytes, name);
+	}
+
+	gps::MemoryUsage Model3D::getMemoryUsage() {
+        gps::MemoryUsage usage = {};
+        for (size_t i = 0; i < meshes.size(); i++) {
+            Buffers buffers = meshes[i].getBuffers();
+            usage.bufferBytes += MemoryStats::getBufferBytes(buffers.VBO) + MemoryStats::getBufferBytes(buffers.EBO);
+            usage.cpuBytes += meshes[i].getCpuBytes();
+            usage.buffers += 2;
+        }
+        for (size_t i = 0; i < loadedTextures.size(); i++)
+            usage.textureBytes += MemoryStats::getTextureBytes(loadedTextures[i].id);
+        usage.textures = (int)loadedTextures.size();
+        return usage;
+	}
+
+	void Model3D::memoryReport(std::ostream& out) {
+        gps::MemoryUsage usage = getMemoryUsage();
+        out << std::fixed << std::setprecision(1);
+        out << name << ": " << (usage.bufferBytes + usage.textureBytes) / 1024.0 << " KB GPU, " << usage.cpuBytes / 1024.0 << " KB CPU" << std::endl;
+        for (size_t i = 0; i < meshes.size(); i++) {
+            Buffers buffers = meshes[i].getBuffers();
+            out << "  mesh " << std::left << std::setw(4) << i << std::right << std::setw(8) << meshes[i].getVertexCount() << " vertices "
+                << std::setw(8) << meshes[i].getIndexCount() << " indices, buffers "
+                << std::setw(9) << (MemoryStats::getBufferBytes(buffers.VBO) + MemoryStats::getBufferBytes(buffers.EBO)) / 1024.0 << " KB, CPU "
+                << std::setw(9) << meshes[i].getCpuBytes() / 1024.0 << " KB" << std::endl;
+        }
+        //textures include their mip chains
+        for (size_t i = 0; i < loadedTextures.size(); i++) {
+            out << "  texture " << loadedTextures[i].path.substr(loadedTextures[i].path.find_last_of('/') + 1) << " "
+                << MemoryStats::getTextureBytes(loadedTextures[i].id) / 1024.0 << " KB" << std::endl;
+        }
+        out.unsetf(std::ios::floatfield);
 	}
 }
@@ -2,6 +2,7 @@
 #define Model3D_hpp
 
 #include "Mesh.hpp"
+#include "MemoryStats.hpp"
 
 #include "tiny_obj_loader.h"
 #include "stb_image.h"
@@ -12,6 +13,12 @@
 
 namespace gps {
 
+    //a mesh as loaded from the file; after mergeMeshes a range of the merged mesh of its material
+    struct SubMesh {
+        GLsizei indexCount;
+        GLuint firstIndex;
+    };
+
     class Model3D
     {
 
@@ -24,11 +31,65 @@ namespace gps {
 
 		void Draw(gps::Shader shaderProgram);
 
+		void Draw(gps::ShaderPermutations& permutations, unsigned int features);
+
+		// Instanced versions, the instance attributes come from setInstanceBuffer
+		void Draw(gps::Shader shaderProgram, GLsizei instanceCount);
+
+		void Draw(gps::ShaderPermutations& permutations, unsigned int features, GLsizei instanceCount);
+
+		void setInstanceBuffer(GLuint buffer);
+
+		// Indirect versions, sub mesh i uses the command commandStride * i bytes after the first one;
+		// one glMultiDrawElementsIndirect per mesh covers the commands of all of its sub meshes
+		void DrawIndirect(gps::Shader shaderProgram, GLintptr firstCommand, GLsizei commandStride);
+
+		void DrawIndirect(gps::ShaderPermutations& permutations, unsigned int features, GLintptr firstCommand, GLsizei commandStride);
+
+		// Moves the meshes that share their textures into one vertex and index buffer, so indirect draws
+		// take one call per material; needs the CPU geometry, call before setInstanceBuffer
+		void mergeMeshes();
+
+		int getMeshCount() { return (int)meshes.size(); }
+		// Sub meshes are ordered by the mesh that holds them, one per mesh until they are merged
+		int getSubMeshCount() { return (int)subMeshes.size(); }
+		const SubMesh& getSubMesh(int subMesh) { return subMeshes[subMesh]; }
+		const std::vector<gps::Mesh>& getMeshes() { return meshes; }
+		// Frees the vertex and index buffers of every mesh, e.g. once they were merged into a static batch;
+		// the textures stay, they may be shared with the batch
+		void releaseGeometry();
+		// Frees the textures, once nothing draws with them any more (e.g. they were packed into arrays)
+		void releaseTextures();
+		// Frees the CPU copies of vertices and indices, the buffers stay and the model can still be drawn;
+		// call after anything that reads them, such as static batching
+		void releaseCpuGeometry();
+
+		// GPU and CPU bytes held by the model
+		gps::MemoryUsage getMemoryUsage();
+		// The same per mesh and texture
+		void memoryReport(std::ostream& out);
+
+		// The file the model was loaded from, without its directory
+		const std::string& getName() { return name; }
+
+		// Object space bounding box, valid after loading
+		glm::vec3 getBoundsMin() { return boundsMin; }
+		glm::vec3 getBoundsMax() { return boundsMax; }
+
     private:
+		std::string name;
 		// Component meshes - group of objects
         std::vector<gps::Mesh> meshes;
+		std::vector<gps::SubMesh> subMeshes;
+		// How many of the sub meshes each mesh holds
+		std::vector<int> subMeshCounts;
 		// Associated textures
         std::vector<gps::Texture> loadedTextures;
+		glm::vec3 boundsMin = glm::vec3(0.0f);
+		glm::vec3 boundsMax = glm::vec3(0.0f);
+
+		// Publishes the size of the CPU copies to MemoryStats
+		void updateCpuBytes();
 
 		// Does the parsing of the .obj file and fills in the data structure
 		void ReadOBJ(std::string fileName, std::string basePath);
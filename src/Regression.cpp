@@ -0,0 +1,255 @@
+#include "Regression.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+
+namespace gps {
+
+	//a CIE76 distance around 2.3 is the smallest one people notice
+	static const double VISIBLE_DELTA_E = 2.3;
+
+	bool RegressionSuite::Load(const std::string& directory)
+	{
+		this->directory = directory;
+		views.clear();
+		std::ifstream file(directory + "/views.txt");
+		std::string line;
+		while (std::getline(file, line)) {
+			size_t comment = line.find('#');
+			if (comment != std::string::npos)
+				line.erase(comment);
+			std::istringstream fields(line);
+			RegressionView view;
+			if (fields >> view.name >> view.position.x >> view.position.y >> view.position.z >> view.yaw >> view.pitch)
+				views.push_back(view);
+		}
+		if (views.empty()) {
+			std::cerr << "No regression views in " << directory << "/views.txt" << std::endl;
+			return false;
+		}
+		baseline.clear();
+		readFlatJson(directory + "/baseline.json", baseline);
+		return true;
+	}
+
+	double RegressionSuite::threshold(const std::string& name, double fallback)
+	{
+		std::map<std::string, double>::const_iterator value = baseline.find("threshold." + name);
+		return value == baseline.end() ? fallback : value->second;
+	}
+
+	void RegressionSuite::addCheck(const std::string& view, const std::string& name, double value, double limit, bool passed)
+	{
+		Check check = { view, name, value, limit, passed };
+		checks.push_back(check);
+		allPassed = allPassed && passed;
+		if (!passed)
+			std::cout << "  FAILED " << view << " " << name << ": " << value << " (limit " << limit << ")" << std::endl;
+	}
+
+	void RegressionSuite::check(const RegressionResult& result, bool update)
+	{
+		std::string golden = directory + "/golden/" + result.name + ".ppm";
+		if (update) {
+			std::error_code error;
+			std::filesystem::create_directories(directory + "/golden", error);
+			if (!writePPM(golden, result.width, result.height, result.pixels))
+				addCheck(result.name, "golden_written", 0.0, 1.0, false);
+			baseline[result.name + ".frame_ms"] = result.frameTime;
+			baseline[result.name + ".gpu_ms"] = result.gpuTime;
+			for (std::map<std::string, double>::const_iterator counter = result.counters.begin(); counter != result.counters.end(); ++counter)
+				baseline[result.name + "." + counter->first] = counter->second;
+			return;
+		}
+
+		//pixels: a few visibly different pixels are tolerated, e.g. along shadow and triangle edges
+		int width = 0, height = 0;
+		std::vector<unsigned char> pixels;
+		if (!readPPM(golden, width, height, pixels) || width != result.width || height != result.height) {
+			addCheck(result.name, "golden_size", (double)result.width * result.height, (double)width * height, false);
+		}
+		else {
+			ImageDifference difference = compareImages(result.pixels, pixels);
+			double maxFraction = threshold("differing_fraction", 0.001);
+			double maxMean = threshold("mean_delta_e", 0.5);
+			addCheck(result.name, "differing_fraction", difference.differingFraction, maxFraction, difference.differingFraction <= maxFraction);
+			addCheck(result.name, "mean_delta_e", difference.meanDeltaE, maxMean, difference.meanDeltaE <= maxMean);
+		}
+
+		//timings: slower than the baseline by more than the allowed fraction
+		double timeTolerance = threshold("time", 0.15);
+		const char* timings[2] = { "frame_ms", "gpu_ms" };
+		double measured[2] = { result.frameTime, result.gpuTime };
+		for (int t = 0; t < 2; t++) {
+			std::map<std::string, double>::const_iterator reference = baseline.find(result.name + "." + timings[t]);
+			if (reference == baseline.end()) {
+				addCheck(result.name, timings[t], measured[t], 0.0, false);
+				continue;
+			}
+			double limit = reference->second * (1.0 + timeTolerance);
+			addCheck(result.name, timings[t], measured[t], limit, measured[t] <= limit);
+		}
+
+		//counters: fewer is always fine, more only within the allowed fraction
+		double counterTolerance = threshold("counters", 0.0);
+		for (std::map<std::string, double>::const_iterator counter = result.counters.begin(); counter != result.counters.end(); ++counter) {
+			std::map<std::string, double>::const_iterator reference = baseline.find(result.name + "." + counter->first);
+			if (reference == baseline.end()) {
+				addCheck(result.name, counter->first, counter->second, 0.0, false);
+				continue;
+			}
+			double limit = reference->second * (1.0 + counterTolerance);
+			addCheck(result.name, counter->first, counter->second, limit, counter->second <= limit);
+		}
+	}
+
+	void RegressionSuite::checkMetadata(const std::string& name, double value, bool update)
+	{
+		std::string key = "meta." + name;
+		if (update) {
+			baseline[key] = value;
+			return;
+		}
+		std::map<std::string, double>::const_iterator reference = baseline.find(key);
+		double expected = reference == baseline.end() ? 0.0 : reference->second;
+		addCheck("suite", key, value, expected, reference != baseline.end() && value == expected);
+	}
+
+	bool RegressionSuite::writeBaseline()
+	{
+		//thresholds are kept, or written with their defaults so they can be tuned by hand
+		const char* thresholds[4] = { "threshold.differing_fraction", "threshold.mean_delta_e", "threshold.time", "threshold.counters" };
+		const double defaults[4] = { 0.001, 0.5, 0.15, 0.0 };
+		for (int i = 0; i < 4; i++) {
+			if (baseline.find(thresholds[i]) == baseline.end())
+				baseline[thresholds[i]] = defaults[i];
+		}
+
+		std::ofstream file(directory + "/baseline.json", std::ios::trunc);
+		if (!file.is_open())
+			return false;
+		file << "{\n" << std::setprecision(6);
+		for (std::map<std::string, double>::const_iterator value = baseline.begin(); value != baseline.end(); ++value)
+			file << "  \"" << value->first << "\": " << value->second << (std::next(value) == baseline.end() ? "\n" : ",\n");
+		file << "}\n";
+		return true;
+	}
+
+	bool RegressionSuite::writeReport(const std::string& fileName)
+	{
+		std::ofstream file(fileName, std::ios::trunc);
+		if (!file.is_open())
+			return false;
+		file << "{\n  \"passed\": " << (allPassed ? "true" : "false") << ",\n  \"checks\": [\n" << std::setprecision(6);
+		for (size_t i = 0; i < checks.size(); i++) {
+			file << "    { \"view\": \"" << checks[i].view << "\", \"check\": \"" << checks[i].name << "\", \"value\": " << checks[i].value
+				<< ", \"limit\": " << checks[i].limit << ", \"passed\": " << (checks[i].passed ? "true" : "false") << " }"
+				<< (i + 1 < checks.size() ? ",\n" : "\n");
+		}
+		file << "  ]\n}\n";
+		return true;
+	}
+
+	//sRGB to CIELAB under D65
+	static void toLab(const unsigned char* rgb, double lab[3])
+	{
+		double linear[3];
+		for (int c = 0; c < 3; c++) {
+			double v = rgb[c] / 255.0;
+			linear[c] = v <= 0.04045 ? v / 12.92 : std::pow((v + 0.055) / 1.055, 2.4);
+		}
+		double xyz[3] = {
+			(0.4124 * linear[0] + 0.3576 * linear[1] + 0.1805 * linear[2]) / 0.95047,
+			0.2126 * linear[0] + 0.7152 * linear[1] + 0.0722 * linear[2],
+			(0.0193 * linear[0] + 0.1192 * linear[1] + 0.9505 * linear[2]) / 1.08883
+		};
+		for (int c = 0; c < 3; c++)
+			xyz[c] = xyz[c] > 0.008856 ? std::cbrt(xyz[c]) : 7.787 * xyz[c] + 16.0 / 116.0;
+		lab[0] = 116.0 * xyz[1] - 16.0;
+		lab[1] = 500.0 * (xyz[0] - xyz[1]);
+		lab[2] = 200.0 * (xyz[1] - xyz[2]);
+	}
+
+	ImageDifference RegressionSuite::compareImages(const std::vector<unsigned char>& a, const std::vector<unsigned char>& b)
+	{
+		ImageDifference difference = { 0.0, 0.0, 0.0 };
+		size_t pixelCount = std::min(a.size(), b.size()) / 3;
+		if (pixelCount == 0 || a.size() != b.size()) {
+			difference.meanDeltaE = difference.maxDeltaE = 100.0;
+			difference.differingFraction = 1.0;
+			return difference;
+		}
+		size_t differing = 0;
+		double sum = 0.0;
+		for (size_t i = 0; i < pixelCount; i++) {
+			if (a[3 * i] == b[3 * i] && a[3 * i + 1] == b[3 * i + 1] && a[3 * i + 2] == b[3 * i + 2])
+				continue;
+			double labA[3], labB[3];
+			toLab(&a[3 * i], labA);
+			toLab(&b[3 * i], labB);
+			double deltaE = std::sqrt((labA[0] - labB[0]) * (labA[0] - labB[0]) + (labA[1] - labB[1]) * (labA[1] - labB[1]) + (labA[2] - labB[2]) * (labA[2] - labB[2]));
+			sum += deltaE;
+			difference.maxDeltaE = std::max(difference.maxDeltaE, deltaE);
+			if (deltaE > VISIBLE_DELTA_E)
+				differing++;
+		}
+		difference.meanDeltaE = sum / pixelCount;
+		difference.differingFraction = (double)differing / pixelCount;
+		return difference;
+	}
+
+	bool RegressionSuite::readPPM(const std::string& fileName, int& width, int& height, std::vector<unsigned char>& pixels)
+	{
+		std::ifstream file(fileName, std::ios::binary);
+		std::string magic;
+		int maxValue = 0;
+		if (!(file >> magic >> width >> height >> maxValue) || magic != "P6" || maxValue != 255 || width <= 0 || height <= 0)
+			return false;
+		file.get();
+		pixels.resize((size_t)width * height * 3);
+		return (bool)file.read((char*)pixels.data(), pixels.size());
+	}
+
+	bool RegressionSuite::writePPM(const std::string& fileName, int width, int height, const std::vector<unsigned char>& pixels)
+	{
+		std::ofstream file(fileName, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+			return false;
+		file << "P6\n" << width << " " << height << "\n255\n";
+		file.write((const char*)pixels.data(), pixels.size());
+		return (bool)file;
+	}
+
+	bool RegressionSuite::readFlatJson(const std::string& fileName, std::map<std::string, double>& values)
+	{
+		//only "key": number pairs of one object, which is all writeBaseline produces
+		std::ifstream file(fileName);
+		if (!file.is_open())
+			return false;
+		std::stringstream content;
+		content << file.rdbuf();
+		std::string text = content.str();
+		size_t position = 0;
+		while ((position = text.find('"', position)) != std::string::npos) {
+			size_t end = text.find('"', position + 1);
+			size_t colon = end == std::string::npos ? end : text.find(':', end);
+			if (colon == std::string::npos)
+				break;
+			std::string key = text.substr(position + 1, end - position - 1);
+			const char* number = text.c_str() + colon + 1;
+			char* numberEnd = NULL;
+			double value = std::strtod(number, &numberEnd);
+			if (numberEnd != number)
+				values[key] = value;
+			position = colon + 1;
+		}
+		return true;
+	}
+}
@@ -0,0 +1,87 @@
+#ifndef Regression_hpp
+#define Regression_hpp
+
+#include "glm/glm.hpp"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    //a camera pose the regression renders, angles in degrees as taken by Camera::rotate
+    struct RegressionView {
+        std::string name;
+        glm::vec3 position;
+        float yaw;
+        float pitch;
+    };
+
+    //what one view produced
+    struct RegressionResult {
+        std::string name;
+        int width, height;
+        //RGB, top row first
+        std::vector<unsigned char> pixels;
+        //median over the measured frames, in milliseconds
+        double frameTime, gpuTime;
+        //draw and state counts, lower is better
+        std::map<std::string, double> counters;
+    };
+
+    //per pixel CIE76 distance between two images of the same size
+    struct ImageDifference {
+        double meanDeltaE;
+        double maxDeltaE;
+        //pixels over the visible difference threshold
+        double differingFraction;
+    };
+
+    //renders of fixed views checked against golden images and a baseline of timings and counters;
+    //a directory holds views.txt ("name x y z yaw pitch" per line), golden/<name>.ppm and baseline.json,
+    //a flat JSON object of numbers so it diffs well and needs no JSON library
+    class RegressionSuite
+    {
+    public:
+        //false if the directory has no views; a missing baseline only fails the checks, not the load
+        bool Load(const std::string& directory);
+        const std::vector<RegressionView>& getViews() { return views; }
+
+        //compares one result with its golden and baseline entries, or replaces them when updating
+        void check(const RegressionResult& result, bool update);
+        //how the run measured, stored as meta.<name>; counters are only comparable when it matches
+        //the baseline, so a different value fails the run, or replaces the entry when updating
+        void checkMetadata(const std::string& name, double value, bool update);
+        //baseline.json with the results of the last updating run
+        bool writeBaseline();
+        //one entry per view and check, plus the overall verdict
+        bool writeReport(const std::string& fileName);
+        bool passed() { return allPassed; }
+
+        static ImageDifference compareImages(const std::vector<unsigned char>& a, const std::vector<unsigned char>& b);
+        static bool readPPM(const std::string& fileName, int& width, int& height, std::vector<unsigned char>& pixels);
+        static bool writePPM(const std::string& fileName, int width, int height, const std::vector<unsigned char>& pixels);
+
+    private:
+        struct Check {
+            std::string view;
+            std::string name;
+            double value;
+            double limit;
+            bool passed;
+        };
+
+        std::string directory;
+        std::vector<RegressionView> views;
+        std::map<std::string, double> baseline;
+        std::vector<Check> checks;
+        bool allPassed = true;
+
+        double threshold(const std::string& name, double fallback);
+        void addCheck(const std::string& view, const std::string& name, double value, double limit, bool passed);
+
+        static bool readFlatJson(const std::string& fileName, std::map<std::string, double>& values);
+    };
+}
+
+#endif /* Regression_hpp */
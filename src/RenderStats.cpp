@@ -0,0 +1,228 @@
+#include "RenderStats.hpp"
+#include "MemoryStats.hpp"
+
+#include <cstring>
+#include <iostream>
+
+namespace gps {
+
+	RENDER_PASS RenderStats::pass = RENDER_PASS_OTHER;
+	RenderFrameStats RenderStats::current = {};
+	std::vector<RenderFrameStats> RenderStats::history;
+	size_t RenderStats::historyHead = 0;
+	std::ofstream RenderStats::csv;
+	GLuint RenderStats::boundProgram = 0;
+	GLuint RenderStats::boundVertexArray = 0;
+	GLuint RenderStats::activeUnit = 0;
+	GLenum RenderStats::boundTargets[TEXTURE_UNITS] = {};
+	GLuint RenderStats::boundTextures[TEXTURE_UNITS] = {};
+
+	unsigned long long RenderFrameStats::total(RENDER_COUNTER counter) const
+	{
+		unsigned long long sum = 0;
+		for (int p = 0; p < RENDER_PASS_COUNT; p++)
+			sum += counters[p][counter];
+		return sum;
+	}
+
+	void RenderStats::beginFrame()
+	{
+		std::memset(current.counters, 0, sizeof(current.counters));
+		pass = RENDER_PASS_OTHER;
+		//-1 never matches a real object, so the first bind of each is counted as a change
+		boundProgram = (GLuint)-1;
+		boundVertexArray = (GLuint)-1;
+		activeUnit = (GLuint)-1;
+		for (int i = 0; i < TEXTURE_UNITS; i++) {
+			boundTargets[i] = 0;
+			boundTextures[i] = (GLuint)-1;
+		}
+	}
+
+	void RenderStats::endFrame()
+	{
+		//the whole ring up front, growing it would allocate in the middle of a run
+		if (history.empty())
+			history.reserve(HISTORY_FRAMES);
+		if (history.size() < (size_t)HISTORY_FRAMES)
+			history.push_back(current);
+		else
+			history[historyHead] = current;
+		historyHead = (historyHead + 1) % HISTORY_FRAMES;
+
+		if (csv.is_open()) {
+			csv << current.frame;
+			for (int p = 0; p < RENDER_PASS_COUNT; p++)
+				for (int c = 0; c < COUNTER_COUNT; c++)
+					csv << "," << current.counters[p][c];
+			//the footprint at the end of the frame, not per pass
+			csv << "," << MemoryStats::getGpuBytes() << "," << MemoryStats::getCpuBytes() << "\n";
+			csv.flush();
+		}
+		current.frame++;
+	}
+
+	void RenderStats::countInstances(size_t submitted, size_t culled)
+	{
+		add(COUNTER_SUBMITTED_INSTANCES, submitted);
+		add(COUNTER_CULLED_INSTANCES, culled);
+	}
+
+	const RenderFrameStats& RenderStats::getFrame(size_t age)
+	{
+		return history[(historyHead + HISTORY_FRAMES - 1 - age) % HISTORY_FRAMES % history.size()];
+	}
+
+	const char* RenderStats::getPassName(RENDER_PASS pass)
+	{
+		const char* names[RENDER_PASS_COUNT] = { "other", "shadow", "main" };
+		return names[pass];
+	}
+
+	const char* RenderStats::getCounterName(RENDER_COUNTER counter)
+	{
+		const char* names[COUNTER_COUNT] = {
+			"draw_calls", "triangles", "vertices", "program_binds", "vertex_array_binds", "texture_binds",
+			"uniform_uploads", "buffer_bytes", "redundant_changes", "submitted_instances", "culled_instances"
+		};
+		return names[counter];
+	}
+
+	bool RenderStats::openCsv(const std::string& fileName)
+	{
+		csv.open(fileName, std::ios::trunc);
+		if (!csv) {
+			std::cerr << "Could not write the render statistics to " << fileName << std::endl;
+			return false;
+		}
+		csv << "frame";
+		for (int p = 0; p < RENDER_PASS_COUNT; p++)
+			for (int c = 0; c < COUNTER_COUNT; c++)
+				csv << "," << getPassName((RENDER_PASS)p) << "_" << getCounterName((RENDER_COUNTER)c);
+		csv << ",gpu_bytes,cpu_bytes\n";
+		csv.flush();
+		return true;
+	}
+
+	void RenderStats::closeCsv()
+	{
+		if (csv.is_open())
+			csv.close();
+	}
+
+	void RenderStats::useProgram(GLuint program)
+	{
+		add(program == boundProgram ? COUNTER_REDUNDANT_CHANGES : COUNTER_PROGRAM_BINDS, 1);
+		boundProgram = program;
+		glUseProgram(program);
+	}
+
+	void RenderStats::bindVertexArray(GLuint vertexArray)
+	{
+		//unbinding is not a change worth counting
+		if (vertexArray != 0)
+			add(vertexArray == boundVertexArray ? COUNTER_REDUNDANT_CHANGES : COUNTER_VERTEX_ARRAY_BINDS, 1);
+		boundVertexArray = vertexArray;
+		glBindVertexArray(vertexArray);
+	}
+
+	void RenderStats::activeTexture(GLenum unit)
+	{
+		if (unit - GL_TEXTURE0 == activeUnit)
+			add(COUNTER_REDUNDANT_CHANGES, 1);
+		activeUnit = unit - GL_TEXTURE0;
+		glActiveTexture(unit);
+	}
+
+	void RenderStats::bindTexture(GLenum target, GLuint texture)
+	{
+		if (activeUnit < (GLuint)TEXTURE_UNITS) {
+			if (texture != 0)
+				add(boundTargets[activeUnit] == target && boundTextures[activeUnit] == texture ? COUNTER_REDUNDANT_CHANGES : COUNTER_TEXTURE_BINDS, 1);
+			boundTargets[activeUnit] = target;
+			boundTextures[activeUnit] = texture;
+		}
+		else if (texture != 0) {
+			add(COUNTER_TEXTURE_BINDS, 1);
+		}
+		glBindTexture(target, texture);
+	}
+
+	void RenderStats::uniform1i(GLint location, GLint value)
+	{
+		add(COUNTER_UNIFORM_UPLOADS, 1);
+		glUniform1i(location, value);
+	}
+
+	void RenderStats::uniform4f(GLint location, GLfloat x, GLfloat y, GLfloat z, GLfloat w)
+	{
+		add(COUNTER_UNIFORM_UPLOADS, 1);
+		glUniform4f(location, x, y, z, w);
+	}
+
+	void RenderStats::bufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage)
+	{
+		//orphaning without data uploads nothing
+		if (data)
+			add(COUNTER_BUFFER_BYTES, (unsigned long long)size);
+		glBufferData(target, size, data, usage);
+	}
+
+	void RenderStats::bufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data)
+	{
+		add(COUNTER_BUFFER_BYTES, (unsigned long long)size);
+		glBufferSubData(target, offset, size, data);
+	}
+
+	void RenderStats::countPrimitives(GLenum mode, GLsizei count, GLsizei instanceCount)
+	{
+		unsigned long long primitives = 0;
+		if (mode == GL_TRIANGLES)
+			primitives = count / 3;
+		else if ((mode == GL_TRIANGLE_STRIP || mode == GL_TRIANGLE_FAN) && count > 2)
+			primitives = count - 2;
+		add(COUNTER_TRIANGLES, primitives * instanceCount);
+		add(COUNTER_VERTICES, (unsigned long long)count * instanceCount);
+	}
+
+	void RenderStats::drawArrays(GLenum mode, GLint first, GLsizei count, GLsizei instanceCount)
+	{
+		add(COUNTER_DRAW_CALLS, 1);
+		countPrimitives(mode, count, instanceCount);
+		if (instanceCount == 1)
+			glDrawArrays(mode, first, count);
+		else
+			glDrawArraysInstanced(mode, first, count, instanceCount);
+	}
+
+	void RenderStats::drawElements(GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei instanceCount)
+	{
+		add(COUNTER_DRAW_CALLS, 1);
+		countPrimitives(mode, count, instanceCount);
+		if (instanceCount == 1)
+			glDrawElements(mode, count, type, indices);
+		else
+			glDrawElementsInstanced(mode, count, type, indices, instanceCount);
+	}
+
+	void RenderStats::multiDrawElements(GLenum mode, const GLsizei* counts, GLenum type, const void* const* indices, GLsizei drawCount)
+	{
+		//one call, however many ranges
+		add(COUNTER_DRAW_CALLS, 1);
+		for (GLsizei i = 0; i < drawCount; i++)
+			countPrimitives(mode, counts[i], 1);
+		glMultiDrawElements(mode, counts, type, indices, drawCount);
+	}
+
+	void RenderStats::drawArraysIndirect(GLenum mode, const void* command)
+	{
+		add(COUNTER_DRAW_CALLS, 1);
+		glDrawArraysIndirect(mode, command);
+	}
+
+	void RenderStats::multiDrawElementsIndirect(GLenum mode, GLenum type, const void* commands, GLsizei drawCount, GLsizei stride)
+	{
+		add(COUNTER_DRAW_CALLS, 1);
+		glMultiDrawElementsIndirect(mode, type, commands, drawCount, stride);
+	}
+}
@@ -0,0 +1,106 @@
+#ifndef RenderStats_hpp
+#define RenderStats_hpp
+
+#include <GL/glew.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    enum RENDER_PASS {
+        //culling, the depth pyramid and anything outside the two scene passes
+        RENDER_PASS_OTHER,
+        RENDER_PASS_SHADOW,
+        RENDER_PASS_MAIN,
+        RENDER_PASS_COUNT
+    };
+
+    enum RENDER_COUNTER {
+        COUNTER_DRAW_CALLS,
+        COUNTER_TRIANGLES,
+        COUNTER_VERTICES,
+        COUNTER_PROGRAM_BINDS,
+        COUNTER_VERTEX_ARRAY_BINDS,
+        COUNTER_TEXTURE_BINDS,
+        //glUniform calls and uniform block writes
+        COUNTER_UNIFORM_UPLOADS,
+        COUNTER_BUFFER_BYTES,
+        //binds of what was already bound
+        COUNTER_REDUNDANT_CHANGES,
+        //instances and objects that passed or failed CPU culling; GPU culled instances are not known here
+        COUNTER_SUBMITTED_INSTANCES,
+        COUNTER_CULLED_INSTANCES,
+        COUNTER_COUNT
+    };
+
+    //the counters of one frame, per pass
+    struct RenderFrameStats {
+        unsigned long long frame;
+        unsigned long long counters[RENDER_PASS_COUNT][COUNTER_COUNT];
+
+        unsigned long long total(RENDER_COUNTER counter) const;
+    };
+
+    //counts what the render thread submits through the wrappers below; every wrapper makes the GL call
+    //it is named after, and remembers the bound program, vertex array and textures to spot redundant binds
+    class RenderStats
+    {
+    public:
+        //frames kept in memory
+        static const int HISTORY_FRAMES = 600;
+        static const int TEXTURE_UNITS = 32;
+
+        //forgets the bound objects, GL calls outside the wrappers may have changed them
+        static void beginFrame();
+        //moves the frame into the history and appends it to the CSV file
+        static void endFrame();
+        static void setPass(RENDER_PASS pass) { RenderStats::pass = pass; }
+        static void add(RENDER_COUNTER counter, unsigned long long value) { current.counters[pass][counter] += value; }
+        static void countInstances(size_t submitted, size_t culled);
+
+        //age 0 is the newest finished frame
+        static size_t getFrameCount() { return history.size(); }
+        static const RenderFrameStats& getFrame(size_t age);
+        static const char* getPassName(RENDER_PASS pass);
+        static const char* getCounterName(RENDER_COUNTER counter);
+
+        //one line per frame with the memory footprint at the end, flushed every frame so a monitor can tail the file
+        static bool openCsv(const std::string& fileName);
+        static void closeCsv();
+
+        static void useProgram(GLuint program);
+        static void bindVertexArray(GLuint vertexArray);
+        static void activeTexture(GLenum unit);
+        static void bindTexture(GLenum target, GLuint texture);
+        static void uniform1i(GLint location, GLint value);
+        static void uniform4f(GLint location, GLfloat x, GLfloat y, GLfloat z, GLfloat w);
+        static void bufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage);
+        static void bufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data);
+        static void drawArrays(GLenum mode, GLint first, GLsizei count, GLsizei instanceCount = 1);
+        static void drawElements(GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei instanceCount = 1);
+        static void multiDrawElements(GLenum mode, const GLsizei* counts, GLenum type, const void* const* indices, GLsizei drawCount);
+        //the instance counts of indirect draws are written by the GPU, only the call is counted
+        static void drawArraysIndirect(GLenum mode, const void* command);
+        static void multiDrawElementsIndirect(GLenum mode, GLenum type, const void* commands, GLsizei drawCount, GLsizei stride);
+
+    private:
+        static RENDER_PASS pass;
+        static RenderFrameStats current;
+        //ring of finished frames, newest at historyHead - 1
+        static std::vector<RenderFrameStats> history;
+        static size_t historyHead;
+        static std::ofstream csv;
+
+        static GLuint boundProgram;
+        static GLuint boundVertexArray;
+        static GLuint activeUnit;
+        static GLenum boundTargets[TEXTURE_UNITS];
+        static GLuint boundTextures[TEXTURE_UNITS];
+
+        static void countPrimitives(GLenum mode, GLsizei count, GLsizei instanceCount);
+    };
+}
+
+#endif /* RenderStats_hpp */
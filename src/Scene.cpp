@@ -0,0 +1,270 @@
+#include "Scene.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace gps {
+
+	Entity Scene::createEntity(gps::Model3D* model)
+	{
+		Entity entity = (Entity)models.size();
+
+		positionX.push_back(0.0f); positionY.push_back(0.0f); positionZ.push_back(0.0f);
+		rotationX.push_back(0.0f); rotationY.push_back(0.0f); rotationZ.push_back(0.0f); rotationW.push_back(1.0f);
+		scaleX.push_back(1.0f); scaleY.push_back(1.0f); scaleZ.push_back(1.0f);
+
+		glm::vec3 boundsMin = model ? model->getBoundsMin() : glm::vec3(0.0f);
+		glm::vec3 boundsMax = model ? model->getBoundsMax() : glm::vec3(0.0f);
+		glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+		glm::vec3 extent = (boundsMax - boundsMin) * 0.5f;
+		centerX.push_back(center.x); centerY.push_back(center.y); centerZ.push_back(center.z);
+		extentX.push_back(extent.x); extentY.push_back(extent.y); extentZ.push_back(extent.z);
+		worldMinX.push_back(boundsMin.x); worldMinY.push_back(boundsMin.y); worldMinZ.push_back(boundsMin.z);
+		worldMaxX.push_back(boundsMax.x); worldMaxY.push_back(boundsMax.y); worldMaxZ.push_back(boundsMax.z);
+
+		for (int c = 0; c < 10; c++) {
+			previousTransforms[c].push_back((*getTransformComponents(c))[entity]);
+			interpolatedTransforms[c].push_back((*getTransformComponents(c))[entity]);
+		}
+
+		models.push_back(model);
+		modelMatrices.push_back(glm::mat4(1.0f));
+		normalMatrices.push_back(glm::mat3(1.0f));
+		return entity;
+	}
+
+	void Scene::setPosition(Entity entity, glm::vec3 position)
+	{
+		positionX[entity] = position.x;
+		positionY[entity] = position.y;
+		positionZ[entity] = position.z;
+	}
+
+	void Scene::setRotationY(Entity entity, float angle)
+	{
+		float halfAngle = glm::radians(angle) * 0.5f;
+		rotationX[entity] = 0.0f;
+		rotationY[entity] = std::sin(halfAngle);
+		rotationZ[entity] = 0.0f;
+		rotationW[entity] = std::cos(halfAngle);
+	}
+
+	void Scene::setScale(Entity entity, glm::vec3 scale)
+	{
+		scaleX[entity] = scale.x;
+		scaleY[entity] = scale.y;
+		scaleZ[entity] = scale.z;
+	}
+
+	void Scene::addAnimator(Entity entity, ANIMATOR_TYPE type, float speed, float sign)
+	{
+		animatorEntity.push_back(entity);
+		animatorType.push_back(type);
+		animatorSpeed.push_back(speed);
+		animatorSign.push_back(sign);
+		animatorOpening.push_back(0);
+		//swings start open
+		animatorAngle.push_back(type == ANIMATOR_SWING ? 90.0f : 0.0f);
+	}
+
+	void Scene::beginStep()
+	{
+		for (int c = 0; c < 10; c++)
+			previousTransforms[c] = *getTransformComponents(c);
+	}
+
+	void Scene::animate(bool running, float dt, gps::JobSystem& jobs)
+	{
+		//every animator owns its entity, so ranges can run on any worker
+		jobs.parallelFor(animatorEntity.size(), 64, [this, running, dt](size_t first, size_t last) {
+			for (size_t i = first; i < last; i++) {
+				Entity entity = animatorEntity[i];
+				switch (animatorType[i]) {
+				case ANIMATOR_SWING:
+					if (running) {
+						//turns around at both ends of the swing
+						animatorAngle[i] += (animatorOpening[i] ? animatorSpeed[i] : -animatorSpeed[i]) * dt;
+						if (animatorAngle[i] >= 90.0f) {
+							animatorAngle[i] = 90.0f;
+							animatorOpening[i] = 0;
+						}
+						else if (animatorAngle[i] <= 0.0f) {
+							animatorAngle[i] = 0.0f;
+							animatorOpening[i] = 1;
+						}
+					}
+					else {
+						animatorAngle[i] = 90.0f;
+					}
+					setRotationY(entity, animatorSign[i] * animatorAngle[i]);
+					break;
+				case ANIMATOR_SPIN:
+					if (running) {
+						animatorAngle[i] += animatorSpeed[i] * dt;
+						if (animatorAngle[i] > 360.0f)
+							animatorAngle[i] -= 360.0f;
+					}
+					setRotationY(entity, animatorAngle[i]);
+					break;
+				}
+			}
+		});
+	}
+
+	void Scene::resetAnimators()
+	{
+		for (size_t i = 0; i < animatorEntity.size(); i++) {
+			if (animatorType[i] == ANIMATOR_SWING) {
+				animatorAngle[i] = 90.0f;
+				animatorOpening[i] = 0;
+			}
+		}
+	}
+
+	//transform components in TransformArrays order
+	std::vector<float>* Scene::getTransformComponents(int component)
+	{
+		std::vector<float>* components[10] = {
+			&positionX, &positionY, &positionZ,
+			&rotationX, &rotationY, &rotationZ, &rotationW,
+			&scaleX, &scaleY, &scaleZ
+		};
+		return components[component];
+	}
+
+	void Scene::interpolateTransforms(float alpha, size_t first, size_t last)
+	{
+		//positions and scales: linear
+		const int linearComponents[6] = { 0, 1, 2, 7, 8, 9 };
+		for (int k = 0; k < 6; k++) {
+			int c = linearComponents[k];
+			const std::vector<float>& current = *getTransformComponents(c);
+			for (size_t i = first; i < last; i++)
+				interpolatedTransforms[c][i] = previousTransforms[c][i] + (current[i] - previousTransforms[c][i]) * alpha;
+		}
+
+		//rotations: normalized lerp along the shorter arc
+		for (size_t i = first; i < last; i++) {
+			float q0[4] = { previousTransforms[3][i], previousTransforms[4][i], previousTransforms[5][i], previousTransforms[6][i] };
+			float q1[4] = { rotationX[i], rotationY[i], rotationZ[i], rotationW[i] };
+			float sign = q0[0] * q1[0] + q0[1] * q1[1] + q0[2] * q1[2] + q0[3] * q1[3] < 0.0f ? -1.0f : 1.0f;
+			float q[4], length = 0.0f;
+			for (int k = 0; k < 4; k++) {
+				q[k] = q0[k] + (sign * q1[k] - q0[k]) * alpha;
+				length += q[k] * q[k];
+			}
+			length = 1.0f / std::sqrt(length);
+			for (int k = 0; k < 4; k++)
+				interpolatedTransforms[3 + k][i] = q[k] * length;
+		}
+	}
+
+	void Scene::updateTransforms(const glm::mat4& view, float alpha, gps::JobSystem& jobs)
+	{
+		//the chunks capture a single pointer, so std::function stores them without allocating
+		struct Context {
+			Scene* scene;
+			TransformArrays transforms;
+			const glm::mat4* view;
+			float alpha;
+		} context = { this, {
+			interpolatedTransforms[0].data(), interpolatedTransforms[1].data(), interpolatedTransforms[2].data(),
+			interpolatedTransforms[3].data(), interpolatedTransforms[4].data(), interpolatedTransforms[5].data(), interpolatedTransforms[6].data(),
+			interpolatedTransforms[7].data(), interpolatedTransforms[8].data(), interpolatedTransforms[9].data()
+		}, &view, alpha };
+		Context* shared = &context;
+		//ranges are multiples of 8 so every worker runs full SIMD batches
+		jobs.parallelFor(models.size(), 256, [shared](size_t first, size_t last) {
+			Scene* scene = shared->scene;
+			scene->interpolateTransforms(shared->alpha, first, last);
+			buildTransforms(shared->transforms, first, last - first, *shared->view, scene->modelMatrices.data(), scene->normalMatrices.data());
+		});
+	}
+
+	void Scene::updateBounds(gps::JobSystem& jobs)
+	{
+		jobs.parallelFor(models.size(), 256, [this](size_t first, size_t last) {
+			refitBounds(first, last);
+		});
+	}
+
+	void Scene::refitBounds(size_t first, size_t last)
+	{
+		//the world box of a transformed box: center goes through the matrix, extent through its absolute value
+		for (size_t i = first; i < last; i++) {
+			const glm::mat4& m = modelMatrices[i];
+			float cx = m[0][0] * centerX[i] + m[1][0] * centerY[i] + m[2][0] * centerZ[i] + m[3][0];
+			float cy = m[0][1] * centerX[i] + m[1][1] * centerY[i] + m[2][1] * centerZ[i] + m[3][1];
+			float cz = m[0][2] * centerX[i] + m[1][2] * centerY[i] + m[2][2] * centerZ[i] + m[3][2];
+			float ex = std::fabs(m[0][0]) * extentX[i] + std::fabs(m[1][0]) * extentY[i] + std::fabs(m[2][0]) * extentZ[i];
+			float ey = std::fabs(m[0][1]) * extentX[i] + std::fabs(m[1][1]) * extentY[i] + std::fabs(m[2][1]) * extentZ[i];
+			float ez = std::fabs(m[0][2]) * extentX[i] + std::fabs(m[1][2]) * extentY[i] + std::fabs(m[2][2]) * extentZ[i];
+			worldMinX[i] = cx - ex; worldMinY[i] = cy - ey; worldMinZ[i] = cz - ez;
+			worldMaxX[i] = cx + ex; worldMaxY[i] = cy + ey; worldMaxZ[i] = cz + ez;
+		}
+	}
+
+	void Scene::cull(CULL_VIEW view, const glm::mat4& viewProjection, std::vector<DrawItem>& drawList, gps::JobSystem& jobs)
+	{
+		struct Context {
+			Scene* scene;
+			std::vector<std::vector<DrawItem>>* rangeItems;
+			//frustum planes as rows of the clip matrix: w + x, w - x, w + y, w - y, w + z, w - z
+			glm::vec4 planes[6];
+		} context;
+		context.scene = this;
+		context.rangeItems = &rangeItems[view];
+		for (int p = 0; p < 6; p++) {
+			int axis = p / 2;
+			float side = (p % 2 == 0) ? 1.0f : -1.0f;
+			for (int c = 0; c < 4; c++)
+				context.planes[p][c] = viewProjection[c][3] + side * viewProjection[c][axis];
+		}
+
+		//every range lists its visible items separately, they are joined in range order afterwards;
+		//the lists only grow when entities are added, a range never holds more than CULL_GRAIN items
+		size_t rangeCount = (models.size() + CULL_GRAIN - 1) / CULL_GRAIN;
+		std::vector<std::vector<DrawItem>>& items = rangeItems[view];
+		if (items.size() < rangeCount) {
+			items.resize(rangeCount);
+			for (size_t range = 0; range < rangeCount; range++)
+				items[range].reserve(CULL_GRAIN);
+		}
+		for (size_t range = 0; range < rangeCount; range++)
+			items[range].clear();
+
+		Context* shared = &context;
+		jobs.parallelFor(rangeCount, 1, [shared](size_t firstRange, size_t lastRange) {
+			shared->scene->cullRanges(shared->planes, *shared->rangeItems, firstRange, lastRange);
+		});
+
+		drawList.clear();
+		drawList.reserve(models.size());
+		for (size_t range = 0; range < rangeCount; range++)
+			drawList.insert(drawList.end(), items[range].begin(), items[range].end());
+	}
+
+	void Scene::cullRanges(const glm::vec4 planes[6], std::vector<std::vector<DrawItem>>& items, size_t firstRange, size_t lastRange)
+	{
+		for (size_t range = firstRange; range < lastRange; range++) {
+			size_t last = std::min((range + 1) * CULL_GRAIN, models.size());
+			for (size_t i = range * CULL_GRAIN; i < last; i++) {
+				if (!models[i])
+					continue;
+				float cx = (worldMinX[i] + worldMaxX[i]) * 0.5f, ex = (worldMaxX[i] - worldMinX[i]) * 0.5f;
+				float cy = (worldMinY[i] + worldMaxY[i]) * 0.5f, ey = (worldMaxY[i] - worldMinY[i]) * 0.5f;
+				float cz = (worldMinZ[i] + worldMaxZ[i]) * 0.5f, ez = (worldMaxZ[i] - worldMinZ[i]) * 0.5f;
+				bool visible = true;
+				for (int p = 0; p < 6 && visible; p++) {
+					float distance = planes[p].x * cx + planes[p].y * cy + planes[p].z * cz + planes[p].w;
+					float radius = std::fabs(planes[p].x) * ex + std::fabs(planes[p].y) * ey + std::fabs(planes[p].z) * ez;
+					visible = distance + radius >= 0.0f;
+				}
+				if (visible) {
+					DrawItem item = { models[i], (Entity)i };
+					items[range].push_back(item);
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,116 @@
+#ifndef Scene_hpp
+#define Scene_hpp
+
+#include "glm/glm.hpp"
+
+#include "Model3D.hpp"
+#include "TransformKernels.hpp"
+#include "JobSystem.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    //index into the dense component arrays, entities are never destroyed
+    typedef unsigned int Entity;
+
+    enum ANIMATOR_TYPE {
+        //swings around Y between 0 and 90 degrees, rests open at 90
+        ANIMATOR_SWING,
+        //keeps turning around Y
+        ANIMATOR_SPIN
+    };
+
+    //the views culled every frame, each keeps its own scratch lists so both can be culled at once
+    enum CULL_VIEW {
+        CULL_VIEW_CAMERA = 0,
+        CULL_VIEW_SHADOW = 1,
+        CULL_VIEW_COUNT = 2
+    };
+
+    //one entry of a draw list
+    struct DrawItem {
+        gps::Model3D* model;
+        Entity entity;
+    };
+
+    //scene objects stored as components in structure of arrays form:
+    //transform, bounds and renderable per entity, animators densely packed with their owner
+    class Scene
+    {
+    public:
+        Entity createEntity(gps::Model3D* model);
+        size_t size() { return models.size(); }
+
+        void setPosition(Entity entity, glm::vec3 position);
+        //rotation around the Y axis, in degrees
+        void setRotationY(Entity entity, float angle);
+        void setScale(Entity entity, glm::vec3 scale);
+        //speed is in degrees per second, sign flips the swing direction
+        void addAnimator(Entity entity, ANIMATOR_TYPE type, float speed, float sign);
+
+        //keeps the current transforms as the previous simulation step, call before animate
+        void beginStep();
+        //advances every animator by one simulation step of dt seconds; stopped swings snap back to open
+        void animate(bool running, float dt, gps::JobSystem& jobs);
+        void resetAnimators();
+
+        //rebuilds the model and eye space normal matrices of all entities with the batched kernels,
+        //from the transforms interpolated between the previous and the current step (alpha 0..1)
+        void updateTransforms(const glm::mat4& view, float alpha, gps::JobSystem& jobs);
+        //refits the world space boxes from the current model matrices
+        void updateBounds(gps::JobSystem& jobs);
+        //tests the world boxes against the frustum of viewProjection and lists the visible renderables in entity order;
+        //different views may be culled at the same time, the same view may not
+        void cull(CULL_VIEW view, const glm::mat4& viewProjection, std::vector<DrawItem>& drawList, gps::JobSystem& jobs);
+
+        gps::Model3D* getModel(Entity entity) { return models[entity]; }
+        const glm::mat4& getModelMatrix(Entity entity) { return modelMatrices[entity]; }
+        const glm::mat3& getNormalMatrix(Entity entity) { return normalMatrices[entity]; }
+        const std::vector<glm::mat4>& getModelMatrices() { return modelMatrices; }
+        const std::vector<glm::mat3>& getNormalMatrices() { return normalMatrices; }
+        glm::vec3 getWorldMin(Entity entity) { return glm::vec3(worldMinX[entity], worldMinY[entity], worldMinZ[entity]); }
+        glm::vec3 getWorldMax(Entity entity) { return glm::vec3(worldMaxX[entity], worldMaxY[entity], worldMaxZ[entity]); }
+
+    private:
+        //entities per cull job
+        static const size_t CULL_GRAIN = 256;
+
+        //transform
+        std::vector<float> positionX, positionY, positionZ;
+        std::vector<float> rotationX, rotationY, rotationZ, rotationW;
+        std::vector<float> scaleX, scaleY, scaleZ;
+        //the same at the previous simulation step, and the interpolated result fed to the kernels
+        std::vector<float> previousTransforms[10];
+        std::vector<float> interpolatedTransforms[10];
+
+        //bounds: object space box as center and half extent, world space box refit every frame
+        std::vector<float> centerX, centerY, centerZ;
+        std::vector<float> extentX, extentY, extentZ;
+        std::vector<float> worldMinX, worldMinY, worldMinZ;
+        std::vector<float> worldMaxX, worldMaxY, worldMaxZ;
+
+        //renderable
+        std::vector<gps::Model3D*> models;
+        std::vector<glm::mat4> modelMatrices;
+        std::vector<glm::mat3> normalMatrices;
+
+        //animator
+        std::vector<Entity> animatorEntity;
+        std::vector<ANIMATOR_TYPE> animatorType;
+        std::vector<float> animatorAngle;
+        std::vector<float> animatorSpeed;
+        std::vector<float> animatorSign;
+        std::vector<unsigned char> animatorOpening;
+
+        //what every range of a cull found, per view; cleared and refilled so steady frames do not allocate
+        std::vector<std::vector<DrawItem>> rangeItems[CULL_VIEW_COUNT];
+
+        std::vector<float>* getTransformComponents(int component);
+        void interpolateTransforms(float alpha, size_t first, size_t last);
+        void refitBounds(size_t first, size_t last);
+        void cullRanges(const glm::vec4 planes[6], std::vector<std::vector<DrawItem>>& items, size_t firstRange, size_t lastRange);
+    };
+}
+
+#endif /* Scene_hpp */
@@ -1,6 +1,49 @@
 #include "Shader.hpp"
+#include "CpuProfiler.hpp"
+#include "AllocationTracker.hpp"
+#include "RenderStats.hpp"
+
+#include <cassert>
+#include <chrono>
+#include <filesystem>
+#include <thread>
 
 namespace gps {
+
+    bool Shader::parallelCompile = false;
+    std::string Shader::cacheDirectory;
+    std::string Shader::driverKey;
+
+    //64 bit FNV-1a, only used to name cache files
+    static unsigned long long hashString(const std::string& text, unsigned long long hash = 14695981039346656037ull)
+    {
+        for (size_t i = 0; i < text.size(); i++) {
+            hash ^= (unsigned char)text[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    void Shader::initCompiler(std::string cacheDirectory)
+    {
+        parallelCompile = GLEW_KHR_parallel_shader_compile;
+        if (parallelCompile) {
+            //let the driver pick the number of compiler threads
+            glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+        }
+
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        if (formats > 0) {
+            std::error_code error;
+            std::filesystem::create_directories(cacheDirectory, error);
+            Shader::cacheDirectory = error ? "" : cacheDirectory;
+        }
+
+        //binaries are only valid for the driver that produced them
+        driverKey = std::string((const char*)glGetString(GL_VENDOR)) + "|" +
+            (const char*)glGetString(GL_RENDERER) + "|" + (const char*)glGetString(GL_VERSION);
+    }
     std::string Shader::readShaderFile(std::string fileName)
     {
         std::ifstream shaderFile;
@@ -36,7 +79,7 @@ namespace gps {
         }
     }
 
-    void Shader::shaderLinkLog(GLuint shaderProgramId)
+    bool Shader::shaderLinkLog(GLuint shaderProgramId)
     {
         GLint success;
         GLchar infoLog[512];
@@ -47,44 +90,284 @@ namespace gps {
             glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
             std::cout << "Shader linking error\n" << infoLog << std::endl;
         }
+        return success;
+    }
+
+    bool Shader::loadProgramBinary()
+    {
+        std::ifstream binaryFile(binaryFileName.c_str(), std::ios::binary);
+        if (!binaryFile)
+            return false;
+
+        GLenum format;
+        if (!binaryFile.read((char*)&format, sizeof(format)))
+            return false;
+        std::vector<char> binary((std::istreambuf_iterator<char>(binaryFile)), std::istreambuf_iterator<char>());
+        if (binary.empty())
+            return false;
+
+        glProgramBinary(this->shaderProgram, format, &binary[0], (GLsizei)binary.size());
+
+        //a driver update may reject old binaries, then we simply compile again
+        GLint success;
+        glGetProgramiv(this->shaderProgram, GL_LINK_STATUS, &success);
+        return success;
+    }
+
+    void Shader::saveProgramBinary()
+    {
+        GLint length = 0;
+        glGetProgramiv(this->shaderProgram, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+
+        std::vector<char> binary(length);
+        GLenum format;
+        glGetProgramBinary(this->shaderProgram, length, NULL, &format, &binary[0]);
+
+        std::ofstream binaryFile(binaryFileName.c_str(), std::ios::binary);
+        binaryFile.write((const char*)&format, sizeof(format));
+        binaryFile.write(&binary[0], length);
+    }
+
+    std::string Shader::injectDefines(std::string source, std::string defines)
+    {
+        //#version has to stay the first statement
+        size_t version = source.find("#version");
+        size_t lineEnd = version == std::string::npos ? std::string::npos : source.find('\n', version);
+        if (lineEnd == std::string::npos)
+            return defines + source;
+        return source.substr(0, lineEnd + 1) + defines + source.substr(lineEnd + 1);
+    }
+
+    std::string Shader::cacheFileName(unsigned long long sourceHash)
+    {
+        if (cacheDirectory.empty())
+            return "";
+        std::stringstream name;
+        name << cacheDirectory << "/" << std::hex << hashString(driverKey, sourceHash) << ".bin";
+        return name.str();
     }
 
     void Shader::loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName)
     {
-        //read, parse and compile the vertex shader
-        std::string v = readShaderFile(vertexShaderFileName);
+        loadShader(vertexShaderFileName, fragmentShaderFileName, "");
+    }
+
+    void Shader::loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName, std::string defines)
+    {
+        gps::CpuZone zone("loadShader", fragmentShaderFileName.c_str());
+        beginLoad(vertexShaderFileName, fragmentShaderFileName, defines);
+        finishLoad();
+    }
+
+    void Shader::beginLoad(std::string vertexShaderFileName, std::string fragmentShaderFileName, std::string defines)
+    {
+        gps::CpuZone zone("Shader::beginLoad", fragmentShaderFileName.c_str());
+        gps::AllocationScope allocationScope(gps::ALLOCATION_SHADERS);
+        //read and parse both stages
+        std::string v = injectDefines(readShaderFile(vertexShaderFileName), defines);
+        std::string f = injectDefines(readShaderFile(fragmentShaderFileName), defines);
+
+        this->shaderProgram = glCreateProgram();
+
+        //a cached binary skips GLSL compilation entirely
+        binaryFileName = cacheFileName(hashString(f, hashString(v)));
+        if (!binaryFileName.empty()) {
+            if (loadProgramBinary()) {
+                binaryFileName.clear();
+                return;
+            }
+        }
+
+        //compile the vertex shader
         const GLchar* vertexShaderString = v.c_str();
-        GLuint vertexShader;
-        vertexShader = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertexShader, 1, &vertexShaderString, NULL);
-        glCompileShader(vertexShader);
-        //check compilation status
-        shaderCompileLog(vertexShader);
+        pendingVertexShader = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(pendingVertexShader, 1, &vertexShaderString, NULL);
+        glCompileShader(pendingVertexShader);
 
-        //read, parse and compile the vertex shader
-        std::string f = readShaderFile(fragmentShaderFileName);
+        //compile the fragment shader
         const GLchar* fragmentShaderString = f.c_str();
-        GLuint fragmentShader;
-        fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragmentShader, 1, &fragmentShaderString, NULL);
-        glCompileShader(fragmentShader);
+        pendingFragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(pendingFragmentShader, 1, &fragmentShaderString, NULL);
+        glCompileShader(pendingFragmentShader);
+
+        //attach and link the shader programs, the status is only queried in finishLoad
+        //so the driver can keep working in the background
+        glAttachShader(this->shaderProgram, pendingVertexShader);
+        glAttachShader(this->shaderProgram, pendingFragmentShader);
+        if (!binaryFileName.empty())
+            glProgramParameteri(this->shaderProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(this->shaderProgram);
+    }
+
+    bool Shader::isReady()
+    {
+        if (!parallelCompile || pendingVertexShader == 0)
+            return true;
+
+        GLint completed = GL_TRUE;
+        glGetProgramiv(this->shaderProgram, GL_COMPLETION_STATUS_KHR, &completed);
+        return completed;
+    }
+
+    void Shader::finishLoad()
+    {
+        gps::CpuZone zone("Shader::finishLoad");
+        gps::AllocationScope allocationScope(gps::ALLOCATION_SHADERS);
+        //loaded from the cache
+        if (pendingVertexShader == 0)
+            return;
+
         //check compilation status
-        shaderCompileLog(fragmentShader);
+        shaderCompileLog(pendingVertexShader);
+        shaderCompileLog(pendingFragmentShader);
+        //check linking info
+        bool linked = shaderLinkLog(this->shaderProgram);
+
+        glDeleteShader(pendingVertexShader);
+        glDeleteShader(pendingFragmentShader);
+        pendingVertexShader = 0;
+        pendingFragmentShader = 0;
+
+        if (linked && !binaryFileName.empty())
+            saveProgramBinary();
+        //copies of the shader are made per draw, without the name they never allocate
+        binaryFileName.clear();
+    }
+
+    void Shader::loadComputeShader(std::string computeShaderFileName, std::string defines)
+    {
+        gps::AllocationScope allocationScope(gps::ALLOCATION_SHADERS);
+        std::string c = injectDefines(readShaderFile(computeShaderFileName), defines);
 
-        //attach and link the shader programs
         this->shaderProgram = glCreateProgram();
-        glAttachShader(this->shaderProgram, vertexShader);
-        glAttachShader(this->shaderProgram, fragmentShader);
+        binaryFileName = cacheFileName(hashString(c));
+        if (!binaryFileName.empty() && loadProgramBinary()) {
+            binaryFileName.clear();
+            return;
+        }
+
+        const GLchar* computeShaderString = c.c_str();
+        GLuint computeShader = glCreateShader(GL_COMPUTE_SHADER);
+        glShaderSource(computeShader, 1, &computeShaderString, NULL);
+        glCompileShader(computeShader);
+        shaderCompileLog(computeShader);
+
+        glAttachShader(this->shaderProgram, computeShader);
+        if (!binaryFileName.empty())
+            glProgramParameteri(this->shaderProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
         glLinkProgram(this->shaderProgram);
-        glDeleteShader(vertexShader);
-        glDeleteShader(fragmentShader);
-        //check linking info
-        shaderLinkLog(this->shaderProgram);
+        glDeleteShader(computeShader);
+
+        if (shaderLinkLog(this->shaderProgram) && !binaryFileName.empty())
+            saveProgramBinary();
+        binaryFileName.clear();
+    }
+
+    void Shader::finishAll(std::vector<gps::Shader*> shaders)
+    {
+        while (!shaders.empty()) {
+            bool progress = false;
+            for (size_t i = 0; i < shaders.size(); ) {
+                if (shaders[i]->isReady()) {
+                    shaders[i]->finishLoad();
+                    shaders.erase(shaders.begin() + i);
+                    progress = true;
+                }
+                else {
+                    i++;
+                }
+            }
+            if (!progress)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
     }
 
     void Shader::useShaderProgram()
     {
-        glUseProgram(this->shaderProgram);
+        RenderStats::useProgram(this->shaderProgram);
+    }
+
+    void ShaderPermutations::loadSource(std::string vertexShaderFileName, std::string fragmentShaderFileName)
+    {
+        this->vertexShaderFileName = vertexShaderFileName;
+        this->fragmentShaderFileName = fragmentShaderFileName;
     }
 
+    void ShaderPermutations::setLinkCallback(void (*callback)(gps::Shader shader))
+    {
+        this->linkCallback = callback;
+    }
+
+    std::string ShaderPermutations::featureDefines(unsigned int features)
+    {
+        const char* names[FEATURE_COUNT] = { "SPOT_LIGHT", "POINT_LIGHTS", "FOG", "SHADOW", "SPECULAR_MAP", "CROWD", "IMPOSTOR", "TEXTURE_ARRAY" };
+        std::string defines;
+        for (int i = 0; i < FEATURE_COUNT; i++) {
+            if (features & (1u << i))
+                defines += std::string("#define ") + names[i] + "\n";
+        }
+        return defines;
+    }
+
+    const gps::Shader& ShaderPermutations::getVariant(unsigned int features)
+    {
+        if (loaded[features])
+            return variants[features];
+
+        if (submitted) {
+            std::cerr << "Shader variant " << features << " of " << fragmentShaderFileName << " was not submitted up front, compiling it mid-frame" << std::endl;
+            assert(!"every variant a frame draws with has to be submitted with beginAll");
+        }
+        variants[features].loadShader(vertexShaderFileName, fragmentShaderFileName, featureDefines(features));
+        if (linkCallback)
+            linkCallback(variants[features]);
+        loaded[features] = true;
+        return variants[features];
+    }
+
+    void ShaderPermutations::beginAll(unsigned int features, unsigned int required)
+    {
+        //walk every subset of the mask
+        features &= ~required;
+        unsigned int subset = features;
+        while (true) {
+            unsigned int variant = subset | required;
+            if (!loaded[variant]) {
+                variants[variant].beginLoad(vertexShaderFileName, fragmentShaderFileName, featureDefines(variant));
+                loaded[variant] = true;
+                pending.push_back(variant);
+            }
+            if (subset == 0)
+                break;
+            subset = (subset - 1) & features;
+        }
+    }
+
+    void ShaderPermutations::finishAll()
+    {
+        std::vector<gps::Shader*> shaders;
+        for (size_t i = 0; i < pending.size(); i++)
+            shaders.push_back(&variants[pending[i]]);
+        gps::Shader::finishAll(shaders);
+
+        for (size_t i = 0; i < pending.size(); i++) {
+            if (linkCallback)
+                linkCallback(variants[pending[i]]);
+        }
+        pending.clear();
+        submitted = true;
+    }
+
+    void ShaderPermutations::Delete()
+    {
+        for (unsigned int i = 0; i < VARIANT_COUNT; i++) {
+            if (loaded[i])
+                glDeleteProgram(variants[i].shaderProgram);
+            loaded[i] = false;
+        }
+        pending.clear();
+        submitted = false;
+    }
 }
@@ -8,20 +8,102 @@
 #include <sstream>
 #include <iostream>
 #include <string>
+#include <map>
+#include <vector>
 
 namespace gps {
 
+//optional parts of a shader, each one compiled in through a #define
+enum SHADER_FEATURE {
+    FEATURE_SPOT = 1 << 0,
+    FEATURE_POINT = 1 << 1,
+    FEATURE_FOG = 1 << 2,
+    FEATURE_SHADOW = 1 << 3,
+    FEATURE_SPECULAR_MAP = 1 << 4,
+    //instanced crowd, placement and jump come from instance attributes instead of DrawData
+    FEATURE_CROWD = 1 << 5,
+    //far crowd members as camera facing quads lit from the impostor atlases
+    FEATURE_IMPOSTOR = 1 << 6,
+    //diffuse and specular maps from texture arrays, with per vertex layers
+    FEATURE_TEXTURE_ARRAY = 1 << 7,
+    FEATURE_COUNT = 8
+};
+
 class Shader
 {
 public:
     GLuint shaderProgram;
     void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName);
+    //same as above, the defines are inserted right after the #version line of both stages
+    void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName, std::string defines);
     void useShaderProgram();
 
+    //submits compilation and linking without waiting for the driver, or loads the program from the binary cache
+    void beginLoad(std::string vertexShaderFileName, std::string fragmentShaderFileName, std::string defines);
+    //true once the driver is done with the program, always true without KHR_parallel_shader_compile
+    bool isReady();
+    //checks the logs and stores the program binary, has to be called before the program is used
+    void finishLoad();
+    //finishes the given shaders in the order the driver completes them
+    static void finishAll(std::vector<gps::Shader*> shaders);
+
+    //compiles and links a compute program right away, needs a 4.3 context
+    void loadComputeShader(std::string computeShaderFileName, std::string defines);
+
+    //enables parallel compilation when available and the program binary cache in the given directory
+    static void initCompiler(std::string cacheDirectory);
+
 private:
+    //shader objects of a load that has not been finished yet
+    GLuint pendingVertexShader = 0;
+    GLuint pendingFragmentShader = 0;
+    //where the program binary is stored, empty when the cache is disabled
+    std::string binaryFileName;
+
+    static bool parallelCompile;
+    static std::string cacheDirectory;
+    static std::string driverKey;
+
     std::string readShaderFile(std::string fileName);
+    std::string injectDefines(std::string source, std::string defines);
     void shaderCompileLog(GLuint shaderId);
-    void shaderLinkLog(GLuint shaderProgramId);
+    bool shaderLinkLog(GLuint shaderProgramId);
+    std::string cacheFileName(unsigned long long sourceHash);
+    bool loadProgramBinary();
+    void saveProgramBinary();
+};
+
+//one shader source compiled into a variant per feature bitmask; the variants are submitted up front
+//and kept in a table indexed by the bitmask, so picking one per draw costs an index
+class ShaderPermutations
+{
+public:
+    static const unsigned int VARIANT_COUNT = 1u << FEATURE_COUNT;
+
+    void loadSource(std::string vertexShaderFileName, std::string fragmentShaderFileName);
+    //called once for every newly linked variant, e.g. to bind uniform blocks and sampler units
+    void setLinkCallback(void (*callback)(gps::Shader shader));
+    //a variant that was not submitted is compiled on the spot, stalling the frame; after finishAll
+    //that warns once per variant, and fails in debug builds
+    const gps::Shader& getVariant(unsigned int features);
+    //submits every combination of the given features up front so switching never stalls a frame;
+    //the required bits are part of every variant and do not double the count
+    void beginAll(unsigned int features, unsigned int required = 0);
+    //waits for the variants submitted by beginAll and runs the link callback on them
+    void finishAll();
+    void Delete();
+
+    static std::string featureDefines(unsigned int features);
+
+private:
+    std::string vertexShaderFileName;
+    std::string fragmentShaderFileName;
+    void (*linkCallback)(gps::Shader shader) = nullptr;
+    gps::Shader variants[VARIANT_COUNT];
+    bool loaded[VARIANT_COUNT] = {};
+    std::vector<unsigned int> pending;
+    //set by finishAll, every variant the frames use should be loaded by then
+    bool submitted = false;
 };
 
 }
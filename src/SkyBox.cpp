@@ -7,6 +7,9 @@
 //
 
 #include "SkyBox.hpp"
+#include "AllocationTracker.hpp"
+#include "MemoryStats.hpp"
+#include "RenderStats.hpp"
 
 
 namespace gps {
@@ -22,27 +25,23 @@ namespace gps {
         InitSkyBox();
     }
     
-    void SkyBox::Draw(gps::Shader shader, glm::mat4 viewMatrix, glm::mat4 projectionMatrix)
+    void SkyBox::Draw(gps::Shader shader)
     {
-        //set the view and projection matrices
-        glm::mat4 transformedView = glm::mat4(glm::mat3(viewMatrix));
-        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(transformedView));
-        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projectionMatrix));
-        
         glDepthFunc(GL_LEQUAL);
         
-        glBindVertexArray(skyboxVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glUniform1i(glGetUniformLocation(shader.shaderProgram, "skybox"), 0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-        glBindVertexArray(0);
+        RenderStats::bindVertexArray(skyboxVAO);
+        RenderStats::activeTexture(GL_TEXTURE0);
+        RenderStats::uniform1i(glGetUniformLocation(shader.shaderProgram, "skybox"), 0);
+        RenderStats::bindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+        RenderStats::drawArrays(GL_TRIANGLES, 0, 36);
+        RenderStats::bindVertexArray(0);
         
         glDepthFunc(GL_LESS);
     }
     
     GLuint SkyBox::LoadSkyBoxTextures(std::vector<const GLchar*> skyBoxFaces)
     {
+        gps::AllocationScope allocationScope(gps::ALLOCATION_TEXTURES);
         GLuint textureID;
         glGenTextures(1, &textureID);
         glActiveTexture(GL_TEXTURE0);
@@ -63,6 +62,8 @@ namespace gps {
                          GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0,
                          GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image
                          );
+            stbi_image_free(image);
+            MemoryStats::trackTexture(textureID, MemoryStats::getTextureBytes(textureID) + MemoryStats::textureBytes(GL_RGB, width, height, 1, 1), "skybox");
         }
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -126,6 +127,7 @@ namespace gps {
         glBindVertexArray(skyboxVAO);
         glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
         glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
+        MemoryStats::trackBuffer(skyboxVBO, sizeof(skyboxVertices), "skybox");
         
         glEnableVertexAttribArray(0);
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
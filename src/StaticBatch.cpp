@@ -0,0 +1,285 @@
+#include "StaticBatch.hpp"
+#include "MemoryStats.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace gps {
+
+	std::string StaticBatch::materialKey(const gps::Mesh& mesh, const gps::TextureArrayPacker* packer)
+	{
+		//packed meshes only need the same arrays, their layers go into the vertices
+		if (packer) {
+			int diffuseArray, specularArray;
+			textureLayer(mesh, "diffuseTexture", packer, diffuseArray);
+			textureLayer(mesh, "specularTexture", packer, specularArray);
+			return "arrays:" + std::to_string(diffuseArray) + ";" + std::to_string(specularArray);
+		}
+
+		//texture ids are shared through the model's texture cache, equal ids mean the same material
+		std::string key;
+		for (size_t i = 0; i < mesh.textures.size(); i++)
+			key += mesh.textures[i].type + ":" + std::to_string(mesh.textures[i].id) + ";";
+		return key;
+	}
+
+	std::string StaticBatch::materialName(const gps::Mesh& mesh, const gps::TextureArrayPacker* packer)
+	{
+		if (packer) {
+			int diffuseArray, specularArray;
+			textureLayer(mesh, "diffuseTexture", packer, diffuseArray);
+			textureLayer(mesh, "specularTexture", packer, specularArray);
+			return "arrays " + std::to_string(diffuseArray) + "/" + std::to_string(specularArray);
+		}
+		for (size_t i = 0; i < mesh.textures.size(); i++) {
+			if (mesh.textures[i].type == "diffuseTexture")
+				return mesh.textures[i].path.substr(mesh.textures[i].path.find_last_of('/') + 1);
+		}
+		return "untextured";
+	}
+
+	GLushort StaticBatch::textureLayer(const gps::Mesh& mesh, const std::string& type, const gps::TextureArrayPacker* packer, int& array)
+	{
+		array = -1;
+		for (size_t i = 0; i < mesh.textures.size(); i++) {
+			gps::TextureLayer location;
+			if (mesh.textures[i].type == type && packer->find(mesh.textures[i].id, location)) {
+				array = location.array;
+				return (GLushort)location.layer;
+			}
+		}
+		return 0;
+	}
+
+	void StaticBatch::Add(gps::Model3D* model, const glm::mat4& transform)
+	{
+		const std::vector<gps::Mesh>& meshes = model->getMeshes();
+		for (size_t i = 0; i < meshes.size(); i++) {
+			Source source = { &meshes[i], transform, "" };
+			sources.push_back(source);
+		}
+	}
+
+	void StaticBatch::addTextures(gps::TextureArrayPacker& packer)
+	{
+		for (size_t i = 0; i < sources.size(); i++) {
+			for (size_t t = 0; t < sources[i].mesh->textures.size(); t++)
+				packer.Add(sources[i].mesh->textures[t]);
+		}
+	}
+
+	void StaticBatch::Build(const gps::TextureArrayPacker* packer)
+	{
+		if (packer && packer->getArrayCount() == 0)
+			packer = NULL;
+		for (size_t i = 0; i < sources.size(); i++)
+			sources[i].material = materialKey(*sources[i].mesh, packer);
+
+		//stable so the ranges of a batch keep the order the meshes were added in
+		std::vector<size_t> order(sources.size());
+		for (size_t i = 0; i < order.size(); i++)
+			order[i] = i;
+		std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+			return sources[a].material < sources[b].material;
+		});
+
+		size_t first = 0;
+		while (first < order.size()) {
+			size_t last = first;
+			while (last < order.size() && sources[order[last]].material == sources[order[first]].material)
+				last++;
+
+			std::vector<gps::Vertex> vertices;
+			std::vector<GLuint> indices;
+			std::vector<GLushort> layers;
+			Batch batch;
+			for (size_t k = first; k < last; k++) {
+				const Source& source = sources[order[k]];
+				glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(source.transform)));
+				GLuint baseVertex = (GLuint)vertices.size();
+
+				StaticRange range;
+				range.firstIndex = (GLsizei)indices.size();
+				range.indexCount = (GLsizei)source.mesh->indices.size();
+				range.boundsMin = glm::vec3(INFINITY);
+				range.boundsMax = glm::vec3(-INFINITY);
+				for (size_t v = 0; v < source.mesh->vertices.size(); v++) {
+					gps::Vertex vertex = source.mesh->vertices[v];
+					vertex.Position = glm::vec3(source.transform * glm::vec4(vertex.Position, 1.0f));
+					vertex.Normal = glm::normalize(normalMatrix * vertex.Normal);
+					range.boundsMin = glm::min(range.boundsMin, vertex.Position);
+					range.boundsMax = glm::max(range.boundsMax, vertex.Position);
+					vertices.push_back(vertex);
+				}
+				for (size_t j = 0; j < source.mesh->indices.size(); j++)
+					indices.push_back(baseVertex + source.mesh->indices[j]);
+				if (packer) {
+					int array;
+					GLushort diffuseLayer = textureLayer(*source.mesh, "diffuseTexture", packer, array);
+					GLushort specularLayer = textureLayer(*source.mesh, "specularTexture", packer, array);
+					for (size_t v = 0; v < source.mesh->vertices.size(); v++) {
+						layers.push_back(diffuseLayer);
+						layers.push_back(specularLayer);
+					}
+				}
+				if (range.indexCount > 0)
+					batch.ranges.push_back(range);
+			}
+
+			batch.layerBuffer = 0;
+			batch.features = 0;
+			batch.name = materialName(*sources[order[first]].mesh, packer);
+			if (packer) {
+				//the arrays take the place of the material's own textures
+				std::vector<gps::Texture> textures;
+				const gps::Mesh& mesh = *sources[order[first]].mesh;
+				const char* types[2][2] = { { "diffuseTexture", "diffuseArray" }, { "specularTexture", "specularArray" } };
+				for (int t = 0; t < 2; t++) {
+					int array;
+					textureLayer(mesh, types[t][0], packer, array);
+					if (array < 0)
+						continue;
+					gps::Texture texture;
+					texture.id = packer->getArray(array);
+					texture.type = types[t][1];
+					texture.target = GL_TEXTURE_2D_ARRAY;
+					textures.push_back(texture);
+				}
+				batch.mesh = new gps::Mesh(vertices, indices, textures, "static batch");
+
+				glGenBuffers(1, &batch.layerBuffer);
+				glBindBuffer(GL_ARRAY_BUFFER, batch.layerBuffer);
+				glBufferData(GL_ARRAY_BUFFER, layers.size() * sizeof(GLushort), layers.data(), GL_STATIC_DRAW);
+				MemoryStats::trackBuffer(batch.layerBuffer, layers.size() * sizeof(GLushort), "static batch");
+				glBindBuffer(GL_ARRAY_BUFFER, 0);
+				batch.mesh->setLayerBuffer(batch.layerBuffer);
+				batch.features = FEATURE_TEXTURE_ARRAY;
+			}
+			else {
+				batch.mesh = new gps::Mesh(vertices, indices, sources[order[first]].mesh->textures, "static batch");
+			}
+			batches.push_back(batch);
+			first = last;
+		}
+
+		std::cout << "Static batching: " << sources.size() << " meshes in " << batches.size() << " batches" << std::endl;
+		sources.clear();
+		updateCpuBytes();
+	}
+
+	void StaticBatch::releaseCpuGeometry()
+	{
+		for (size_t i = 0; i < batches.size(); i++)
+			batches[i].mesh->releaseCpuGeometry();
+		updateCpuBytes();
+	}
+
+	void StaticBatch::updateCpuBytes()
+	{
+		size_t bytes = 0;
+		for (size_t i = 0; i < batches.size(); i++)
+			bytes += batches[i].mesh->getCpuBytes();
+		MemoryStats::setCpuBytes(this, bytes, "static batch");
+	}
+
+	void StaticBatch::Delete()
+	{
+		for (size_t i = 0; i < batches.size(); i++) {
+			gps::Buffers buffers = batches[i].mesh->getBuffers();
+			MemoryStats::deleteBuffers(1, &buffers.VBO);
+			MemoryStats::deleteBuffers(1, &buffers.EBO);
+			glDeleteVertexArrays(1, &buffers.VAO);
+			MemoryStats::deleteBuffers(1, &batches[i].layerBuffer);
+			delete batches[i].mesh;
+		}
+		batches.clear();
+		updateCpuBytes();
+	}
+
+	void StaticBatch::cull(const glm::mat4& viewProjection, StaticDrawList& drawList) const
+	{
+		//frustum planes as rows of the clip matrix: w + x, w - x, w + y, w - y, w + z, w - z
+		glm::vec4 planes[6];
+		for (int p = 0; p < 6; p++) {
+			int axis = p / 2;
+			float side = (p % 2 == 0) ? 1.0f : -1.0f;
+			for (int c = 0; c < 4; c++)
+				planes[p][c] = viewProjection[c][3] + side * viewProjection[c][axis];
+		}
+
+		drawList.counts.clear();
+		drawList.offsets.clear();
+		drawList.firstRun.clear();
+		drawList.visibleRanges = 0;
+		drawList.totalRanges = 0;
+		//a batch has at most one run per range, reserved for that so no view allocates
+		size_t rangeCount = 0;
+		for (size_t b = 0; b < batches.size(); b++)
+			rangeCount += batches[b].ranges.size();
+		drawList.counts.reserve(rangeCount);
+		drawList.offsets.reserve(rangeCount);
+		drawList.firstRun.reserve(batches.size() + 1);
+		for (size_t b = 0; b < batches.size(); b++) {
+			drawList.firstRun.push_back(drawList.counts.size());
+			//the run being grown, -1 while the previous range was culled
+			GLsizei runFirst = -1, runEnd = 0;
+			const std::vector<StaticRange>& ranges = batches[b].ranges;
+			drawList.totalRanges += ranges.size();
+			for (size_t r = 0; r <= ranges.size(); r++) {
+				bool visible = false;
+				if (r < ranges.size()) {
+					glm::vec3 center = (ranges[r].boundsMin + ranges[r].boundsMax) * 0.5f;
+					glm::vec3 extent = (ranges[r].boundsMax - ranges[r].boundsMin) * 0.5f;
+					visible = true;
+					for (int p = 0; p < 6 && visible; p++) {
+						float distance = planes[p].x * center.x + planes[p].y * center.y + planes[p].z * center.z + planes[p].w;
+						float radius = std::fabs(planes[p].x) * extent.x + std::fabs(planes[p].y) * extent.y + std::fabs(planes[p].z) * extent.z;
+						visible = distance + radius >= 0.0f;
+					}
+				}
+				if (visible) {
+					drawList.visibleRanges++;
+					if (runFirst < 0)
+						runFirst = ranges[r].firstIndex;
+					runEnd = ranges[r].firstIndex + ranges[r].indexCount;
+				}
+				else if (runFirst >= 0) {
+					drawList.counts.push_back(runEnd - runFirst);
+					drawList.offsets.push_back((const GLvoid*)(runFirst * sizeof(GLuint)));
+					runFirst = -1;
+				}
+			}
+		}
+		drawList.firstRun.push_back(drawList.counts.size());
+	}
+
+	void StaticBatch::Draw(const StaticDrawList& drawList, gps::Shader shader)
+	{
+		for (size_t b = 0; b < batches.size(); b++)
+			DrawBatch(drawList, b, shader);
+	}
+
+	void StaticBatch::Draw(const StaticDrawList& drawList, gps::ShaderPermutations& permutations, unsigned int features)
+	{
+		for (size_t b = 0; b < batches.size(); b++)
+			DrawBatch(drawList, b, permutations, features);
+	}
+
+	void StaticBatch::DrawBatch(const StaticDrawList& drawList, size_t batch, gps::Shader shader)
+	{
+		//lists culled before Build have no entries
+		if (batch + 1 >= drawList.firstRun.size())
+			return;
+		size_t run = drawList.firstRun[batch];
+		batches[batch].mesh->DrawRanges(shader, drawList.counts.data() + run, drawList.offsets.data() + run, (GLsizei)(drawList.firstRun[batch + 1] - run));
+	}
+
+	void StaticBatch::DrawBatch(const StaticDrawList& drawList, size_t batch, gps::ShaderPermutations& permutations, unsigned int features)
+	{
+		if (batch + 1 >= drawList.firstRun.size())
+			return;
+		size_t run = drawList.firstRun[batch];
+		batches[batch].mesh->DrawRanges(permutations, features | batches[batch].features, drawList.counts.data() + run, drawList.offsets.data() + run, (GLsizei)(drawList.firstRun[batch + 1] - run));
+	}
+}
@@ -0,0 +1,97 @@
+#ifndef StaticBatch_hpp
+#define StaticBatch_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include "Mesh.hpp"
+#include "Model3D.hpp"
+#include "Shader.hpp"
+#include "TextureArrayPacker.hpp"
+
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    //the indices of one source mesh inside its batch, with its world box for culling
+    struct StaticRange {
+        GLsizei firstIndex;
+        GLsizei indexCount;
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+    };
+
+    //visible index runs of every batch for one view; the runs of batch b are firstRun[b] .. firstRun[b + 1]
+    struct StaticDrawList {
+        std::vector<GLsizei> counts;
+        std::vector<const GLvoid*> offsets;
+        std::vector<size_t> firstRun;
+        //source meshes that survived culling, and all of them
+        size_t visibleRanges = 0;
+        size_t totalRanges = 0;
+    };
+
+    //meshes that never move, merged by material into one pre-transformed vertex and index range each;
+    //a batch is drawn with one glMultiDrawElements over the runs of its ranges that survive culling
+    class StaticBatch
+    {
+    public:
+        //queues the meshes of model placed with transform, nothing is uploaded before Build
+        void Add(gps::Model3D* model, const glm::mat4& transform);
+        //queues every texture of the added meshes for packing
+        void addTextures(gps::TextureArrayPacker& packer);
+        //merges everything added so far, the source models may release their geometry afterwards;
+        //with a packed packer the meshes are merged by texture array instead of by material
+        //and each vertex carries the layers of its own material
+        void Build(const gps::TextureArrayPacker* packer = NULL);
+        void Delete();
+        //frees the merged vertices and indices kept on the CPU, the batches draw from their buffers
+        void releaseCpuGeometry();
+
+        //tests every range against the frustum of viewProjection, neighbouring visible ranges become one run
+        void cull(const glm::mat4& viewProjection, StaticDrawList& drawList) const;
+        //the vertices are already in world space, the caller sets an identity model matrix
+        void Draw(const StaticDrawList& drawList, gps::Shader shader);
+        void Draw(const StaticDrawList& drawList, gps::ShaderPermutations& permutations, unsigned int features);
+        //the same for one batch, e.g. to time batches on their own
+        void DrawBatch(const StaticDrawList& drawList, size_t batch, gps::Shader shader);
+        void DrawBatch(const StaticDrawList& drawList, size_t batch, gps::ShaderPermutations& permutations, unsigned int features);
+
+        size_t getBatchCount() { return batches.size(); }
+        //the diffuse texture of the batch's material, or its texture arrays
+        const std::string& getBatchName(size_t batch) { return batches[batch].name; }
+        //the feature bits every draw of the batch adds to the pass features
+        unsigned int getBatchFeatures(size_t batch) { return batches[batch].features | (batches[batch].mesh->usesSpecularMap() ? FEATURE_SPECULAR_MAP : 0); }
+        size_t getSourceCount() { return sources.size(); }
+
+    private:
+        void updateCpuBytes();
+
+        struct Source {
+            const gps::Mesh* mesh;
+            glm::mat4 transform;
+            //meshes with the same textures share a batch
+            std::string material;
+        };
+        struct Batch {
+            gps::Mesh* mesh;
+            std::vector<StaticRange> ranges;
+            //per vertex layers, 0 without texture arrays
+            GLuint layerBuffer;
+            //FEATURE_TEXTURE_ARRAY for packed batches
+            unsigned int features;
+            std::string name;
+        };
+
+        std::vector<Source> sources;
+        std::vector<Batch> batches;
+
+        static std::string materialKey(const gps::Mesh& mesh, const gps::TextureArrayPacker* packer);
+        static std::string materialName(const gps::Mesh& mesh, const gps::TextureArrayPacker* packer);
+        //the layer of the first texture of the given type, 0 if the mesh has none
+        static GLushort textureLayer(const gps::Mesh& mesh, const std::string& type, const gps::TextureArrayPacker* packer, int& array);
+    };
+}
+
+#endif /* StaticBatch_hpp */
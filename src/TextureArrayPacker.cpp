@@ -0,0 +1,146 @@
+#include "TextureArrayPacker.hpp"
+#include "AllocationTracker.hpp"
+#include "MemoryStats.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace gps {
+
+	void TextureArrayPacker::Add(const gps::Texture& texture)
+	{
+		for (size_t i = 0; i < entries.size(); i++) {
+			if (entries[i].texture.id == texture.id)
+				return;
+		}
+		Entry entry;
+		entry.texture = texture;
+		entry.width = entry.height = entry.internalFormat = 0;
+		entry.location.array = -1;
+		entry.location.layer = 0;
+		entries.push_back(entry);
+	}
+
+	void TextureArrayPacker::Pack(const std::string& cacheDirectory)
+	{
+		AllocationScope allocationScope(ALLOCATION_TEXTURES);
+		for (size_t i = 0; i < entries.size(); i++) {
+			glBindTexture(GL_TEXTURE_2D, entries[i].texture.id);
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &entries[i].width);
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &entries[i].height);
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &entries[i].internalFormat);
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		//the order only depends on the textures themselves, never on load order or GL names
+		std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+			if (a.width != b.width)
+				return a.width > b.width;
+			if (a.height != b.height)
+				return a.height > b.height;
+			if (a.internalFormat != b.internalFormat)
+				return a.internalFormat < b.internalFormat;
+			return a.texture.path < b.texture.path;
+		});
+
+		GLint maxLayers = 0;
+		glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+
+		std::vector<unsigned char> pixels;
+		size_t first = 0;
+		while (first < entries.size()) {
+			//one array per run of equal size and format, split where the layer limit is reached
+			size_t last = first + 1;
+			while (last < entries.size() && (GLint)(last - first) < maxLayers &&
+				entries[last].width == entries[first].width && entries[last].height == entries[first].height &&
+				entries[last].internalFormat == entries[first].internalFormat)
+				last++;
+
+			GLsizei width = entries[first].width, height = entries[first].height;
+			GLuint array;
+			glGenTextures(1, &array);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, array);
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, entries[first].internalFormat, width, height, (GLsizei)(last - first), 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+			//the texels are read back from the loaded textures, sRGB values come back unconverted
+			pixels.resize((size_t)width * height * 4);
+			glPixelStorei(GL_PACK_ALIGNMENT, 1);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			for (size_t i = first; i < last; i++) {
+				glBindTexture(GL_TEXTURE_2D, entries[i].texture.id);
+				glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+				glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, (GLint)(i - first), width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+				entries[i].location.array = (int)arrays.size();
+				entries[i].location.layer = (GLuint)(i - first);
+			}
+			glPixelStorei(GL_PACK_ALIGNMENT, 4);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			glBindTexture(GL_TEXTURE_2D, 0);
+
+			glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+			MemoryStats::trackTexture(array, MemoryStats::textureBytes(entries[first].internalFormat, width, height, (GLsizei)(last - first), 0), "texture arrays");
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+			arrays.push_back(array);
+			first = last;
+		}
+
+		std::cout << "Texture arrays: " << entries.size() << " textures in " << arrays.size() << " arrays" << std::endl;
+		writeManifest(cacheDirectory);
+	}
+
+	void TextureArrayPacker::writeManifest(const std::string& cacheDirectory)
+	{
+		std::stringstream manifest;
+		manifest << "#array layer width height format path\n";
+		for (size_t i = 0; i < entries.size(); i++) {
+			manifest << entries[i].location.array << " " << entries[i].location.layer << " "
+				<< entries[i].width << " " << entries[i].height << " 0x" << std::hex << entries[i].internalFormat << std::dec << " "
+				<< entries[i].texture.path << "\n";
+		}
+
+		std::error_code error;
+		std::filesystem::create_directories(cacheDirectory, error);
+		if (error)
+			return;
+		std::string fileName = cacheDirectory + "/texturearrays.txt";
+
+		//only rewritten when the layout changed, so the file can be compared between runs and machines
+		std::ifstream previousFile(fileName);
+		std::stringstream previous;
+		previous << previousFile.rdbuf();
+		previousFile.close();
+		if (previous.str() == manifest.str())
+			return;
+		if (!previous.str().empty())
+			std::cout << "Texture array layout changed, rewriting " << fileName << std::endl;
+		std::ofstream file(fileName, std::ios::trunc);
+		file << manifest.str();
+	}
+
+	void TextureArrayPacker::Delete()
+	{
+		if (!arrays.empty())
+			MemoryStats::deleteTextures((GLsizei)arrays.size(), arrays.data());
+		arrays.clear();
+		entries.clear();
+	}
+
+	bool TextureArrayPacker::find(GLuint texture, TextureLayer& location) const
+	{
+		for (size_t i = 0; i < entries.size(); i++) {
+			if (entries[i].texture.id == texture && entries[i].location.array >= 0) {
+				location = entries[i].location;
+				return true;
+			}
+		}
+		return false;
+	}
+}
@@ -0,0 +1,51 @@
+#ifndef TextureArrayPacker_hpp
+#define TextureArrayPacker_hpp
+
+#include <GL/glew.h>
+
+#include "Mesh.hpp"
+
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    //where a packed texture ended up
+    struct TextureLayer {
+        int array;
+        GLuint layer;
+    };
+
+    //copies 2D textures of the same size and format into GL_TEXTURE_2D_ARRAY objects, so meshes of
+    //different materials can share one set of bindings and pick their layers per vertex
+    class TextureArrayPacker
+    {
+    public:
+        //queues a loaded texture, repeated ids are packed once
+        void Add(const gps::Texture& texture);
+        //sorts the textures by size, format and path and fills the arrays in that order, so the same
+        //set of textures always gives the same layers; the layout is written to the cache directory
+        void Pack(const std::string& cacheDirectory);
+        void Delete();
+
+        //false if the texture was never added
+        bool find(GLuint texture, TextureLayer& location) const;
+        GLuint getArray(int array) const { return arrays[array]; }
+        size_t getArrayCount() const { return arrays.size(); }
+
+    private:
+        struct Entry {
+            gps::Texture texture;
+            GLint width, height;
+            GLint internalFormat;
+            TextureLayer location;
+        };
+
+        std::vector<Entry> entries;
+        std::vector<GLuint> arrays;
+
+        void writeManifest(const std::string& cacheDirectory);
+    };
+}
+
+#endif /* TextureArrayPacker_hpp */
@@ -0,0 +1,215 @@
+#include "TransformKernels.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace gps {
+
+	//one entity, same math as the batched path
+	static void buildTransform(const TransformArrays& t, size_t i, const glm::mat3& view3, glm::mat4& model, glm::mat3& normal)
+	{
+		float x = t.rotationX[i], y = t.rotationY[i], z = t.rotationZ[i], w = t.rotationW[i];
+
+		//columns of R * S
+		glm::vec3 c0 = glm::vec3(1.0f - 2.0f * (y * y + z * z), 2.0f * (x * y + w * z), 2.0f * (x * z - w * y)) * t.scaleX[i];
+		glm::vec3 c1 = glm::vec3(2.0f * (x * y - w * z), 1.0f - 2.0f * (x * x + z * z), 2.0f * (y * z + w * x)) * t.scaleY[i];
+		glm::vec3 c2 = glm::vec3(2.0f * (x * z + w * y), 2.0f * (y * z - w * x), 1.0f - 2.0f * (x * x + y * y)) * t.scaleZ[i];
+		model = glm::mat4(glm::vec4(c0, 0.0f), glm::vec4(c1, 0.0f), glm::vec4(c2, 0.0f),
+			glm::vec4(t.positionX[i], t.positionY[i], t.positionZ[i], 1.0f));
+
+		//the inverse transpose of a 3x3 matrix with columns a, b, c has the columns b x c, c x a, a x b over the determinant
+		glm::vec3 a = view3 * c0;
+		glm::vec3 b = view3 * c1;
+		glm::vec3 c = view3 * c2;
+		glm::vec3 bc = glm::cross(b, c);
+		float invDet = 1.0f / glm::dot(a, bc);
+		normal = glm::mat3(bc * invDet, glm::cross(c, a) * invDet, glm::cross(a, b) * invDet);
+	}
+
+#ifdef __AVX2__
+	static inline __m256 add(__m256 a, __m256 b) { return _mm256_add_ps(a, b); }
+	static inline __m256 sub(__m256 a, __m256 b) { return _mm256_sub_ps(a, b); }
+	static inline __m256 mul(__m256 a, __m256 b) { return _mm256_mul_ps(a, b); }
+	//a.y * b.z - a.z * b.y
+	static inline __m256 crossTerm(__m256 ay, __m256 az, __m256 by, __m256 bz) { return sub(mul(ay, bz), mul(az, by)); }
+#endif
+
+	void buildTransforms(const TransformArrays& t, size_t first, size_t count, const glm::mat4& view,
+		glm::mat4* modelMatrices, glm::mat3* normalMatrices)
+	{
+		glm::mat3 view3 = glm::mat3(view);
+		size_t i = first;
+		size_t end = first + count;
+
+#ifdef __AVX2__
+		__m256 v[9];
+		for (int column = 0; column < 3; column++)
+			for (int row = 0; row < 3; row++)
+				v[3 * column + row] = _mm256_set1_ps(view3[column][row]);
+		__m256 one = _mm256_set1_ps(1.0f);
+		__m256 two = _mm256_set1_ps(2.0f);
+
+		//lanes are written here first and then scattered into the AoS matrices
+		alignas(32) float modelLanes[16][8];
+		alignas(32) float normalLanes[9][8];
+		for (int lane = 0; lane < 8; lane++) {
+			modelLanes[3][lane] = modelLanes[7][lane] = modelLanes[11][lane] = 0.0f;
+			modelLanes[15][lane] = 1.0f;
+		}
+
+		for (; i + 8 <= end; i += 8) {
+			__m256 x = _mm256_loadu_ps(t.rotationX + i);
+			__m256 y = _mm256_loadu_ps(t.rotationY + i);
+			__m256 z = _mm256_loadu_ps(t.rotationZ + i);
+			__m256 w = _mm256_loadu_ps(t.rotationW + i);
+			__m256 sx = _mm256_loadu_ps(t.scaleX + i);
+			__m256 sy = _mm256_loadu_ps(t.scaleY + i);
+			__m256 sz = _mm256_loadu_ps(t.scaleZ + i);
+
+			__m256 xx = mul(x, x), yy = mul(y, y), zz = mul(z, z);
+			__m256 xy = mul(x, y), xz = mul(x, z), yz = mul(y, z);
+			__m256 wx = mul(w, x), wy = mul(w, y), wz = mul(w, z);
+
+			//columns of R * S
+			__m256 c[9];
+			c[0] = mul(sub(one, mul(two, add(yy, zz))), sx);
+			c[1] = mul(mul(two, add(xy, wz)), sx);
+			c[2] = mul(mul(two, sub(xz, wy)), sx);
+			c[3] = mul(mul(two, sub(xy, wz)), sy);
+			c[4] = mul(sub(one, mul(two, add(xx, zz))), sy);
+			c[5] = mul(mul(two, add(yz, wx)), sy);
+			c[6] = mul(mul(two, add(xz, wy)), sz);
+			c[7] = mul(mul(two, sub(yz, wx)), sz);
+			c[8] = mul(sub(one, mul(two, add(xx, yy))), sz);
+
+			for (int column = 0; column < 3; column++)
+				for (int row = 0; row < 3; row++)
+					_mm256_store_ps(modelLanes[4 * column + row], c[3 * column + row]);
+			_mm256_store_ps(modelLanes[12], _mm256_loadu_ps(t.positionX + i));
+			_mm256_store_ps(modelLanes[13], _mm256_loadu_ps(t.positionY + i));
+			_mm256_store_ps(modelLanes[14], _mm256_loadu_ps(t.positionZ + i));
+
+			//m = view3 * (R * S)
+			__m256 m[9];
+			for (int column = 0; column < 3; column++)
+				for (int row = 0; row < 3; row++)
+					m[3 * column + row] = add(add(mul(v[row], c[3 * column]), mul(v[3 + row], c[3 * column + 1])), mul(v[6 + row], c[3 * column + 2]));
+
+			//cofactors: b x c, c x a, a x b
+			__m256 n[9];
+			n[0] = crossTerm(m[4], m[5], m[7], m[8]);
+			n[1] = crossTerm(m[5], m[3], m[8], m[6]);
+			n[2] = crossTerm(m[3], m[4], m[6], m[7]);
+			n[3] = crossTerm(m[7], m[8], m[1], m[2]);
+			n[4] = crossTerm(m[8], m[6], m[2], m[0]);
+			n[5] = crossTerm(m[6], m[7], m[0], m[1]);
+			n[6] = crossTerm(m[1], m[2], m[4], m[5]);
+			n[7] = crossTerm(m[2], m[0], m[5], m[3]);
+			n[8] = crossTerm(m[0], m[1], m[3], m[4]);
+			__m256 det = add(add(mul(m[0], n[0]), mul(m[1], n[1])), mul(m[2], n[2]));
+			__m256 invDet = _mm256_div_ps(one, det);
+			for (int k = 0; k < 9; k++)
+				_mm256_store_ps(normalLanes[k], mul(n[k], invDet));
+
+			for (int lane = 0; lane < 8; lane++) {
+				float* model = &modelMatrices[i + lane][0][0];
+				for (int k = 0; k < 16; k++)
+					model[k] = modelLanes[k][lane];
+				float* normal = &normalMatrices[i + lane][0][0];
+				for (int k = 0; k < 9; k++)
+					normal[k] = normalLanes[k][lane];
+			}
+		}
+#endif
+
+		for (; i < end; i++)
+			buildTransform(t, i, view3, modelMatrices[i], normalMatrices[i]);
+	}
+
+	void buildTransformsReference(const TransformArrays& t, size_t first, size_t count, const glm::mat4& view,
+		glm::mat4* modelMatrices, glm::mat3* normalMatrices)
+	{
+		for (size_t i = first; i < first + count; i++) {
+			glm::quat rotation(t.rotationW[i], t.rotationX[i], t.rotationY[i], t.rotationZ[i]);
+			glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(t.positionX[i], t.positionY[i], t.positionZ[i]));
+			model = model * glm::mat4_cast(rotation);
+			model = glm::scale(model, glm::vec3(t.scaleX[i], t.scaleY[i], t.scaleZ[i]));
+			modelMatrices[i] = model;
+			normalMatrices[i] = glm::mat3(glm::inverseTranspose(view * model));
+		}
+	}
+
+	void benchmarkTransformKernels(size_t count, int iterations)
+	{
+		if (count == 0 || iterations <= 0)
+			return;
+		//random transforms with unit quaternions and positive scales
+		std::vector<float> components[10];
+		for (int c = 0; c < 10; c++)
+			components[c].resize(count);
+		for (size_t i = 0; i < count; i++) {
+			for (int c = 0; c < 3; c++)
+				components[c][i] = (float)(rand() % 2000) / 10.0f - 100.0f;
+			float q[4], length = 0.0f;
+			for (int c = 0; c < 4; c++) {
+				q[c] = (float)(rand() % 2000) / 1000.0f - 1.0f;
+				length += q[c] * q[c];
+			}
+			length = length > 0.0f ? std::sqrt(length) : 1.0f;
+			for (int c = 0; c < 4; c++)
+				components[3 + c][i] = length > 0.0f ? q[c] / length : 0.0f;
+			for (int c = 7; c < 10; c++)
+				components[c][i] = 0.5f + (float)(rand() % 1000) / 500.0f;
+		}
+		TransformArrays transforms = {
+			components[0].data(), components[1].data(), components[2].data(),
+			components[3].data(), components[4].data(), components[5].data(), components[6].data(),
+			components[7].data(), components[8].data(), components[9].data()
+		};
+		glm::mat4 view = glm::lookAt(glm::vec3(2.0f, 5.0f, -10.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+		std::vector<glm::mat4> referenceModels(count), batchedModels(count);
+		std::vector<glm::mat3> referenceNormals(count), batchedNormals(count);
+
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		for (int it = 0; it < iterations; it++)
+			buildTransformsReference(transforms, 0, count, view, referenceModels.data(), referenceNormals.data());
+		double referenceTime = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - start).count() / iterations;
+
+		start = std::chrono::high_resolution_clock::now();
+		for (int it = 0; it < iterations; it++)
+			buildTransforms(transforms, 0, count, view, batchedModels.data(), batchedNormals.data());
+		double batchedTime = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - start).count() / iterations;
+
+		float maxError = 0.0f;
+		for (size_t i = 0; i < count; i++) {
+			for (int column = 0; column < 3; column++) {
+				for (int row = 0; row < 3; row++) {
+					maxError = std::fmax(maxError, std::fabs(referenceModels[i][column][row] - batchedModels[i][column][row]));
+					maxError = std::fmax(maxError, std::fabs(referenceNormals[i][column][row] - batchedNormals[i][column][row]));
+				}
+			}
+		}
+
+#ifdef __AVX2__
+		const char* batchedName = "AVX2";
+#else
+		const char* batchedName = "scalar";
+#endif
+		std::cout << "Transform kernels, " << count << " entities, " << iterations << " iterations" << std::endl;
+		std::cout << "  glm per object : " << referenceTime << " us (" << referenceTime * 1000.0 / count << " ns/entity)" << std::endl;
+		std::cout << "  batched " << batchedName << " : " << batchedTime << " us (" << batchedTime * 1000.0 / count << " ns/entity)" << std::endl;
+		std::cout << "  speedup " << referenceTime / batchedTime << "x, max abs difference " << maxError << std::endl;
+	}
+}
@@ -0,0 +1,38 @@
+#ifndef TransformKernels_hpp
+#define TransformKernels_hpp
+
+#include "glm/glm.hpp"
+
+#include <cstddef>
+
+namespace gps {
+
+    //translation, rotation quaternion and scale of many entities, one array per component
+    struct TransformArrays {
+        const float* positionX;
+        const float* positionY;
+        const float* positionZ;
+        const float* rotationX;
+        const float* rotationY;
+        const float* rotationZ;
+        const float* rotationW;
+        const float* scaleX;
+        const float* scaleY;
+        const float* scaleZ;
+    };
+
+    //builds model = T * R * S and the eye space normal matrix inverseTranspose(mat3(view * model))
+    //for entities [first, first + count); runs 8 entities per iteration when compiled with AVX2
+    //(-mavx2 or /arch:AVX2) and falls back to a scalar loop otherwise
+    void buildTransforms(const TransformArrays& transforms, size_t first, size_t count, const glm::mat4& view,
+        glm::mat4* modelMatrices, glm::mat3* normalMatrices);
+
+    //reference path: one entity at a time through glm
+    void buildTransformsReference(const TransformArrays& transforms, size_t first, size_t count, const glm::mat4& view,
+        glm::mat4* modelMatrices, glm::mat3* normalMatrices);
+
+    //times both paths on random transforms and prints the results, does not need a GL context; no-op without entities
+    void benchmarkTransformKernels(size_t count, int iterations);
+}
+
+#endif /* TransformKernels_hpp */
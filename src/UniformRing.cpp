@@ -0,0 +1,130 @@
+#include "UniformRing.hpp"
+#include "MemoryStats.hpp"
+#include "RenderStats.hpp"
+
+#include <cstring>
+#include <iostream>
+
+namespace gps {
+
+	void UniformRing::Init(GLsizeiptr maxBlockSize, int maxBlocksPerFrame)
+	{
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		GLsizeiptr alignedBlock = (maxBlockSize + alignment - 1) / alignment * alignment;
+		createBuffer(alignedBlock * maxBlocksPerFrame);
+	}
+
+	void UniformRing::createBuffer(GLsizeiptr segmentSize)
+	{
+		this->segmentSize = segmentSize;
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		persistent = GLEW_ARB_buffer_storage;
+		if (persistent) {
+			//mapped once for the lifetime of the ring, writes are visible without flushing
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_UNIFORM_BUFFER, segmentSize * FRAMES_IN_FLIGHT, NULL, flags);
+			mapped = (unsigned char*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, segmentSize * FRAMES_IN_FLIGHT, flags);
+		}
+		else {
+			glBufferData(GL_UNIFORM_BUFFER, segmentSize * FRAMES_IN_FLIGHT, NULL, GL_STREAM_DRAW);
+		}
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		MemoryStats::trackBuffer(buffer, segmentSize * FRAMES_IN_FLIGHT, "uniform ring");
+	}
+
+	void UniformRing::releaseBuffer()
+	{
+		if (persistent) {
+			glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+			glUnmapBuffer(GL_UNIFORM_BUFFER);
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+			mapped = nullptr;
+		}
+	}
+
+	void UniformRing::Delete()
+	{
+		for (int i = 0; i < FRAMES_IN_FLIGHT; i++) {
+			if (fences[i])
+				glDeleteSync(fences[i]);
+			fences[i] = 0;
+			if (!retired[i].empty())
+				MemoryStats::deleteBuffers((GLsizei)retired[i].size(), retired[i].data());
+			retired[i].clear();
+		}
+		releaseBuffer();
+		MemoryStats::deleteBuffers(1, &buffer);
+	}
+
+	void UniformRing::grow(GLsizeiptr required)
+	{
+		GLsizeiptr grownSize = segmentSize * 2;
+		while (grownSize < required)
+			grownSize *= 2;
+		std::cerr << "Uniform ring segment of " << segmentSize << " bytes overflowed, growing it to "
+			<< grownSize << " bytes; the per frame bound in initUniforms is too low" << std::endl;
+
+		//draws already submitted this frame read the old buffer, it is deleted once this segment's fence passes
+		releaseBuffer();
+		retired[segment].push_back(buffer);
+		createBuffer(grownSize);
+		head = 0;
+	}
+
+	void UniformRing::beginFrame()
+	{
+		segment = (segment + 1) % FRAMES_IN_FLIGHT;
+		head = 0;
+
+		if (fences[segment]) {
+			//normally already signaled, we only block when the GPU is more than two frames behind
+			GLenum result = glClientWaitSync(fences[segment], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+			while (result == GL_TIMEOUT_EXPIRED)
+				result = glClientWaitSync(fences[segment], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+			glDeleteSync(fences[segment]);
+			fences[segment] = 0;
+		}
+		//the GPU is done with everything this segment's frame read, including replaced buffers
+		if (!retired[segment].empty()) {
+			MemoryStats::deleteBuffers((GLsizei)retired[segment].size(), retired[segment].data());
+			retired[segment].clear();
+		}
+	}
+
+	void UniformRing::endFrame()
+	{
+		fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	GLintptr UniformRing::push(const void* data, GLsizeiptr size)
+	{
+		GLsizeiptr alignedSize = (size + alignment - 1) / alignment * alignment;
+		if (head + alignedSize > segmentSize)
+			grow(alignedSize);
+
+		GLintptr offset = segment * segmentSize + head;
+		head += alignedSize;
+		RenderStats::add(COUNTER_UNIFORM_UPLOADS, 1);
+		RenderStats::add(COUNTER_BUFFER_BYTES, (unsigned long long)size);
+
+		if (persistent) {
+			memcpy(mapped + offset, data, size);
+		}
+		else {
+			//the fence already guarantees the range is free, so skip the driver's synchronization
+			glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+			void* ptr = glMapBufferRange(GL_UNIFORM_BUFFER, offset, size,
+				GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+			memcpy(ptr, data, size);
+			glUnmapBuffer(GL_UNIFORM_BUFFER);
+		}
+		return offset;
+	}
+
+	void UniformRing::pushAndBind(GLuint binding, const void* data, GLsizeiptr size)
+	{
+		GLintptr offset = push(data, size);
+		glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, offset, size);
+	}
+}
@@ -0,0 +1,57 @@
+#ifndef UniformRing_hpp
+#define UniformRing_hpp
+
+#include <GL/glew.h>
+
+#include <vector>
+
+namespace gps {
+
+    //uniform buffer split into one segment per frame in flight; every segment is guarded by a fence
+    //so the CPU never overwrites data the GPU is still reading. A segment that overflows is not
+    //wrapped: the ring moves to a buffer twice as large and the old one lives until its frames are done
+    class UniformRing
+    {
+    public:
+        static const int FRAMES_IN_FLIGHT = 3;
+
+        //segments hold maxBlocksPerFrame blocks of up to maxBlockSize bytes, each at the offset alignment
+        void Init(GLsizeiptr maxBlockSize, int maxBlocksPerFrame);
+        void Delete();
+
+        //waits until the GPU is done with the next segment and starts writing into it
+        void beginFrame();
+        //fences the current segment
+        void endFrame();
+
+        //copies size bytes into the current segment and returns their offset in the buffer
+        GLintptr push(const void* data, GLsizeiptr size);
+        //push + glBindBufferRange to the given uniform block binding point
+        void pushAndBind(GLuint binding, const void* data, GLsizeiptr size);
+
+        GLuint getBuffer() { return buffer; }
+        bool isPersistent() { return persistent; }
+        GLsizeiptr getSegmentSize() { return segmentSize; }
+
+    private:
+        GLuint buffer = 0;
+        GLsizeiptr segmentSize = 0;
+        GLint alignment = 256;
+        //true when ARB_buffer_storage is available and the whole ring stays mapped
+        bool persistent = false;
+        unsigned char* mapped = nullptr;
+
+        int segment = 0;
+        GLintptr head = 0;
+        GLsync fences[FRAMES_IN_FLIGHT] = {};
+        //buffers replaced while growing, deleted once the fence of the segment they were retired in passes
+        std::vector<GLuint> retired[FRAMES_IN_FLIGHT];
+
+        void createBuffer(GLsizeiptr segmentSize);
+        void releaseBuffer();
+        //called by push when the segment is full; the ranges pushed so far stay bound to the old buffer
+        void grow(GLsizeiptr required);
+    };
+}
+
+#endif /* UniformRing_hpp */
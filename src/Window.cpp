@@ -1,5 +1,10 @@
 #include "Window.h"
 
+#ifdef GPS_HEADLESS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
 namespace gps {
 
     void Window::Create(int width, int height, const char *title) {
@@ -9,7 +14,6 @@ namespace gps {
 
         //window hints
         glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
         glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
         glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
@@ -19,7 +23,13 @@ namespace gps {
         // for multisampling/antialising
         glfwWindowHint(GLFW_SAMPLES, 4);
 
-        this->window = glfwCreateWindow(width, height, title, NULL, NULL);
+        //4.3 enables compute culling, 4.1 is the most some platforms offer
+        const int minorVersions[2] = { 3, 1 };
+        this->window = NULL;
+        for (int i = 0; i < 2 && !this->window; i++) {
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, minorVersions[i]);
+            this->window = glfwCreateWindow(width, height, title, NULL, NULL);
+        }
         if (!this->window) {
             throw std::runtime_error("Could not create GLFW3 window!");
         }
@@ -32,23 +42,169 @@ namespace gps {
         glewExperimental = GL_TRUE;
         glewInit();
 
+        printContextInfo();
+
+        //for RETINA display
+        glfwGetFramebufferSize(window, &this->dimensions.width, &this->dimensions.height);
+    }
+
+    void Window::CreateHeadless(int width, int height) {
+#ifdef GPS_HEADLESS
+        //a display that needs neither X11 nor Wayland, Mesa llvmpipe included
+        EGLDisplay display = EGL_NO_DISPLAY;
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay)
+            display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        if (display == EGL_NO_DISPLAY)
+            display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+            throw std::runtime_error("Could not open an EGL display!");
+        }
+        if (!eglBindAPI(EGL_OPENGL_API)) {
+            eglTerminate(display);
+            throw std::runtime_error("EGL has no desktop OpenGL!");
+        }
+
+        const EGLint configAttributes[] = {
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_SURFACE_TYPE, 0,
+            EGL_NONE
+        };
+        EGLConfig config;
+        EGLint configCount = 0;
+        if (!eglChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0) {
+            //surfaceless contexts need no config at all
+            config = (EGLConfig)0;
+        }
+
+        //the same versions and profile as the window
+        const int minorVersions[2] = { 3, 1 };
+        EGLContext context = EGL_NO_CONTEXT;
+        for (int i = 0; i < 2 && context == EGL_NO_CONTEXT; i++) {
+            const EGLint contextAttributes[] = {
+                EGL_CONTEXT_MAJOR_VERSION, 4,
+                EGL_CONTEXT_MINOR_VERSION, minorVersions[i],
+                EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                EGL_CONTEXT_OPENGL_FORWARD_COMPATIBLE, EGL_TRUE,
+                EGL_NONE
+            };
+            context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+        }
+        if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+            if (context != EGL_NO_CONTEXT)
+                eglDestroyContext(display, context);
+            eglTerminate(display);
+            throw std::runtime_error("Could not create a surfaceless OpenGL 4.1 core context!");
+        }
+        this->eglDisplay = display;
+        this->eglContext = context;
+
+        //GLEW built for GLX reports the missing X display after loading every GL entry point
+        glewExperimental = GL_TRUE;
+        GLenum glewError = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+        if (glewError == GLEW_ERROR_NO_GLX_DISPLAY)
+            glewError = GLEW_OK;
+#endif
+        if (glewError != GLEW_OK) {
+            throw std::runtime_error("Could not load the OpenGL entry points!");
+        }
+
+        printContextInfo();
+
+        //stands in for the window: sRGB color and a packed depth stencil like a default framebuffer,
+        //single sampled since it is meant for software renderers
+        glGenRenderbuffers(1, &colorBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_SRGB8_ALPHA8, width, height);
+        glGenRenderbuffers(1, &depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            throw std::runtime_error("Could not create the offscreen framebuffer!");
+        }
+
+        this->headless = true;
+        this->dimensions.width = width;
+        this->dimensions.height = height;
+        this->startTime = std::chrono::steady_clock::now();
+#else
+        (void)width;
+        (void)height;
+        throw std::runtime_error("Headless mode needs a build with GPS_HEADLESS defined and libEGL linked!");
+#endif
+    }
+
+    void Window::printContextInfo() {
         // get version info
         const GLubyte* renderer = glGetString(GL_RENDERER); // get renderer string
         const GLubyte* version = glGetString(GL_VERSION); // version as a string
         std::cout << "Renderer: " << renderer << std::endl;
         std::cout << "OpenGL version: " << version << std::endl;
-
-        //for RETINA display
-        glfwGetFramebufferSize(window, &this->dimensions.width, &this->dimensions.height);
     }
 
     void Window::Delete() {
+        if (headless) {
+            glDeleteFramebuffers(1, &framebuffer);
+            glDeleteRenderbuffers(1, &colorBuffer);
+            glDeleteRenderbuffers(1, &depthBuffer);
+            framebuffer = colorBuffer = depthBuffer = 0;
+#ifdef GPS_HEADLESS
+            eglMakeCurrent((EGLDisplay)eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            eglDestroyContext((EGLDisplay)eglDisplay, (EGLContext)eglContext);
+            eglTerminate((EGLDisplay)eglDisplay);
+#endif
+            eglDisplay = eglContext = NULL;
+            return;
+        }
         if (window)
             glfwDestroyWindow(window);
         //close GL context and any other GLFW resources
         glfwTerminate();
     }
 
+    bool Window::shouldClose() {
+        if (headless)
+            return closeRequested;
+        return glfwWindowShouldClose(window);
+    }
+
+    void Window::setShouldClose(bool close) {
+        if (headless)
+            closeRequested = close;
+        else
+            glfwSetWindowShouldClose(window, close ? GL_TRUE : GL_FALSE);
+    }
+
+    void Window::pollEvents() {
+        if (!headless)
+            glfwPollEvents();
+    }
+
+    void Window::swapBuffers() {
+        //nothing is presented, wait for the frame like a blocking swap would
+        if (headless)
+            glFinish();
+        else
+            glfwSwapBuffers(window);
+    }
+
+    void Window::setSwapInterval(int interval) {
+        if (!headless)
+            glfwSwapInterval(interval);
+    }
+
+    double Window::getTime() {
+        if (headless)
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        return glfwGetTime();
+    }
+
     GLFWwindow* Window::getWindow() {
         return this->window;
     }
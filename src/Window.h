@@ -5,6 +5,7 @@
 #include <GLFW/glfw3.h>
 #include <stdexcept>
 #include <iostream>
+#include <chrono>
 
 struct WindowDimensions {
     int width;
@@ -17,15 +18,44 @@ namespace gps {
 
     public:
         void Create(int width=800, int height=600, const char *title="OpenGL Project");
+        //no window and no display: a surfaceless EGL context with the same profile, rendering into
+        //an offscreen framebuffer of the given size; needs a build with GPS_HEADLESS and libEGL
+        void CreateHeadless(int width, int height);
         void Delete();
 
         GLFWwindow* getWindow();
         WindowDimensions getWindowDimensions();
         void setWindowDimensions(WindowDimensions dimensions);
 
+        bool isHeadless() { return headless; }
+        //where frames are rendered: 0 for the window, the offscreen framebuffer when headless
+        GLuint getFramebuffer() { return framebuffer; }
+
+        //the calls of the main loop, they work the same with and without a window
+        bool shouldClose();
+        void setShouldClose(bool close);
+        void pollEvents();
+        void swapBuffers();
+        void setSwapInterval(int interval);
+        //seconds since the context was created
+        double getTime();
+
     private:
         WindowDimensions dimensions;
-        GLFWwindow *window;
+        GLFWwindow *window = NULL;
+
+        bool headless = false;
+        bool closeRequested = false;
+        std::chrono::steady_clock::time_point startTime;
+        //offscreen target, headless only
+        GLuint framebuffer = 0;
+        GLuint colorBuffer = 0;
+        GLuint depthBuffer = 0;
+        //EGLDisplay and EGLContext, kept opaque so EGL stays out of this header
+        void* eglDisplay = NULL;
+        void* eglContext = NULL;
+
+        void printContextInfo();
     };
 }
 
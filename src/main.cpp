@@ -12,32 +12,93 @@
 #include "Camera.hpp"
 #include "Model3D.hpp"
 #include "SkyBox.hpp"
-
+#include "LightClusters.hpp"
+#include "UniformRing.hpp"
+#include "FrameUniforms.hpp"
+#include "Scene.hpp"
+#include "JobSystem.hpp"
+#include "FramePipeline.hpp"
+#include "Crowd.hpp"
+#include "Impostor.hpp"
+#include "DepthPyramid.hpp"
+#include "StaticBatch.hpp"
+#include "TextureArrayPacker.hpp"
+#include "CameraPath.hpp"
+#include "FrameBenchmark.hpp"
+#include "InputLog.hpp"
+#include "Regression.hpp"
+#include "GpuProfiler.hpp"
+#include "CpuProfiler.hpp"
+#include "RenderStats.hpp"
+#include "MemoryStats.hpp"
+#include "AllocationTracker.hpp"
+#include "Hud.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <mutex>
+#include <thread>
 
 // window
 gps::Window myWindow;
 int retina_width, retina_height;
+//--headless WxH renders offscreen without a display, --frames N stops after N frames
+bool headless = false;
+int headlessWidth = 1600, headlessHeight = 900;
+long long maxFrames = 0;
+//--benchmark path.txt flies the camera along a spline on a fixed clock and writes frame times to --benchmark-csv
+bool benchmarking = false;
+std::string benchmarkPathFile;
+std::string benchmarkCsv = "benchmark.csv";
+gps::CameraPath benchmarkPath;
+gps::FrameBenchmark frameBenchmark;
+const int BENCHMARK_WARMUP_FRAMES = 30;
+//--record file writes the input and frame clock of the session, --replay file plays one back instead of live input
+gps::InputLog inputLog;
+std::string recordFile;
+std::string replayFile;
+//--regression dir renders the views in dir/views.txt and checks them against its goldens and baseline.json,
+//--regression-update replaces both; the verdict goes to dir/report.json and the exit code
+std::string regressionDirectory;
+bool regressionUpdate = false;
+//two seconds of animation, then everything holds still
+const int REGRESSION_ANIMATION_STEPS = 120;
+const int REGRESSION_FRAMES = 70;
+const int REGRESSION_WARMUP_FRAMES = 10;
+//--gpu-profile times the passes of every frame on the GPU and prints the tree every few seconds and at exit,
+//--gpu-profile-draws adds a scope per model and static batch
+gps::GpuProfiler gpuProfiler;
+bool gpuProfiling = false;
+bool gpuProfilingDraws = false;
+const long long GPU_PROFILE_REPORT_FRAMES = 600;
+//--trace file.json records CPU zones of every thread from startup on and writes them as a Chrome trace at exit,
+//P writes the trace so far at any time
+std::string traceFile;
+//--stats file.csv appends the render counters of every frame, per pass, and prints the memory report after loading
+std::string statsFile;
+//--allocations prints the allocations per subsystem after loading and at exit, and flags every allocation
+//once the render loop settled; the counters need a build with GPS_TRACK_ALLOCATIONS defined
+bool trackAllocations = false;
+const long long ALLOCATION_WARMUP_FRAMES = 120;
+//--release-cpu-geometry frees the vertices and indices the models keep after uploading them
+bool releaseCpuGeometry = false;
 
 // matrices
-glm::mat4 model;
 glm::mat4 view;
 glm::mat4 projection;
-glm::mat3 normalMatrix;
 
 
-// shader uniform locations
-GLuint modelLoc;
-GLuint viewLoc;
-GLuint projectionLoc;
-GLuint normalMatrixLoc;
-GLuint lightDirLoc;
-GLuint lightColorLoc;
+// uniform blocks, streamed through a fenced ring buffer
+gps::UniformRing uniformRing;
+gps::DrawUniforms drawUniforms;
 glm::mat3 lightDirMatrix;
-GLuint lightDirMatrixLoc;
 
 glm::mat4 lightRotation;
-GLfloat lightAngle;
+GLfloat lightAngle = 0.0f;
 
 //light
 glm::vec3 lightDir;
@@ -53,7 +114,13 @@ glm::vec3 spotLightPosition;
 //pointLight
 int enablePointLight = 0;
 glm::vec3 posPointLight1;
-GLuint posPointLightLoc1;
+
+//stage lights, culled per cluster; the first one is the static point light above the stage
+std::vector<gps::PointLight> stageLights;
+const int STAGE_LIGHT_COUNT = 48;
+//the rig is small enough for all of its lights to reach one cluster
+static_assert(STAGE_LIGHT_COUNT <= gps::LightClusters::MAX_LIGHTS_PER_CLUSTER, "a cluster must be able to list every stage light");
+float stageLightsAngle = 0.0f;
 
 
 // camera at eye level
@@ -62,9 +129,19 @@ gps::Camera myCamera(
     glm::vec3(0.0f, 0.0f, 0.0f),
     glm::vec3(0.0f, 0.0f, 0.0f));
 
-GLfloat cameraSpeed = 0.2;
+//units per second
+GLfloat cameraSpeed = 12.0f;
 
-float deltaTime = 0.0f;
+//fixed step simulation clock, rendering interpolates between the last two steps
+const double SIMULATION_STEP = 1.0 / 60.0;
+//longest frame that is caught up on, a longer stall slows the scene down instead of piling up steps
+const double MAX_FRAME_TIME = 0.25;
+double simulationTime = 0.0;
+double stepAccumulator = 0.0;
+//state at the previous step
+gps::Camera previousCamera = myCamera;
+float previousLightAngle = 0.0f;
+float previousStageLightsAngle = 0.0f;
 
 
 bool firstMouse = true;
@@ -73,10 +150,16 @@ float pitch = 0.0f;
 float lastX = 1600.0 / 2.0;
 float lastY = 900.0 / 2.0;
 float fov = 90.0f;
-float nearPlane = 0.01f;
-float farPlane = 100.00f;
+//shared by the camera projection and the light clusters, their depth slices must match what is drawn
+const float nearPlane = 0.1f;
+const float farPlane = 1000.0f;
 
+//simulation thread only: applyKey and applyCursor write them from the queued input, processMovement reads them
 GLboolean pressedKeys[1024];
+float cameraPitch = 0.0f;
+float cameraYaw = -90.0f;
+bool cameraRotated = false;
+GLenum polygonMode = GL_FILL;
 
 
 GLfloat angle;
@@ -88,21 +171,80 @@ gps::Model3D rightGate;
 gps::Model3D lightCube;
 gps::Model3D screenQuad;
 gps::Model3D audience;
-std::vector<glm::mat4> modelMatrices;
 gps::Model3D discoBall;
 bool startAnimations=false;
-float leftGateAngle=0.0f;
-float rightGateAngle=0.0f;
-float discoBallAngle = 0.0f;
-bool leftGateOpening=false;
-bool rightGateOpening =false;
-std::vector<bool> jumpUp = { 0 };
+
+//every placed object, its transforms are rebuilt once per frame by updateScene and read by every pass
+gps::Scene scene;
+
+//the stage and the teapot, merged by material at load time; they are not scene entities
+gps::StaticBatch staticBatch;
+//their textures packed into arrays so one draw covers several materials, --no-texture-arrays keeps one batch per material
+gps::TextureArrayPacker stageTextures;
+bool textureArrays = true;
+
+//CPU work of the frame is spread over these workers, GL calls stay on the main thread
+gps::JobSystem jobSystem;
+
+//the audience, animated entirely in the vertex shader; --crowd N places N x N people
+gps::Crowd crowd;
+int crowdSize = 8;
+//people further than this are drawn as impostors, --impostor-distance 0 turns them off
+gps::Impostor audienceImpostor;
+float impostorDistance = 30.0f;
+//on 4.3 contexts the crowd is culled by a compute pass and drawn indirectly, --cpu-culling keeps the 4.1 path
+bool gpuCulling = true;
+gps::DepthPyramid depthPyramid;
+
+//everything the render thread needs to submit one frame, filled by the simulation
+struct FrameSlot {
+    gps::FrameUniforms uniforms;
+    unsigned int basicFeatures;
+    GLenum polygonMode;
+    bool showDepthMap;
+    bool showHud;
+    //CPU time simulateFrame took for this slot, in milliseconds
+    double simulationTime;
+    glm::mat4 lightCubeModel;
+    //copies of the scene matrices, the scene itself moves on to the next frame
+    std::vector<glm::mat4> modelMatrices;
+    std::vector<glm::mat3> normalMatrices;
+    //visible objects of the camera and of the shadow map
+    std::vector<gps::DrawItem> cameraDrawList;
+    std::vector<gps::DrawItem> shadowDrawList;
+    //visible index runs of the static batches, for the same two views
+    gps::StaticDrawList cameraStaticList;
+    gps::StaticDrawList shadowStaticList;
+    //the crowd split into full meshes and impostors for this frame's eye
+    std::vector<gps::CrowdInstance> nearCrowd;
+    std::vector<gps::CrowdInstance> farCrowd;
+    //stage lights binned for this frame's view, each slot has its own buffer textures
+    gps::LightClusters lightClusters;
+};
+
+//the simulation thread fills one slot while the main thread renders the other
+FrameSlot frameSlots[gps::FramePipeline::SLOT_COUNT];
+gps::FramePipeline framePipeline;
+gps::PIPELINE_MODE pipelineMode = gps::PIPELINE_OVERLAPPED;
+std::thread simulationThread;
+double lastSimulationTime = 0.0;
+//swap interval 0 instead of vsync
+bool uncapped = false;
 
 // shaders
-gps::Shader myBasicShader;
+gps::ShaderPermutations basicShaders;
+//the basic shader features toggled while running, every combination is compiled up front
+const unsigned int RUNTIME_FEATURES = gps::FEATURE_SPOT | gps::FEATURE_POINT | gps::FEATURE_FOG;
 gps::Shader skyBoxShader;
 gps::Shader depthMapShader;
+gps::Shader depthCrowdShader;
+gps::Shader depthImpostorShader;
+gps::Shader impostorBakeShader;
+gps::Shader cullCrowdShader;
+gps::Shader depthCopyShader;
+gps::Shader depthReduceShader;
 gps::Shader screenQuadShader;
+gps::Shader hudShader;
 gps::Shader lightShader;
 
 //Skybox
@@ -112,9 +254,26 @@ std::vector<const GLchar*> faces;
 //shadow
 GLuint shadowMapFBO;
 GLuint depthMapTexture;
+GLuint shadowSampler;
 const unsigned int SHADOW_WIDTH = 2048;
 const unsigned int SHADOW_HEIGHT = 2048;
 bool showDepthMap = false;
+//performance overlay, toggled with H
+gps::Hud hud;
+bool showHud = false;
+//frame intervals of the render thread in milliseconds, for the HUD graph
+const int HUD_GRAPH_FRAMES = 200;
+float hudFrameTimes[HUD_GRAPH_FRAMES];
+int hudFrameIndex = 0;
+double lastRenderTime = 0.0;
+//GPU scopes shown by the HUD, reused every frame
+std::vector<gps::GpuScopeTime> hudGpuTimes;
+//PCF kernel: number of Poisson taps (1..16) and their radius in shadow map texels
+int pcfTaps = 12;
+float pcfRadius = 1.5f;
+//slope-scaled and constant depth offset applied while rendering the shadow map
+float shadowSlopeBias = 2.0f;
+float shadowConstantBias = 4.0f;
 
 //fog
 GLfloat fogDensity = 0.01f;
@@ -156,49 +315,48 @@ GLenum glCheckError_(const char *file, int line)
 }
 #define glCheckError() glCheckError_(__FILE__, __LINE__)
 
-void initUniforms() {
-    myBasicShader.useShaderProgram();
-
-    modelLoc = glGetUniformLocation(myBasicShader.shaderProgram, "model");
-
-    viewLoc = glGetUniformLocation(myBasicShader.shaderProgram, "view");
+void bindUniformBlocks(gps::Shader shader) {
+    GLuint frameIndex = glGetUniformBlockIndex(shader.shaderProgram, "FrameData");
+    if (frameIndex != GL_INVALID_INDEX)
+        glUniformBlockBinding(shader.shaderProgram, frameIndex, gps::FRAME_BINDING);
+    GLuint drawIndex = glGetUniformBlockIndex(shader.shaderProgram, "DrawData");
+    if (drawIndex != GL_INVALID_INDEX)
+        glUniformBlockBinding(shader.shaderProgram, drawIndex, gps::DRAW_BINDING);
+}
 
-    normalMatrixLoc = glGetUniformLocation(myBasicShader.shaderProgram, "normalMatrix");
+void initBasicVariant(gps::Shader shader) {
+    bindUniformBlocks(shader);
+    shader.useShaderProgram();
+    glUniform1i(glGetUniformLocation(shader.shaderProgram, "shadowMap"), 3);
+    //the sampler units are the same for every slot
+    frameSlots[0].lightClusters.setSamplerUnits(shader, 4);
+}
 
-    lightDirMatrixLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightDirMatrix");
+void initUniforms() {
+    bindUniformBlocks(depthMapShader);
+    bindUniformBlocks(depthCrowdShader);
+    bindUniformBlocks(depthImpostorShader);
+    bindUniformBlocks(lightShader);
+    bindUniformBlocks(skyBoxShader);
 
-    projection = glm::perspective(glm::radians(fov), (float)retina_width / (float)retina_height, 0.1f, 1000.0f);
-    projectionLoc = glGetUniformLocation(myBasicShader.shaderProgram, "projection");
-    glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    //the frame block, then per pass one draw block for the static batches and one for every entity
+    //that survives culling, and one for the light cube
+    int blocksPerFrame = 1 + 2 * (1 + (int)scene.size()) + 1;
+    uniformRing.Init(std::max(sizeof(gps::FrameUniforms), sizeof(gps::DrawUniforms)), blocksPerFrame);
 
+    projection = glm::perspective(glm::radians(fov), (float)retina_width / (float)retina_height, nearPlane, farPlane);
 
     //set the light direction (direction towards the light)
     lightDir = glm::vec3(0.5f, 13.2f, 6.5f);
-    lightDirLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightDir");
-    glUniform3fv(lightDirLoc, 1, glm::value_ptr(lightDir));
 
     //set light color
     lightColor = glm::vec3(1.0f, 1.0f, 1.0f); //white light
-    lightColorLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightColor");
-    glUniform3fv(lightColorLoc, 1, glm::value_ptr(lightColor));
-
-    myBasicShader.useShaderProgram();
-    glUniformMatrix4fv(glGetUniformLocation(myBasicShader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-
-    //pointLight
-    posPointLight1 = glm::vec3(2.0f, 10.0f, 18.0f); //on stage, middle
-    posPointLightLoc1 = glGetUniformLocation(myBasicShader.shaderProgram, "posPointLight1");
-    glUniform3fv(posPointLightLoc1, 1, glm::value_ptr(posPointLight1));
 
     //spotLight
     spotLight1 = glm::cos(glm::radians(40.0f));
     spotLight2 = glm::cos(glm::radians(50.0f));
-    glUniform1f(glGetUniformLocation(myBasicShader.shaderProgram, "spotLight1"), spotLight1);
-    glUniform1f(glGetUniformLocation(myBasicShader.shaderProgram, "spotLight2"), spotLight2);
     spotLightDirection = myCamera.getCameraFrontDirection();
     spotLightPosition = myCamera.getCameraPosition();
-    glUniform3fv(glGetUniformLocation(myBasicShader.shaderProgram, "spotLightDirection"), 1, glm::value_ptr(spotLightDirection));
-	glUniform3fv(glGetUniformLocation(myBasicShader.shaderProgram, "spotLightPosition"), 1, glm::value_ptr(spotLightPosition));
 }
 
 void windowResizeCallback(GLFWwindow* window, int width, int height) {
@@ -210,17 +368,48 @@ bool previewStart = false;
 
 void previewScene() {
     if (previewStart) {
-        myCamera.previewAnimation();
+        myCamera.previewAnimation((float)simulationTime);
     }
 }
 
+//events from the callbacks wait here for the simulation, which applies them at the start of its next step;
+//the step swaps the queue with its own list, both keep their capacity so steady state input never allocates
+const size_t INPUT_CAPACITY = 256;
+std::mutex inputMutex;
+std::vector<gps::InputEvent> pendingInput;
+std::vector<gps::InputEvent> stepInput;
+//index of the next simulation step, stamps the recorded events
+unsigned int simulationStep = 0;
+
+void queueInput(const gps::InputEvent& event) {
+    //a replay owns the input
+    if (inputLog.isReplaying())
+        return;
+    std::lock_guard<std::mutex> lock(inputMutex);
+    pendingInput.push_back(event);
+}
+
+void initInput() {
+    pendingInput.reserve(INPUT_CAPACITY);
+    stepInput.reserve(INPUT_CAPACITY);
+}
+
 void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int mode) {
 	if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) {
         glfwSetWindowShouldClose(window, GL_TRUE);
     }
 
+    gps::InputEvent event = { gps::INPUT_KEY, key, action, 0.0, 0.0 };
+    queueInput(event);
+}
+
+void applyKey(int key, int action) {
     if (key == GLFW_KEY_M && action == GLFW_PRESS)
         showDepthMap = !showDepthMap;
+    if (key == GLFW_KEY_H && action == GLFW_PRESS)
+        showHud = !showHud;
+    if (key == GLFW_KEY_P && action == GLFW_PRESS && gps::CpuProfiler::isEnabled())
+        gps::CpuProfiler::writeTrace(traceFile);
 
 	if (key >= 0 && key < 1024) {
         if (action == GLFW_PRESS) {
@@ -234,6 +423,11 @@ void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int
 
 
 void mouseCallback(GLFWwindow* window, double xpos, double ypos) {
+    gps::InputEvent event = { gps::INPUT_CURSOR, 0, 0, xpos, ypos };
+    queueInput(event);
+}
+
+void applyCursor(double xpos, double ypos) {
     if (firstMouse)
     {
         lastX = xpos;
@@ -259,29 +453,34 @@ void mouseCallback(GLFWwindow* window, double xpos, double ypos) {
     if (pitch < -89.0f)
         pitch = -89.0f;
 
-    myCamera.rotate(pitch, yaw);
-    view = myCamera.getViewMatrix();
-    myBasicShader.useShaderProgram();
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
+    //applied by processMovement in the same step
+    cameraPitch = pitch;
+    cameraYaw = yaw;
+    cameraRotated = true;
 }
 
 
-void processMovement() {
+//applies the held keys for one simulation step of dt seconds
+void processMovement(float dt) {
+    if (cameraRotated) {
+        myCamera.rotate(cameraPitch, cameraYaw);
+        cameraRotated = false;
+    }
+
 	if (pressedKeys[GLFW_KEY_W]) {
-		myCamera.move(gps::MOVE_FORWARD, cameraSpeed);
+		myCamera.move(gps::MOVE_FORWARD, cameraSpeed * dt);
 	}
 
 	if (pressedKeys[GLFW_KEY_S]) {
-		myCamera.move(gps::MOVE_BACKWARD, cameraSpeed);
+		myCamera.move(gps::MOVE_BACKWARD, cameraSpeed * dt);
 	}
 
 	if (pressedKeys[GLFW_KEY_A]) {
-		myCamera.move(gps::MOVE_LEFT, cameraSpeed);
+		myCamera.move(gps::MOVE_LEFT, cameraSpeed * dt);
 	}
 
 	if (pressedKeys[GLFW_KEY_D]) {
-		myCamera.move(gps::MOVE_RIGHT, cameraSpeed);
+		myCamera.move(gps::MOVE_RIGHT, cameraSpeed * dt);
 	}
 
     if(pressedKeys[GLFW_KEY_Q]) {
@@ -290,74 +489,55 @@ void processMovement() {
 
     if (pressedKeys[GLFW_KEY_E]) {
         startAnimations = false;
-        leftGateAngle = 90.0f;
-        rightGateAngle = 90.0f;
-        leftGateOpening = false;
-        rightGateOpening = false;
+        scene.resetAnimators();
     }
 
     //enable spotLight
     if (pressedKeys[GLFW_KEY_Z]) {
-        myBasicShader.useShaderProgram();
         enableSpotLight = 1;
-        glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "enableSpotLight"), enableSpotLight);
         spotLightDirection = myCamera.getCameraFrontDirection();
         spotLightPosition = myCamera.getCameraPosition();
-        glUniform3fv(glGetUniformLocation(myBasicShader.shaderProgram, "spotLightDirection"), 1, glm::value_ptr(spotLightDirection));
-        glUniform3fv(glGetUniformLocation(myBasicShader.shaderProgram, "spotLightPosition"), 1, glm::value_ptr(spotLightPosition));
     }
 
     //disable spotLight
     if (pressedKeys[GLFW_KEY_X]) {
-        myBasicShader.useShaderProgram();
         enableSpotLight = 0;
-        glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "enableSpotLight"), enableSpotLight);
     }
 
     //enable pointLight
     if (pressedKeys[GLFW_KEY_C]) {
-        myBasicShader.useShaderProgram();
         enablePointLight = 1;
-        glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "enablePointLight"), enablePointLight);
     }
 
     //disable pointLight
     if (pressedKeys[GLFW_KEY_V]) {
-        myBasicShader.useShaderProgram();
         enablePointLight = 0;
-        glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "enablePointLight"), enablePointLight);
     }
 
     if (pressedKeys[GLFW_KEY_F])
     {
-        fogDensity = glm::min(fogDensity + 0.001f, 1.0f);
+        fogDensity = glm::min(fogDensity + 0.06f * dt, 1.0f);
     }
 
     // decrease the intensity of fog
     if (pressedKeys[GLFW_KEY_G])
     {
-        fogDensity = glm::max(fogDensity - 0.001f, 0.0f);
+        fogDensity = glm::max(fogDensity - 0.06f * dt, 0.0f);
     }
 
     // move light
     if (pressedKeys[GLFW_KEY_J]) {
 
-        lightAngle += 0.5f;
+        lightAngle += 30.0f * dt;
         if (lightAngle > 360.0f)
             lightAngle -= 360.0f;
-        glm::vec3 lightDirTr = glm::vec3(glm::rotate(glm::mat4(1.0f), glm::radians(lightAngle), glm::vec3(0.0f, 1.0f, 0.0f)) * glm::vec4(lightDir, 1.0f));
-        myBasicShader.useShaderProgram();
-        glUniform3fv(lightDirLoc, 1, glm::value_ptr(lightDirTr));
     }
 
     // move light
     if (pressedKeys[GLFW_KEY_L]) {
-        lightAngle -= 0.5f;
+        lightAngle -= 30.0f * dt;
         if (lightAngle < 0.0f)
             lightAngle += 360.0f;
-        glm::vec3 lightDirTr = glm::vec3(glm::rotate(glm::mat4(1.0f), glm::radians(lightAngle), glm::vec3(0.0f, 1.0f, 0.0f)) * glm::vec4(lightDir, 1.0f));
-        myBasicShader.useShaderProgram();
-        glUniform3fv(lightDirLoc, 1, glm::value_ptr(lightDirTr));
     }
 
     if (pressedKeys[GLFW_KEY_ENTER]) {
@@ -371,24 +551,32 @@ void processMovement() {
     //viewing solid, wireframe objects, polygonal and smooth surfaces
 
     if(pressedKeys[GLFW_KEY_1]){
-            glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+            polygonMode = GL_FILL;
     }
 
     if(pressedKeys[GLFW_KEY_2]){
-            glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+            polygonMode = GL_LINE;
     }
 
     if(pressedKeys[GLFW_KEY_3]){
-            glPolygonMode(GL_FRONT_AND_BACK, GL_POINT);
+            polygonMode = GL_POINT;
     }
 }
 
 void initOpenGLWindow() {
+    if (headless) {
+        myWindow.CreateHeadless(headlessWidth, headlessHeight);
+        retina_width = myWindow.getWindowDimensions().width;
+        retina_height = myWindow.getWindowDimensions().height;
+        return;
+    }
     myWindow.Create(1600, 900, "OpenGL Interactive Application");
     glfwGetFramebufferSize(myWindow.getWindow(), &retina_width, &retina_height);
 }
 
 void setWindowCallbacks() {
+    if (myWindow.isHeadless())
+        return;
     //pointer to hide
     glfwSetInputMode(myWindow.getWindow(), GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 	glfwSetWindowSizeCallback(myWindow.getWindow(), windowResizeCallback);
@@ -407,6 +595,45 @@ void initOpenGLState() {
 	glFrontFace(GL_CCW); // GL_CCW for counter clock-wise
 }
 
+//the lights without their clusters, needs no GL context
+void createStageLights() {
+    stageLights.clear();
+    posPointLight1 = glm::vec3(2.0f, 10.0f, 18.0f); //on stage, middle
+    gps::PointLight mainLight;
+    mainLight.position = posPointLight1;
+    mainLight.radius = 60.0f;
+    mainLight.color = glm::vec3(1.0f, 1.0f, 1.0f);
+    mainLight.intensity = 1.0f;
+    stageLights.push_back(mainLight);
+
+    //colored moving heads in a ring above the stage and the front rows
+    for (int i = 1; i < STAGE_LIGHT_COUNT; i++) {
+        gps::PointLight light;
+        float hue = (float)i / STAGE_LIGHT_COUNT * 6.0f;
+        light.color = glm::clamp(glm::vec3(glm::abs(hue - 3.0f) - 1.0f, 2.0f - glm::abs(hue - 2.0f), 2.0f - glm::abs(hue - 4.0f)), 0.0f, 1.0f);
+        light.radius = 6.0f;
+        light.intensity = 1.5f;
+        stageLights.push_back(light);
+    }
+}
+
+void initLights() {
+    createStageLights();
+    for (int i = 0; i < gps::FramePipeline::SLOT_COUNT; i++) {
+        frameSlots[i].lightClusters.Init();
+        frameSlots[i].lightClusters.setProjection(glm::radians(fov), (float)retina_width / (float)retina_height, nearPlane, farPlane);
+    }
+}
+
+//places the moving stage lights for a rotation angle in degrees
+void updateStageLights(float angle) {
+    for (int i = 1; i < STAGE_LIGHT_COUNT; i++) {
+        float phase = glm::radians(angle) + i * 2.0f * 3.14159265f / (STAGE_LIGHT_COUNT - 1);
+        float radius = 4.0f + 3.0f * ((i % 3) / 2.0f);
+        stageLights[i].position = glm::vec3(radius * cos(phase), 5.0f + 2.0f * sin(phase * 3.0f), 14.6f + radius * sin(phase));
+    }
+}
+
 void initFBO() {
     //TODO - Create the FBO, the depth texture and attach the depth texture to the FBO
     //generate FBO ID
@@ -416,6 +643,7 @@ void initFBO() {
     glGenTextures(1, &depthMapTexture);
     glBindTexture(GL_TEXTURE_2D, depthMapTexture);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    gps::MemoryStats::trackTexture(depthMapTexture, gps::MemoryStats::textureBytes(GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 1, 1), "shadow map");
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
@@ -432,20 +660,85 @@ void initFBO() {
     glReadBuffer(GL_NONE);
 
     //unbind until ready to use
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, myWindow.getFramebuffer());
+
+    //comparison sampler used by the main pass: every fetch returns a bilinearly
+    //filtered depth test, the texture itself stays readable for the depth map preview
+    glGenSamplers(1, &shadowSampler);
+    glSamplerParameteri(shadowSampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glSamplerParameteri(shadowSampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glSamplerParameteri(shadowSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glSamplerParameteri(shadowSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    glSamplerParameterfv(shadowSampler, GL_TEXTURE_BORDER_COLOR, borderColor);
+    glSamplerParameteri(shadowSampler, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glSamplerParameteri(shadowSampler, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
 }
 
-glm::mat4 computeLightSpaceTrMatrix() {
+glm::mat4 computeLightSpaceTrMatrix(float angle) {
     //TODO - Return the light-space transformation matrix
     glm::mat4 lightProjection = glm::ortho(-100.0f, 100.0f, -100.0f, 100.0f, 0.1f, 200.0f);
 
-    glm::vec3 lightDirTr = glm::vec3(glm::rotate(glm::mat4(1.0f), glm::radians(lightAngle), glm::vec3(0.0f, 1.0f, 0.0f)) * glm::vec4(lightDir, 1.0f));
+    glm::vec3 lightDirTr = glm::vec3(glm::rotate(glm::mat4(1.0f), glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f)) * glm::vec4(lightDir, 1.0f));
     glm::mat4 lightView = glm::lookAt(lightDirTr, myCamera.getCameraTarget(), glm::vec3(0.0f, 1.0f, 0.0f));
 
     return lightProjection * lightView;
 }
 
+//angle between two steps, across the 360 degree wrap
+float interpolateAngle(float previous, float current, float alpha) {
+    float difference = current - previous;
+    if (difference > 180.0f)
+        difference -= 360.0f;
+    else if (difference < -180.0f)
+        difference += 360.0f;
+    return previous + difference * alpha;
+}
+
+void updateFrameUniforms(FrameSlot& slot, float alpha) {
+    view = myCamera.getViewMatrix(previousCamera, alpha);
+    float frameLightAngle = interpolateAngle(previousLightAngle, lightAngle, alpha);
+    // compute light direction transformation matrix
+    lightDirMatrix = glm::mat3(glm::inverseTranspose(view));
+    glm::vec3 lightDirTr = glm::vec3(glm::rotate(glm::mat4(1.0f), glm::radians(frameLightAngle), glm::vec3(0.0f, 1.0f, 0.0f)) * glm::vec4(lightDir, 1.0f));
+
+    slot.uniforms.view = view;
+    slot.uniforms.projection = projection;
+    slot.uniforms.lightSpaceTrMatrix = computeLightSpaceTrMatrix(frameLightAngle);
+    slot.uniforms.lightDirMatrix = glm::mat4(lightDirMatrix);
+    slot.uniforms.lightDir = glm::vec4(lightDirTr, 0.0f);
+    slot.uniforms.lightColor = glm::vec4(lightColor, 1.0f);
+    slot.uniforms.spotLightPosition = glm::vec4(spotLightPosition, spotLight1);
+    slot.uniforms.spotLightDirection = glm::vec4(spotLightDirection, spotLight2);
+    slot.uniforms.fogAndShadow = glm::vec4(fogDensity, pcfRadius / SHADOW_WIDTH, 0.0f, 0.0f);
+    slot.uniforms.clusterParams = slot.lightClusters.getShaderParams((float)retina_width, (float)retina_height);
+    slot.uniforms.flags = glm::ivec4(enableSpotLight, enablePointLight, pcfTaps, 0);
+    //the crowd jumps at the same interpolated time as everything else
+    double frameTime = simulationTime - (1.0 - alpha) * SIMULATION_STEP;
+    slot.uniforms.crowdParams = glm::vec4((float)frameTime, startAnimations ? 1.0f : 0.0f, 0.0f, 0.0f);
+
+    //only the lighting that is actually on gets compiled into the main pass shaders
+    slot.basicFeatures = gps::FEATURE_SHADOW;
+    if (fogDensity > 0.0f)
+        slot.basicFeatures |= gps::FEATURE_FOG;
+    if (enableSpotLight)
+        slot.basicFeatures |= gps::FEATURE_SPOT;
+    if (enablePointLight)
+        slot.basicFeatures |= gps::FEATURE_POINT;
+    slot.polygonMode = polygonMode;
+    slot.showDepthMap = showDepthMap;
+    slot.showHud = showHud;
+}
+
+//streams the model and normal matrices of the next draw
+void setDrawUniforms(const glm::mat4& model, const glm::mat3& normalMatrix) {
+    drawUniforms.model = model;
+    drawUniforms.normalMatrix = glm::mat4(normalMatrix);
+    uniformRing.pushAndBind(gps::DRAW_BINDING, &drawUniforms, sizeof(drawUniforms));
+}
+
 void initModels() {
+    gps::CpuZone zone("initModels");
+    gps::AllocationScope allocationScope(gps::ALLOCATION_LOADER);
     teapot.LoadModel("models/teapot/teapot20segUT.obj");
     mainScene.LoadModel("models/main_scene/main_scene.obj");
     leftGate.LoadModel("models/gate/gate.obj");
@@ -463,195 +756,530 @@ void initModels() {
     mySkyBox.Load(faces);
 }
 
+//submits every program at once, the driver compiles them while the models load
 void initShaders() {
-    myBasicShader.loadShader("shaders/basic.vert", "shaders/basic.frag");
-    lightShader.loadShader("shaders/lightCube.vert", "shaders/lightCube.frag");
-    screenQuadShader.loadShader("shaders/screenQuad.vert", "shaders/screenQuad.frag");
-    skyBoxShader.loadShader("shaders/skyBoxShader.vert", "shaders/skyBoxShader.frag");
-    depthMapShader.loadShader("shaders/depthMapShader.vert", "shaders/depthMapShader.frag");
+    gps::CpuZone zone("initShaders");
+    gps::AllocationScope allocationScope(gps::ALLOCATION_SHADERS);
+    gps::Shader::initCompiler("shadercache");
+    basicShaders.loadSource("shaders/basic.vert", "shaders/basic.frag");
+    basicShaders.setLinkCallback(initBasicVariant);
+    //the main pass always samples the shadow map, only the lights and fog are switched at run time;
+    //the variants that depend on the loaded meshes follow in beginContentShaders
+    basicShaders.beginAll(RUNTIME_FEATURES | gps::FEATURE_SPECULAR_MAP, gps::FEATURE_SHADOW);
+    basicShaders.beginAll(RUNTIME_FEATURES, gps::FEATURE_SHADOW | gps::FEATURE_IMPOSTOR);
+    lightShader.beginLoad("shaders/lightCube.vert", "shaders/lightCube.frag", "");
+    screenQuadShader.beginLoad("shaders/screenQuad.vert", "shaders/screenQuad.frag", "");
+    hudShader.beginLoad("shaders/hud.vert", "shaders/hud.frag", "");
+    skyBoxShader.beginLoad("shaders/skyBoxShader.vert", "shaders/skyBoxShader.frag", "");
+    depthMapShader.beginLoad("shaders/depthMapShader.vert", "shaders/depthMapShader.frag", "");
+    depthCrowdShader.beginLoad("shaders/depthMapShader.vert", "shaders/depthMapShader.frag", "#define CROWD\n");
+    depthImpostorShader.beginLoad("shaders/depthMapShader.vert", "shaders/depthMapShader.frag", "#define IMPOSTOR\n");
+    impostorBakeShader.beginLoad("shaders/impostorBake.vert", "shaders/impostorBake.frag", "");
+}
+
+//the specular bit is fixed per mesh, so the crowd and the texture array batches only get the variants
+//their meshes can draw with; known once the models are loaded, these overlap less with loading
+void beginContentShaders() {
+    gps::CpuZone zone("beginContentShaders");
+    gps::AllocationScope allocationScope(gps::ALLOCATION_SHADERS);
+    const std::vector<gps::Mesh>& crowdMeshes = audience.getMeshes();
+    for (size_t m = 0; m < crowdMeshes.size(); m++) {
+        unsigned int specular = crowdMeshes[m].usesSpecularMap() ? gps::FEATURE_SPECULAR_MAP : 0;
+        basicShaders.beginAll(RUNTIME_FEATURES, gps::FEATURE_SHADOW | gps::FEATURE_CROWD | specular);
+    }
+    for (size_t b = 0; b < staticBatch.getBatchCount(); b++)
+        basicShaders.beginAll(RUNTIME_FEATURES, gps::FEATURE_SHADOW | staticBatch.getBatchFeatures(b));
+}
+
+void finishShaders() {
+    gps::CpuZone zone("finishShaders");
+    gps::AllocationScope allocationScope(gps::ALLOCATION_SHADERS);
+    std::vector<gps::Shader*> shaders;
+    shaders.push_back(&lightShader);
+    shaders.push_back(&screenQuadShader);
+    shaders.push_back(&hudShader);
+    shaders.push_back(&skyBoxShader);
+    shaders.push_back(&depthMapShader);
+    shaders.push_back(&depthCrowdShader);
+    shaders.push_back(&depthImpostorShader);
+    shaders.push_back(&impostorBakeShader);
+    gps::Shader::finishAll(shaders);
+    basicShaders.finishAll();
+    hud.Init(hudShader);
 }
 
 
 void renderSkyBox(gps::Shader shader) {
     shader.useShaderProgram();
-    mySkyBox.Draw(shader, view, projection);
+    mySkyBox.Draw(shader);
 }
 
-void calculateAudiencePositions(){
-    //generate object positions
-    //y axis should be 0.0
-    //they can rotate randomly around y axis
-    //they should form a square with origin at (-2.0, 0.0, 0.0) and the distance between them at least 2.5
-
-    //starting position
-    glm::mat4 model1(1.0f);
-    model1 = glm::translate(model1, glm::vec3(-8.5f, 0.0f, -10.0f));
-    //nested loop to create a square
-    for(int i=0; i<8; i++){
-        for(int j=0; j<8; j++){
-            glm::mat4 model2(1.0f);
-            model2 = glm::translate(model2, glm::vec3(0.0f, 0.0f, 0.0f));
-            model2 = glm::translate(model2, glm::vec3(i*2.5f, 0.0f, j*2.5f));
-            srand(glfwGetTime());
-            //at max 45 dgrees rotation
-            model2 = glm::rotate(model2, glm::radians((float)(rand() % 45)), glm::vec3(0.0f, 1.0f, 0.0f));
-            modelMatrices.push_back(model1 * model2);
-        }
+//places the static objects and attaches the animations
+void initScene() {
+    gps::CpuZone zone("initScene");
+    gps::AllocationScope allocationScope(gps::ALLOCATION_LOADER);
+    //stage and teapot never move, their meshes are merged into one draw per material
+    staticBatch.Add(&mainScene, glm::mat4(1.0f));
+    staticBatch.Add(&teapot, glm::translate(glm::mat4(1.0f), glm::vec3(4.4f, 2.0f, 12.0f)));
+    if (textureArrays) {
+        //the layout is kept next to the shader binaries
+        staticBatch.addTextures(stageTextures);
+        stageTextures.Pack("shadercache");
+        staticBatch.Build(&stageTextures);
+        mainScene.releaseTextures();
+        teapot.releaseTextures();
+    }
+    else {
+        staticBatch.Build();
     }
+    mainScene.releaseGeometry();
+    teapot.releaseGeometry();
+
+    //gates swing in opposite directions
+    gps::Entity entity = scene.createEntity(&leftGate);
+    scene.setPosition(entity, glm::vec3(4.4f, 0.3f, -16.0f));
+    scene.addAnimator(entity, gps::ANIMATOR_SWING, 30.0f, -1.0f);
+    entity = scene.createEntity(&rightGate);
+    scene.setPosition(entity, glm::vec3(-3.8f, 0.3f, -16.4f));
+    scene.addAnimator(entity, gps::ANIMATOR_SWING, 30.0f, 1.0f);
+
+    //audience
+    //y axis should be 0.0
+    //they can rotate randomly around y axis, at max 45 degrees
+    //they should form a square with origin at (-8.5, 0.0, -10.0) and the distance between them at least 2.5
+    crowd.Init(&audience, glm::vec3(-8.5f, 0.0f, -10.0f), crowdSize, crowdSize, 2.5f, 45.0f);
+
+    //discoBall
+    entity = scene.createEntity(&discoBall);
+    scene.setPosition(entity, glm::vec3(0.0f, 9.5f, 14.6f));
+    scene.addAnimator(entity, gps::ANIMATOR_SPIN, 30.0f, 1.0f);
 }
 
-void drawObjects(gps::Shader shader, bool depthPass) {
-    shader.useShaderProgram();
-    //teapot
-    model = glm::mat4(1.0f);
+//batching, impostors and GPU culling have read what they need, the buffers hold the rest
+void releaseModelGeometry() {
+    staticBatch.releaseCpuGeometry();
+    leftGate.releaseCpuGeometry();
+    rightGate.releaseCpuGeometry();
+    lightCube.releaseCpuGeometry();
+    screenQuad.releaseCpuGeometry();
+    audience.releaseCpuGeometry();
+    discoBall.releaseCpuGeometry();
+}
 
-    //stage
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-    if (!depthPass) {
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    }
-    mainScene.Draw(shader);
+void writeMemoryReport(std::ostream& out) {
+    gps::Model3D* models[] = { &mainScene, &teapot, &leftGate, &rightGate, &lightCube, &screenQuad, &audience, &discoBall };
+    for (size_t i = 0; i < sizeof(models) / sizeof(models[0]); i++)
+        models[i]->memoryReport(out);
+    gps::MemoryStats::writeReport(out);
+}
 
+//pre-renders the views of the repeated models, needs the finished bake shader
+void initImpostors() {
+    gps::CpuZone zone("initImpostors");
+    if (impostorDistance <= 0.0f)
+        return;
+    audienceImpostor.Bake(&audience, impostorBakeShader, 16, 128);
+    crowd.setImpostor(&audienceImpostor, impostorDistance);
+}
 
-    //gates
-    model = glm::translate(glm::mat4(1.0f), glm::vec3(4.4f, 0.3f, -16.0f));
-    if (startAnimations) {
-        if (leftGateAngle == 90.0f)
-            leftGateOpening = false;
-        else if (leftGateAngle == 0.0f)
-            leftGateOpening = true;
+//compute culling against the frustums and the depth of the previous frame, needs the impostors set up
+void initGpuCulling() {
+    gps::CpuZone zone("initGpuCulling");
+    if (!gpuCulling || !GLEW_VERSION_4_3) {
+        gpuCulling = false;
+        return;
+    }
+    cullCrowdShader.loadComputeShader("shaders/cullCrowd.comp", "");
+    depthCopyShader.loadComputeShader("shaders/depthPyramid.comp", "#define COPY\n");
+    depthReduceShader.loadComputeShader("shaders/depthPyramid.comp", "");
+    depthPyramid.Init(retina_width, retina_height, depthCopyShader, depthReduceShader, myWindow.getFramebuffer());
+    crowd.enableGpuCulling(cullCrowdShader);
+}
 
-        if (leftGateOpening) {
-            leftGateAngle += 0.5;
-        }
-        else {
-            leftGateAngle -= 0.5;
+//advances the animations and computes every transform and draw list of the frame, exactly once per frame
+void updateScene(FrameSlot& slot, float alpha) {
+    //transforms -> bounds, each stage spread over the workers
+    scene.updateTransforms(view, alpha, jobSystem);
+    scene.updateBounds(jobSystem);
+
+    //light
+    float frameLightAngle = interpolateAngle(previousLightAngle, lightAngle, alpha);
+    glm::mat4 model = glm::rotate(glm::mat4(1.0f), glm::radians(frameLightAngle), glm::vec3(0.0f, 1.0f, 0.0f));
+    model = glm::translate(model, glm::vec3(3.0f, 5.0f, 3.0f));
+    slot.lightCubeModel = glm::scale(model, glm::vec3(1.0f, 1.0f, 1.0f));
+
+    //both views are culled and the stage lights binned side by side; no job captures more than 16 bytes,
+    //std::function stores that much without allocating
+    gps::Job* root = jobSystem.createJob(std::function<void()>());
+    jobSystem.run(jobSystem.createJob([&slot]() {
+        scene.cull(gps::CULL_VIEW_CAMERA, projection * view, slot.cameraDrawList, jobSystem);
+        staticBatch.cull(projection * view, slot.cameraStaticList);
+    }, root));
+    jobSystem.run(jobSystem.createJob([&slot]() {
+        scene.cull(gps::CULL_VIEW_SHADOW, slot.uniforms.lightSpaceTrMatrix, slot.shadowDrawList, jobSystem);
+        staticBatch.cull(slot.uniforms.lightSpaceTrMatrix, slot.shadowStaticList);
+    }, root));
+    jobSystem.run(jobSystem.createJob([&slot]() {
+        crowd.partition(glm::vec3(glm::inverse(view)[3]), slot.nearCrowd, slot.farCrowd);
+    }, root));
+    jobSystem.run(jobSystem.createJob([&slot]() {
+        slot.modelMatrices = scene.getModelMatrices();
+        slot.normalMatrices = scene.getNormalMatrices();
+    }, root));
+    float stageAngle = interpolateAngle(previousStageLightsAngle, stageLightsAngle, alpha);
+    gps::Job* moveLights = jobSystem.createJob([stageAngle]() {
+        updateStageLights(stageAngle);
+    }, root);
+    if (enablePointLight) {
+        gps::Job* binLights = jobSystem.createJob([&slot]() {
+            slot.lightClusters.Build(stageLights, view, jobSystem);
+        }, root);
+        jobSystem.addDependency(binLights, moveLights);
+        jobSystem.run(binLights);
+    }
+    jobSystem.run(moveLights);
+    jobSystem.run(root);
+    jobSystem.wait(root);
+}
+
+//submits the instances computed by updateScene; the depth pass uses its own program,
+//the main pass picks a basic shader variant per mesh
+void drawObjects(const FrameSlot& slot, bool depthPass) {
+    gps::CpuZone zone("drawObjects", depthPass ? "shadow" : "main");
+    bool detailed = gpuProfiler.isDetailed();
+    {
+        gps::GpuScope scope(gpuProfiler, "static");
+        //static geometry is stored in world space, only the view is left in its normal matrix
+        setDrawUniforms(glm::mat4(1.0f), glm::mat3(slot.uniforms.view));
+        const gps::StaticDrawList& staticList = depthPass ? slot.shadowStaticList : slot.cameraStaticList;
+        gps::RenderStats::countInstances(staticList.visibleRanges, staticList.totalRanges - staticList.visibleRanges);
+        for (size_t b = 0; b < staticBatch.getBatchCount(); b++) {
+            //per material when profiling draws
+            gps::GpuScope batchScope(gpuProfiler, staticBatch.getBatchName(b).c_str(), detailed);
+            if (depthPass)
+                staticBatch.DrawBatch(staticList, b, depthMapShader);
+            else
+                staticBatch.DrawBatch(staticList, b, basicShaders, slot.basicFeatures);
         }
     }
-    else {
-        leftGateAngle = 90.0f;
+
+    {
+        gps::GpuScope scope(gpuProfiler, "objects");
+        const std::vector<gps::DrawItem>& drawList = depthPass ? slot.shadowDrawList : slot.cameraDrawList;
+        gps::RenderStats::countInstances(drawList.size(), scene.size() - drawList.size());
+        for (size_t i = 0; i < drawList.size(); i++) {
+            //per model when profiling draws, every instance of a model adds up in one scope
+            gps::GpuScope modelScope(gpuProfiler, drawList[i].model->getName().c_str(), detailed);
+            setDrawUniforms(slot.modelMatrices[drawList[i].entity], slot.normalMatrices[drawList[i].entity]);
+            if (depthPass)
+                drawList[i].model->Draw(depthMapShader);
+            else
+                drawList[i].model->Draw(basicShaders, slot.basicFeatures);
+        }
     }
 
-    model = glm::rotate(model, glm::radians(-leftGateAngle), glm::vec3(0.0f, 1.0f, 0.0f));
+    //the whole audience in one instanced draw, plus one for the impostors
+    gps::GpuScope scope(gpuProfiler, "crowd");
+    if (!crowd.isGpuCulled())
+        gps::RenderStats::countInstances(slot.nearCrowd.size() + slot.farCrowd.size(), 0);
+    if (depthPass)
+        crowd.Draw(gps::CROWD_VIEW_SHADOW, depthCrowdShader, depthImpostorShader);
+    else
+        crowd.Draw(gps::CROWD_VIEW_CAMERA, basicShaders, slot.basicFeatures);
+}
 
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-    if (!depthPass) {
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+
+//advances input, camera and animations by exactly one SIMULATION_STEP
+void stepSimulation() {
+    gps::CpuZone zone("stepSimulation");
+    gps::AllocationScope allocationScope(gps::ALLOCATION_FRAME);
+    //the input of this step, live from the callbacks or recorded
+    stepInput.clear();
+    if (inputLog.isReplaying()) {
+        inputLog.eventsForStep(simulationStep, stepInput);
+    }
+    else {
+        std::lock_guard<std::mutex> lock(inputMutex);
+        stepInput.swap(pendingInput);
+    }
+    for (size_t i = 0; i < stepInput.size(); i++) {
+        if (stepInput[i].type == gps::INPUT_KEY)
+            applyKey(stepInput[i].key, stepInput[i].action);
+        else
+            applyCursor(stepInput[i].x, stepInput[i].y);
+        inputLog.recordEvent(simulationStep, stepInput[i]);
     }
-    leftGate.Draw(shader);
 
-    model = glm::translate(glm::mat4(1.0f), glm::vec3(-3.8f, 0.3f, -16.4f));
-    if (startAnimations) {
-        if (rightGateAngle == 90.0f)
-            rightGateOpening = false;
-        else if (rightGateAngle == 0.0f)
-            rightGateOpening = true;
+    previousCamera = myCamera;
+    previousLightAngle = lightAngle;
+    previousStageLightsAngle = stageLightsAngle;
+    scene.beginStep();
 
-        if (leftGateOpening) {
-            rightGateAngle += 0.5;
-        }
-        else {
-            rightGateAngle -= 0.5;
-        }
+    if (benchmarking) {
+        //only the path moves the camera, input is ignored
+        benchmarkPath.apply((float)simulationTime, myCamera);
     }
     else {
-        rightGateAngle = 90.0f;
+        previewScene();
+        processMovement((float)SIMULATION_STEP);
+    }
+    scene.animate(startAnimations, (float)SIMULATION_STEP, jobSystem);
+    if (startAnimations) {
+        stageLightsAngle += 30.0f * (float)SIMULATION_STEP;
+        if (stageLightsAngle > 360.0f)
+            stageLightsAngle -= 360.0f;
     }
 
-    model = glm::rotate(model, glm::radians(rightGateAngle), glm::vec3(0.0f, 1.0f, 0.0f));
+    simulationTime += SIMULATION_STEP;
+    simulationStep++;
+}
 
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-    if (!depthPass) {
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+//CPU side of a frame: everything the render thread needs at alpha between the last two steps, no GL calls
+void simulateFrame(FrameSlot& slot, float alpha) {
+    gps::CpuZone zone("simulateFrame");
+    gps::AllocationScope allocationScope(gps::ALLOCATION_FRAME);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    updateFrameUniforms(slot, alpha);
+    updateScene(slot, alpha);
+    slot.simulationTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+//fills the next free slot, returns false once the pipeline has stopped
+bool simulateNextFrame() {
+    //a replay ends with its log
+    gps::InputFrame replayFrame;
+    if (inputLog.isReplaying() && !inputLog.nextFrame(replayFrame)) {
+        myWindow.setShouldClose(true);
+        return false;
     }
-    rightGate.Draw(shader);
-    //audience
-    for (unsigned int i = 0; i < modelMatrices.size(); i++) {
-    model = modelMatrices[i];
-    float jumpHeight = (float)(rand() % 16 + 7) / 10.0f + model[3][1];
-    float jumpSpeed = (float)(rand() % 100) / 250.0f;
-    float delayTimer = (float)(rand() % 10);
-    if (startAnimations) {
-        if (jumpUp[i]) {
-            if (model[3][1] >= jumpHeight) {
-                jumpUp[i] = false;
-                delayTimer = (float)(rand() % 100) / 100.0f;
-            }
-            else {
-                model = glm::translate(model, glm::vec3(0.0f, jumpSpeed, 0.0f));
-            }
-        }
-        else {
-            if (model[3][1] <= jumpHeight - jumpSpeed) {
-                jumpUp[i] = true;
-            }
-            else {
-                model = glm::translate(model, glm::vec3(0.0f, -jumpSpeed, 0.0f));
-            }
-        }
+
+    int slot = framePipeline.beginWrite();
+    if (slot == -1)
+        return false;
+
+    //benchmark frames are one step apart whatever the real time, so every run sees the same frames
+    if (benchmarking) {
+        stepSimulation();
+        simulateFrame(frameSlots[slot], 1.0f);
+        framePipeline.endWrite();
+        return true;
     }
-    delayTimer -= deltaTime;
-    if (delayTimer <= 0.0f) {
-        jumpUp[i] = true;
+
+    //the recorded steps and alpha, at the recorded pace unless uncapped
+    if (inputLog.isReplaying()) {
+        while (!uncapped && myWindow.getTime() < replayFrame.time && !framePipeline.isStopped())
+            std::this_thread::sleep_for(std::chrono::microseconds(500));
+        for (unsigned int i = 0; i < replayFrame.steps; i++)
+            stepSimulation();
+        simulateFrame(frameSlots[slot], replayFrame.alpha);
+        framePipeline.endWrite();
+        return true;
     }
-        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-        if (!depthPass) {
-            normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-            glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-        }
-        audience.Draw(shader);
+
+    //run as many fixed steps as real time has passed, the remainder is interpolated
+    double currentFrame = myWindow.getTime();
+    stepAccumulator += std::min(currentFrame - lastSimulationTime, MAX_FRAME_TIME);
+    lastSimulationTime = currentFrame;
+    gps::InputFrame frame = { 0, 0.0f, currentFrame };
+    while (stepAccumulator >= SIMULATION_STEP) {
+        stepSimulation();
+        stepAccumulator -= SIMULATION_STEP;
+        frame.steps++;
     }
+    frame.alpha = (float)(stepAccumulator / SIMULATION_STEP);
+    inputLog.recordFrame(frame);
+    simulateFrame(frameSlots[slot], frame.alpha);
 
+    framePipeline.endWrite();
+    return true;
+}
 
-    //discoBall
-    model = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 9.5f, 14.6f));
-    if (startAnimations) {
-        discoBallAngle += 0.5f;
+//the job system belongs to the thread that runs the simulation; returns false when the
+//clustered point lights shade differently from all lights, in release builds as well,
+//the frames then fall back to every light in every cluster
+bool startJobs() {
+    jobSystem.Init();
+    updateStageLights(stageLightsAngle);
+    if (!frameSlots[0].lightClusters.Validate(stageLights, myCamera.getViewMatrix(), jobSystem)) {
+        std::cerr << "Clustered point lights do not match shading with all lights, shading with all lights instead" << std::endl;
+        for (int i = 0; i < gps::FramePipeline::SLOT_COUNT; i++)
+            frameSlots[i].lightClusters.setUnclustered(true);
+        return false;
     }
+    return true;
+}
 
-    model = glm::rotate(model, glm::radians(discoBallAngle), glm::vec3(0.0f, 1.0f, 0.0f));
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-    if (!depthPass) {
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+//the stage lights at several angles seen from several poses, every froxel against the reference;
+//runs without a window, returns false on the first pose that does not match
+bool testLightClusters() {
+    //position, pitch and yaw: the start view, the front rows, above the stage, behind it and inside the light ring
+    const float poses[5][5] = {
+        { 2.0f, 5.0f, -10.0f, 0.0f, 90.0f },
+        { -6.0f, 3.0f, 0.0f, -5.0f, 60.0f },
+        { 0.0f, 18.0f, -20.0f, -30.0f, 90.0f },
+        { 6.0f, 6.0f, 18.0f, -10.0f, -160.0f },
+        { 0.0f, 5.0f, 14.6f, 0.0f, 0.0f }
+    };
+    const int angles = 8;
+
+    gps::JobSystem jobs;
+    jobs.Init();
+    createStageLights();
+    gps::LightClusters clusters;
+    clusters.setProjection(glm::radians(fov), (float)headlessWidth / (float)headlessHeight, nearPlane, farPlane);
+    gps::Camera camera = myCamera;
+    bool passed = true;
+    for (int p = 0; p < 5 && passed; p++) {
+        camera.setPose(glm::vec3(poses[p][0], poses[p][1], poses[p][2]), poses[p][3], poses[p][4]);
+        for (int a = 0; a < angles && passed; a++) {
+            updateStageLights(a * 360.0f / angles);
+            passed = clusters.Validate(stageLights, camera.getViewMatrix(), jobs);
+            if (!passed)
+                std::cerr << "  at pose " << p << ", stage lights turned " << a * 360.0f / angles << " degrees" << std::endl;
+        }
     }
-    discoBall.Draw(shader);
+    jobs.Delete();
+    std::cout << "Light clusters, " << STAGE_LIGHT_COUNT << " lights, 5 poses x " << angles << " angles: " << (passed ? "ok" : "FAILED") << std::endl;
+    return passed;
+}
 
-    //teapot
-    model = glm::translate(glm::mat4(1.0f), glm::vec3(4.4f, 2.0f, 12.0f));
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-    if (!depthPass) {
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+void simulationLoop() {
+    gps::CpuProfiler::setThreadName("simulation");
+    startJobs();
+    while (simulateNextFrame()) {
     }
-    teapot.Draw(shader);
+    jobSystem.Delete();
 }
 
+//performance overlay in the top left corner: frame time graph, CPU and GPU times of the last frames and render counters
+void drawHud(const FrameSlot& slot, double renderTime) {
+    //the interval since the previous frame went through here
+    double now = myWindow.getTime();
+    float frameTime = lastRenderTime > 0.0 ? (float)((now - lastRenderTime) * 1000.0) : 0.0f;
+    lastRenderTime = now;
+    hudFrameTimes[hudFrameIndex] = frameTime;
+    hudFrameIndex = (hudFrameIndex + 1) % HUD_GRAPH_FRAMES;
+    float averageTime = 0.0f;
+    for (int i = 0; i < HUD_GRAPH_FRAMES; i++)
+        averageTime += hudFrameTimes[i];
+    averageTime /= HUD_GRAPH_FRAMES;
+
+    const float scale = 2.0f, lineHeight = 20.0f, left = 20.0f, width = 440.0f, graphHeight = 60.0f;
+    const GLuint white = gps::Hud::rgba(240, 240, 240), grey = gps::Hud::rgba(160, 160, 160);
+    char line[128];
+    hud.begin(retina_width, retina_height);
+    //the panel is sized once everything is in, so it goes first with a placeholder height
+    size_t panel = hud.addRect(10.0f, 10.0f, width + 20.0f, 0.0f, gps::Hud::rgba(0, 0, 0, 160));
+    float y = 20.0f;
+
+    snprintf(line, sizeof(line), "FRAME %6.2f MS %5.0f FPS", averageTime, averageTime > 0.0f ? 1000.0f / averageTime : 0.0f);
+    hud.addText(left, y, line, white, scale);
+    y += lineHeight;
+
+    //one bar per frame, oldest on the left; the lines mark 60 and 30 fps
+    float barWidth = width / HUD_GRAPH_FRAMES;
+    for (int i = 0; i < HUD_GRAPH_FRAMES; i++) {
+        float time = hudFrameTimes[(hudFrameIndex + i) % HUD_GRAPH_FRAMES];
+        float height = std::min(time / 33.3f, 1.0f) * graphHeight;
+        GLuint color = time <= 17.0f ? gps::Hud::rgba(80, 220, 80) : time <= 34.0f ? gps::Hud::rgba(240, 200, 60) : gps::Hud::rgba(240, 70, 60);
+        hud.addRect(left + i * barWidth, y + graphHeight - height, barWidth, height, color);
+    }
+    hud.addRect(left, y + graphHeight * 0.5f, width, 1.0f, grey);
+    hud.addRect(left, y, width, 1.0f, grey);
+    y += graphHeight + 8.0f;
+
+    snprintf(line, sizeof(line), "CPU SIM %5.2f RENDER %5.2f MS", slot.simulationTime, renderTime);
+    hud.addText(left, y, line, white, scale);
+    y += lineHeight;
+
+    //the passes read back from the GPU profiler, a few frames old
+    gpuProfiler.getTimes(hudGpuTimes);
+    for (size_t i = 0; i < hudGpuTimes.size(); i++) {
+        if (hudGpuTimes[i].depth > 1)
+            continue;
+        if (hudGpuTimes[i].depth == 0)
+            snprintf(line, sizeof(line), "GPU %-15s %6.2f MS", hudGpuTimes[i].name.c_str(), hudGpuTimes[i].average);
+        else
+            snprintf(line, sizeof(line), "  %-17s %6.2f", hudGpuTimes[i].name.c_str(), hudGpuTimes[i].average);
+        hud.addText(left, y, line, hudGpuTimes[i].depth == 0 ? white : grey, scale);
+        y += lineHeight;
+    }
 
-void renderScene() {
+    //counters of the last finished frame
+    if (gps::RenderStats::getFrameCount() > 0) {
+        const gps::RenderFrameStats& stats = gps::RenderStats::getFrame(0);
+        snprintf(line, sizeof(line), "DRAWS %llu TRIS %.2fM", stats.total(gps::COUNTER_DRAW_CALLS), stats.total(gps::COUNTER_TRIANGLES) / 1000000.0);
+        hud.addText(left, y, line, white, scale);
+        y += lineHeight;
+        snprintf(line, sizeof(line), "BINDS %llu REDUNDANT %llu", stats.total(gps::COUNTER_PROGRAM_BINDS) + stats.total(gps::COUNTER_VERTEX_ARRAY_BINDS) + stats.total(gps::COUNTER_TEXTURE_BINDS), stats.total(gps::COUNTER_REDUNDANT_CHANGES));
+        hud.addText(left, y, line, white, scale);
+        y += lineHeight;
+        snprintf(line, sizeof(line), "UNIFORMS %llu UPLOAD %.1f KB", stats.total(gps::COUNTER_UNIFORM_UPLOADS), stats.total(gps::COUNTER_BUFFER_BYTES) / 1024.0);
+        hud.addText(left, y, line, white, scale);
+        y += lineHeight;
+        for (int pass = gps::RENDER_PASS_SHADOW; pass <= gps::RENDER_PASS_MAIN; pass++) {
+            snprintf(line, sizeof(line), "%-6s SHOWN %llu CULLED %llu", gps::RenderStats::getPassName((gps::RENDER_PASS)pass),
+                stats.counters[pass][gps::COUNTER_SUBMITTED_INSTANCES], stats.counters[pass][gps::COUNTER_CULLED_INSTANCES]);
+            hud.addText(left, y, line, grey, scale);
+            y += lineHeight;
+        }
+    }
 
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    snprintf(line, sizeof(line), "MEMORY GPU %.1f MB CPU %.1f MB", gps::MemoryStats::getGpuBytes() / 1048576.0, gps::MemoryStats::getCpuBytes() / 1048576.0);
+    hud.addText(left, y, line, white, scale);
+    y += lineHeight;
 
-    previewScene();
+    hud.setRectHeight(panel, y - 10.0f);
+    glViewport(0, 0, retina_width, retina_height);
+    hud.Draw(hudShader);
+}
 
-    processMovement();
+//GL side of a frame: submits a slot produced by simulateFrame
+void renderFrame(FrameSlot& slot) {
+    gps::CpuZone zone("renderFrame");
+    gps::AllocationScope allocationScope(gps::ALLOCATION_FRAME);
+    std::chrono::steady_clock::time_point renderStart = std::chrono::steady_clock::now();
+    gps::RenderStats::beginFrame();
+
+    glPolygonMode(GL_FRONT_AND_BACK, slot.polygonMode);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    uniformRing.beginFrame();
+    uniformRing.pushAndBind(gps::FRAME_BINDING, &slot.uniforms, sizeof(slot.uniforms));
+    glm::mat4 cameraViewProjection = slot.uniforms.projection * slot.uniforms.view;
+    if (crowd.isGpuCulled()) {
+        gps::GpuScope scope(gpuProfiler, "crowd culling");
+        //shadows come from people outside the camera frustum too, and are never occlusion culled
+        glm::vec3 eye = glm::vec3(glm::inverse(slot.uniforms.view)[3]);
+        crowd.cull(gps::CROWD_VIEW_SHADOW, slot.uniforms.lightSpaceTrMatrix, eye, NULL);
+        crowd.cull(gps::CROWD_VIEW_CAMERA, cameraViewProjection, eye, &depthPyramid);
+    }
+    else {
+        crowd.Upload(slot.nearCrowd, slot.farCrowd);
+    }
 
     // 1st step: render the scene to the depth buffer 
+
+    gpuProfiler.beginScope("shadow pass");
+    gps::RenderStats::setPass(gps::RENDER_PASS_SHADOW);
     depthMapShader.useShaderProgram();
 
-    glUniformMatrix4fv(glGetUniformLocation(depthMapShader.shaderProgram, "lightSpaceTrMatrix"), 1, GL_FALSE, glm::value_ptr(computeLightSpaceTrMatrix()));
     glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
     glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
     glClear(GL_DEPTH_BUFFER_BIT);
+    //slope-scaled bias replaces the constant bias of the shadow test
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(shadowSlopeBias, shadowConstantBias);
     //drawObjects
-    drawObjects(depthMapShader, 1);
+    drawObjects(slot, true);
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    gpuProfiler.endScope();
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, myWindow.getFramebuffer());
 
-    if (showDepthMap) {
+    gps::RenderStats::setPass(gps::RENDER_PASS_MAIN);
+    if (slot.showDepthMap) {
+        gps::GpuScope scope(gpuProfiler, "depth map view");
         glViewport(0, 0, retina_width, retina_height);
 
         glClear(GL_COLOR_BUFFER_BIT);
@@ -659,9 +1287,9 @@ void renderScene() {
         screenQuadShader.useShaderProgram();
 
         //bind the depth map
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-        glUniform1i(glGetUniformLocation(screenQuadShader.shaderProgram, "depthMap"), 0);
+        gps::RenderStats::activeTexture(GL_TEXTURE0);
+        gps::RenderStats::bindTexture(GL_TEXTURE_2D, depthMapTexture);
+        gps::RenderStats::uniform1i(glGetUniformLocation(screenQuadShader.shaderProgram, "depthMap"), 0);
 
         glDisable(GL_DEPTH_TEST);
         screenQuad.Draw(screenQuadShader);
@@ -671,57 +1299,253 @@ void renderScene() {
 
 
         //2nd step render everything else
-        myBasicShader.useShaderProgram();
-
-        // send lightSpace matrix to shader
-        glUniformMatrix4fv(glGetUniformLocation(myBasicShader.shaderProgram, "lightSpaceTrMatrix"), 1, GL_FALSE, glm::value_ptr(computeLightSpaceTrMatrix()));
-
-        // send view matrix to shader
-        view = myCamera.getViewMatrix();
-
-        glUniformMatrix4fv(glGetUniformLocation(myBasicShader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-
-        // compute light direction transformation matrix
-        lightDirMatrix = glm::mat3(glm::inverseTranspose(view));
-        // send lightDir matrix data to shader
-        glUniformMatrix3fv(lightDirMatrixLoc, 1, GL_FALSE, glm::value_ptr(lightDirMatrix));
-
         glViewport(0, 0, retina_width, retina_height);
-        myBasicShader.useShaderProgram();
-
         // bind the depth map
-        glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-        glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "shadowMap"), 3);
-
+        gps::RenderStats::activeTexture(GL_TEXTURE3);
+        gps::RenderStats::bindTexture(GL_TEXTURE_2D, depthMapTexture);
+        glBindSampler(3, shadowSampler);
 
-        glUniform1f(glGetUniformLocation(myBasicShader.shaderProgram, "fogDensity"), fogDensity);
+        //stage lights were binned by updateScene
+        if (slot.uniforms.flags.y) {
+            slot.lightClusters.Upload();
+        }
+        slot.lightClusters.Bind(4);
 
 
         //draw objects
-        drawObjects(myBasicShader, false);
+        gpuProfiler.beginScope("main pass");
+        drawObjects(slot, false);
+        glBindSampler(3, 0);
+        gpuProfiler.endScope();
 
         //light
+        gpuProfiler.beginScope("light cube");
         lightShader.useShaderProgram();
-        glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-        model = glm::rotate(glm::mat4(1.0f), glm::radians(lightAngle), glm::vec3(0.0f, 1.0f, 0.0f));
-        model = glm::translate(model, glm::vec3(3.0f, 5.0f, 3.0f));
-        model = glm::scale(model, glm::vec3(1.0f, 1.0f, 1.0f));
-        glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
+        setDrawUniforms(slot.lightCubeModel, glm::mat3(1.0f));
         lightCube.Draw(lightShader);
+        gpuProfiler.endScope();
 
         //render skybox
+        gpuProfiler.beginScope("skybox");
         renderSkyBox(skyBoxShader);
+        gpuProfiler.endScope();
+
+        //occluders for the next frame's crowd culling
+        if (crowd.isGpuCulled()) {
+            gps::GpuScope scope(gpuProfiler, "depth pyramid");
+            gps::RenderStats::setPass(gps::RENDER_PASS_OTHER);
+            depthPyramid.Build(cameraViewProjection);
+        }
     }
+
+    gps::RenderStats::endFrame();
+    //after the counters are closed, so the overlay does not count itself
+    if (slot.showHud) {
+        gps::GpuScope scope(gpuProfiler, "hud");
+        drawHud(slot, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - renderStart).count());
+    }
+    uniformRing.endFrame();
 }
 
 void cleanup() {
+    hud.Delete();
+    //also when only the HUD turned it on
+    if (gpuProfiler.isEnabled())
+        gpuProfiler.Delete();
+    basicShaders.Delete();
+    crowd.Delete();
+    staticBatch.Delete();
+    stageTextures.Delete();
+    audienceImpostor.Delete();
+    depthPyramid.Delete();
+    uniformRing.Delete();
+    for (int i = 0; i < gps::FramePipeline::SLOT_COUNT; i++)
+        frameSlots[i].lightClusters.Delete();
+    glDeleteSamplers(1, &shadowSampler);
+    gps::MemoryStats::deleteTextures(1, &depthMapTexture);
+    glDeleteFramebuffers(1, &shadowMapFBO);
     myWindow.Delete();
     //cleanup code for your own data
 }
 
+//the frame just rendered as top down RGB
+void readFramePixels(gps::RegressionResult& result) {
+    result.width = retina_width;
+    result.height = retina_height;
+    std::vector<unsigned char> rows((size_t)retina_width * retina_height * 3);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, myWindow.getFramebuffer());
+    if (myWindow.getFramebuffer() == 0)
+        glReadBuffer(GL_BACK);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, retina_width, retina_height, GL_RGB, GL_UNSIGNED_BYTE, rows.data());
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    size_t rowSize = (size_t)retina_width * 3;
+    result.pixels.resize(rows.size());
+    for (int y = 0; y < retina_height; y++)
+        std::copy(rows.begin() + (retina_height - 1 - y) * rowSize, rows.begin() + (retina_height - y) * rowSize, result.pixels.begin() + y * rowSize);
+}
+
+//what the frame submitted, the same for every run of the same code
+void countFrame(const FrameSlot& slot, gps::RegressionResult& result) {
+    result.counters["camera_objects"] = (double)slot.cameraDrawList.size();
+    result.counters["shadow_objects"] = (double)slot.shadowDrawList.size();
+    result.counters["static_runs"] = (double)(slot.cameraStaticList.counts.size() + slot.shadowStaticList.counts.size());
+    //GPU culling leaves the CPU lists empty, its counts are the camera's visible people read back
+    if (crowd.isGpuCulled()) {
+        GLuint nearVisible, farVisible;
+        crowd.readVisibleCounts(gps::CROWD_VIEW_CAMERA, nearVisible, farVisible);
+        result.counters["crowd_near"] = (double)nearVisible;
+        result.counters["crowd_far"] = (double)farVisible;
+    }
+    else {
+        result.counters["crowd_near"] = (double)slot.nearCrowd.size();
+        result.counters["crowd_far"] = (double)slot.farCrowd.size();
+    }
+    const gps::RenderFrameStats& stats = gps::RenderStats::getFrame(0);
+    result.counters["draw_calls"] = (double)stats.total(gps::COUNTER_DRAW_CALLS);
+    result.counters["triangles"] = (double)stats.total(gps::COUNTER_TRIANGLES);
+    result.counters["state_changes"] = (double)(stats.total(gps::COUNTER_PROGRAM_BINDS) + stats.total(gps::COUNTER_VERTEX_ARRAY_BINDS) + stats.total(gps::COUNTER_TEXTURE_BINDS));
+}
+
+//renders every regression view on the main thread with the animations frozen, returns the exit code
+int runRegression() {
+    gps::RegressionSuite suite;
+    if (!suite.Load(regressionDirectory))
+        return EXIT_FAILURE;
+
+    //1: the crowd counters are what survived the GPU cull, 0: the CPU near/far split of everyone
+    suite.checkMetadata("crowd_counts_gpu_culled", crowd.isGpuCulled() ? 1.0 : 0.0, regressionUpdate);
+    bool clustersMatch = startJobs();
+    startAnimations = true;
+    for (int i = 0; i < REGRESSION_ANIMATION_STEPS; i++)
+        stepSimulation();
+
+    const std::vector<gps::RegressionView>& views = suite.getViews();
+    for (size_t v = 0; v < views.size(); v++) {
+        std::cout << "Regression view " << views[v].name << std::endl;
+        myCamera.setPose(views[v].position, views[v].pitch, views[v].yaw);
+        previousCamera = myCamera;
+
+        //the same frame over and over, the first ones also settle the occlusion of the GPU culling
+        gps::RegressionResult result;
+        result.name = views[v].name;
+        gps::FrameBenchmark timings;
+        timings.Init(REGRESSION_FRAMES, REGRESSION_WARMUP_FRAMES);
+        FrameSlot& slot = frameSlots[0];
+        while (!timings.isDone()) {
+            simulateFrame(slot, 1.0f);
+            timings.beginFrame();
+            renderFrame(slot);
+            timings.endFrame();
+            if (timings.isDone()) {
+                readFramePixels(result);
+                countFrame(slot, result);
+            }
+            myWindow.pollEvents();
+            myWindow.swapBuffers();
+        }
+        timings.finish();
+        result.frameTime = timings.getFrameTimeStats().p50;
+        result.gpuTime = timings.getGpuTimeStats().p50;
+        timings.Delete();
+
+        suite.check(result, regressionUpdate);
+    }
+    jobSystem.Delete();
+
+    if (regressionUpdate && !suite.writeBaseline())
+        std::cerr << "Could not write the regression baseline" << std::endl;
+    std::string report = regressionDirectory + "/report.json";
+    if (!suite.writeReport(report))
+        std::cerr << "Could not write " << report << std::endl;
+    bool passed = suite.passed() && clustersMatch;
+    std::cout << "Regression " << (regressionUpdate ? "baseline updated" : passed ? "PASSED" : "FAILED") << std::endl;
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 int main(int argc, const char * argv[]) {
 
+    //batched transform kernels against the glm path, runs without a window
+    if (argc > 1 && std::string(argv[1]) == "--bench-transforms") {
+        int count = argc > 2 ? atoi(argv[2]) : 10000;
+        if (count <= 0) {
+            std::cerr << "--bench-transforms needs a positive entity count" << std::endl;
+            return EXIT_FAILURE;
+        }
+        gps::benchmarkTransformKernels((size_t)count, 100);
+        return EXIT_SUCCESS;
+    }
+
+    //scheduler checks and timings, runs without a window
+    if (argc > 1 && std::string(argv[1]) == "--bench-jobs") {
+        unsigned int threads = argc > 2 ? (unsigned int)atoi(argv[2]) : 0;
+        return gps::benchmarkJobSystem(threads) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    //every froxel's lights against the brute force reference, runs without a window
+    if (argc > 1 && std::string(argv[1]) == "--test-clusters")
+        return testLightClusters() ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    //serial, overlapped (default) or low-latency, see PIPELINE_MODE
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--uncapped")
+            uncapped = true;
+        if (std::string(argv[i]) == "--crowd" && i + 1 < argc)
+            crowdSize = std::max(atoi(argv[i + 1]), 0);
+        if (std::string(argv[i]) == "--cpu-culling")
+            gpuCulling = false;
+        if (std::string(argv[i]) == "--no-texture-arrays")
+            textureArrays = false;
+        if (std::string(argv[i]) == "--impostor-distance" && i + 1 < argc)
+            impostorDistance = (float)atof(argv[i + 1]);
+        if (std::string(argv[i]) == "--headless" && i + 1 < argc) {
+            headless = true;
+            sscanf(argv[i + 1], "%dx%d", &headlessWidth, &headlessHeight);
+            headlessWidth = std::max(headlessWidth, 1);
+            headlessHeight = std::max(headlessHeight, 1);
+        }
+        if (std::string(argv[i]) == "--benchmark" && i + 1 < argc) {
+            benchmarking = true;
+            benchmarkPathFile = argv[i + 1];
+        }
+        if (std::string(argv[i]) == "--benchmark-csv" && i + 1 < argc)
+            benchmarkCsv = argv[i + 1];
+        if (std::string(argv[i]) == "--record" && i + 1 < argc)
+            recordFile = argv[i + 1];
+        if (std::string(argv[i]) == "--replay" && i + 1 < argc)
+            replayFile = argv[i + 1];
+        if (std::string(argv[i]) == "--regression" && i + 1 < argc)
+            regressionDirectory = argv[i + 1];
+        if (std::string(argv[i]) == "--regression-update")
+            regressionUpdate = true;
+        if (std::string(argv[i]) == "--gpu-profile")
+            gpuProfiling = true;
+        if (std::string(argv[i]) == "--gpu-profile-draws")
+            gpuProfiling = gpuProfilingDraws = true;
+        if (std::string(argv[i]) == "--stats" && i + 1 < argc)
+            statsFile = argv[i + 1];
+        if (std::string(argv[i]) == "--allocations")
+            trackAllocations = true;
+        if (std::string(argv[i]) == "--release-cpu-geometry")
+            releaseCpuGeometry = true;
+        if (std::string(argv[i]) == "--trace" && i + 1 < argc)
+            traceFile = argv[i + 1];
+        if (std::string(argv[i]) == "--frames" && i + 1 < argc)
+            maxFrames = atoll(argv[i + 1]);
+        if (std::string(argv[i]) == "--pipeline" && i + 1 < argc) {
+            std::string mode = argv[i + 1];
+            if (mode == "serial")
+                pipelineMode = gps::PIPELINE_SERIAL;
+            else if (mode == "low-latency")
+                pipelineMode = gps::PIPELINE_LOW_LATENCY;
+        }
+    }
+
+    if (!traceFile.empty()) {
+        gps::CpuProfiler::setEnabled(true);
+        gps::CpuProfiler::setThreadName("render");
+    }
+
     try {
         initOpenGLWindow();
     } catch (const std::exception& e) {
@@ -729,29 +1553,157 @@ int main(int argc, const char * argv[]) {
         return EXIT_FAILURE;
     }
 
+    //a replay drives the clock itself, the benchmark would fight it for the camera
+    if (!replayFile.empty()) {
+        benchmarking = false;
+        if (!inputLog.loadReplay(replayFile, SIMULATION_STEP)) {
+            myWindow.Delete();
+            return EXIT_FAILURE;
+        }
+    }
+    else if (!recordFile.empty() && !inputLog.beginRecording(recordFile, SIMULATION_STEP)) {
+        myWindow.Delete();
+        return EXIT_FAILURE;
+    }
+    if (!regressionDirectory.empty()) {
+        benchmarking = false;
+        uncapped = true;
+    }
+    if (benchmarking) {
+        if (!benchmarkPath.Load(benchmarkPathFile)) {
+            myWindow.Delete();
+            return EXIT_FAILURE;
+        }
+        //one pass over the path unless --frames says otherwise, measured without vsync and with everything moving
+        if (maxFrames <= 0)
+            maxFrames = (long long)std::ceil(benchmarkPath.getDuration() / SIMULATION_STEP) + BENCHMARK_WARMUP_FRAMES;
+        uncapped = true;
+        startAnimations = true;
+    }
+    if (uncapped)
+        myWindow.setSwapInterval(0);
     initOpenGLState();
-    initModels();
-    calculateAudiencePositions();
     initShaders();
+    initModels();
+    initScene();
+    beginContentShaders();
+    finishShaders();
+    initImpostors();
+    initGpuCulling();
     initUniforms();
     initFBO();
-    setWindowCallbacks();
+    initLights();
 	glCheckError();
-    float lastFrame = 0;
+    if (releaseCpuGeometry)
+        releaseModelGeometry();
+    initInput();
+
+    if (!regressionDirectory.empty()) {
+        int result = runRegression();
+        if (!traceFile.empty())
+            gps::CpuProfiler::writeTrace(traceFile);
+        cleanup();
+        return result;
+    }
+    setWindowCallbacks();
+    if (benchmarking)
+        frameBenchmark.Init((int)maxFrames, BENCHMARK_WARMUP_FRAMES);
+    if (!statsFile.empty()) {
+        gps::RenderStats::openCsv(statsFile);
+        writeMemoryReport(std::cout);
+    }
+    if (trackAllocations)
+        gps::AllocationTracker::writeReport(std::cout);
+    if (gpuProfiling) {
+        gpuProfiler.Init();
+        gpuProfiler.setDetailed(gpuProfilingDraws);
+    }
 
-	// application loop
-	while (!glfwWindowShouldClose(myWindow.getWindow())) {
-        float currentFrame = glfwGetTime();
-        deltaTime = currentFrame - lastFrame;
-        lastFrame = currentFrame;
-	    renderScene();
+    framePipeline.Init(pipelineMode);
+    lastSimulationTime = myWindow.getTime();
+    if (pipelineMode == gps::PIPELINE_SERIAL)
+        startJobs();
+    else
+        simulationThread = std::thread(simulationLoop);
 
-		glfwPollEvents();
-		glfwSwapBuffers(myWindow.getWindow());
+	// application loop
+    long long renderedFrames = 0;
+	while (!myWindow.shouldClose()) {
+        if (pipelineMode == gps::PIPELINE_SERIAL)
+            simulateNextFrame();
+
+        int slot = framePipeline.beginRead();
+        if (slot == -1) {
+            //the simulation is still busy with the next frame
+            myWindow.pollEvents();
+            std::this_thread::yield();
+            continue;
+        }
+        if (benchmarking)
+            frameBenchmark.beginFrame();
+        if (trackAllocations)
+            gps::AllocationTracker::beginFrame();
+        //the HUD shows the GPU passes, so it turns the profiler on
+        if (frameSlots[slot].showHud && !gpuProfiler.isEnabled())
+            gpuProfiler.Init();
+        gpuProfiler.beginFrame();
+	    renderFrame(frameSlots[slot]);
+        gpuProfiler.endFrame();
+        if (benchmarking)
+            frameBenchmark.endFrame();
+        //every GL call has copied what it needed, the simulation may reuse the slot
+        framePipeline.endRead();
+
+		myWindow.pollEvents();
+        {
+            gps::CpuZone zone("swapBuffers");
+            myWindow.swapBuffers();
+        }
+        if (trackAllocations)
+            gps::AllocationTracker::endFrame();
+        renderedFrames++;
+        //the first frames fill pools, caches and the profilers' trees; after that nothing should allocate
+        if (trackAllocations && renderedFrames == ALLOCATION_WARMUP_FRAMES)
+            gps::AllocationTracker::setSteadyState(true);
+        if (maxFrames > 0 && renderedFrames >= maxFrames)
+            myWindow.setShouldClose(true);
+        if (gpuProfiling && renderedFrames % GPU_PROFILE_REPORT_FRAMES == 0)
+            gpuProfiler.writeReport(std::cout);
+
+        if (pipelineMode == gps::PIPELINE_LOW_LATENCY) {
+            //keep at most one frame queued on the GPU so it does not add latency of its own
+            GLsync frameDone = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            glClientWaitSync(frameDone, GL_SYNC_FLUSH_COMMANDS_BIT, 100000000);
+            glDeleteSync(frameDone);
+        }
 
 		glCheckError();
 	}
 
+    gps::AllocationTracker::setSteadyState(false);
+    framePipeline.stop();
+    if (simulationThread.joinable())
+        simulationThread.join();
+    else
+        jobSystem.Delete();
+    if (benchmarking) {
+        frameBenchmark.finish();
+        if (!frameBenchmark.writeCsv(benchmarkCsv))
+            std::cerr << "Could not write " << benchmarkCsv << std::endl;
+        std::string summaryCsv = benchmarkCsv;
+        size_t extension = summaryCsv.rfind(".csv");
+        summaryCsv = (extension == std::string::npos ? summaryCsv : summaryCsv.substr(0, extension)) + "_summary.csv";
+        frameBenchmark.writeSummary(std::cout, summaryCsv);
+        frameBenchmark.Delete();
+    }
+    if (gpuProfiling)
+        gpuProfiler.writeReport(std::cout);
+    if (!traceFile.empty())
+        gps::CpuProfiler::writeTrace(traceFile);
+    gps::RenderStats::closeCsv();
+    if (trackAllocations)
+        gps::AllocationTracker::writeReport(std::cout);
+    inputLog.Close();
 	cleanup();
 
     return EXIT_SUCCESS;
@@ -9,20 +9,80 @@ in vec4 fPosEye;
 
 out vec4 fColor;
 
-//matrices
-uniform mat4 model;
-uniform mat4 view;
-uniform mat3 normalMatrix;
-uniform mat3 lightDirMatrix;
+//matrices and lighting
+layout(std140) uniform FrameData {
+	mat4 view;
+	mat4 projection;
+	mat4 lightSpaceTrMatrix;
+	mat4 lightDirMatrix;
+	vec4 lightDir;
+	vec4 lightColor;
+	vec4 spotLightPosition;		//w: cosine of the inner cone
+	vec4 spotLightDirection;	//w: cosine of the outer cone
+	vec4 fogAndShadow;			//x: fog density, y: PCF radius
+	vec4 clusterParams;			//pixels per cluster tile, near plane, cluster slices per log depth
+	ivec4 flags;				//x: spot light, y: point lights, z: PCF taps
+	vec4 crowdParams;			//x: animation time, y: crowd jump scale
+};
 
-//lighting
-uniform vec3 lightDir;
-uniform vec3 lightColor;
+layout(std140) uniform DrawData {
+	mat4 model;
+	mat4 normalMatrix;
+};
+
+//crowd instances have no DrawData of their own, the vertex shader passes their matrix along
+#if defined(CROWD) || defined(IMPOSTOR)
+in mat3 fCrowdNormalMatrix;
+#define NORMAL_MATRIX fCrowdNormalMatrix
+#else
+#define NORMAL_MATRIX mat3(normalMatrix)
+#endif
 
 // textures
 uniform sampler2D diffuseTexture;
 uniform sampler2D specularTexture;
-uniform sampler2D shadowMap;
+uniform sampler2DShadow shadowMap;
+
+#ifdef TEXTURE_ARRAY
+uniform sampler2DArray diffuseArray;
+uniform sampler2DArray specularArray;
+flat in uvec2 fLayers;
+#endif
+
+#ifdef IMPOSTOR
+uniform sampler2D impostorColor;
+uniform sampler2D impostorNormalDepth;
+uniform vec4 impostorParams;	//x: half width, y: bottom, z: top, w: number of baked views
+in vec4 fImpostorCoords;
+in float fImpostorBlend;
+vec3 impostorNormalEye;
+
+//blends the two baked views, moves the depth from the quad onto the baked surface and returns the albedo
+vec3 impostorSurface()
+{
+	vec4 color = mix(texture(impostorColor, fImpostorCoords.xy), texture(impostorColor, fImpostorCoords.zw), fImpostorBlend);
+	if (color.a < 0.5f)
+		discard;
+	//filtering mixes in the empty texels around the silhouette, which are all zero
+	vec4 normalDepth = mix(texture(impostorNormalDepth, fImpostorCoords.xy), texture(impostorNormalDepth, fImpostorCoords.zw), fImpostorBlend) / color.a;
+	impostorNormalEye = normalize(NORMAL_MATRIX * (normalDepth.xyz * 2.0f - 1.0f));
+	//baked depth 0..1 spans 4 half widths seen from 2 half widths in front of the quad
+	float offset = impostorParams.x * (2.0f - 4.0f * normalDepth.w);
+	vec4 clip = projection * vec4(fPosEye.xyz + normalize(-fPosEye.xyz) * offset, 1.0f);
+	gl_FragDepth = clip.z / clip.w * 0.5f + 0.5f;
+	return color.rgb / color.a;
+}
+#endif
+
+//eye space normal of the fragment
+vec3 surfaceNormalEye()
+{
+#ifdef IMPOSTOR
+	return impostorNormalEye;
+#else
+	return normalize(NORMAL_MATRIX * fNormal);
+#endif
+}
 
 //components
 vec3 ambient;
@@ -32,7 +92,6 @@ vec3 specular;
 float specularStrength = 0.5f;
 
 //spotLight
-uniform int enableSpotLight;
 float spotQuadratic = 0.02f;
 float spotLinear = 0.09f;
 float spotConstant = 1.0f;
@@ -40,28 +99,38 @@ float shininess = 64.0f;
 vec3 spotLightAmbient = vec3(0.0f, 0.0f, 0.0f);
 vec3 spotLightSpecular = vec3(1.0f, 1.0f, 1.0f);
 vec3 spotLightColor = vec3(12,12,12);
-uniform float spotLight1;
-uniform float spotLight2;
-uniform vec3 spotLightDirection;
-uniform vec3 spotLightPosition;
 
 //pointLight
-uniform int enablePointLight;
-uniform vec3 posPointLight1;
+//clustered point lights, grid size must match gps::LightClusters
+const int CLUSTERS_X = 16;
+const int CLUSTERS_Y = 9;
+const int CLUSTERS_Z = 24;
+uniform samplerBuffer clusterLights;	//2 texels per light: eye position and radius, color
+uniform usamplerBuffer clusterGrid;		//offset and count into clusterIndices per cluster
+uniform usamplerBuffer clusterIndices;
 
 
-//fog
-uniform float fogDensity;
+//shadow filtering
+const vec2 poissonDisk[16] = vec2[](
+	vec2(-0.94201624, -0.39906216), vec2(0.94558609, -0.76890725),
+	vec2(-0.09418410, -0.92938870), vec2(0.34495938, 0.29387760),
+	vec2(-0.91588581, 0.45771432), vec2(-0.81544232, -0.87912464),
+	vec2(-0.38277543, 0.27676845), vec2(0.97484398, 0.75648379),
+	vec2(0.44323325, -0.97511554), vec2(0.53742981, -0.47373420),
+	vec2(-0.26496911, -0.41893023), vec2(0.79197514, 0.19090188),
+	vec2(-0.24188840, 0.99706507), vec2(-0.81409955, 0.91437590),
+	vec2(0.19984126, 0.78641367), vec2(0.14383161, -0.14100790)
+);
 
 vec3 computeLightComponents()
 {		
 	vec3 cameraPosEye = vec3(0.0f);//in eye coordinates, the viewer is situated at the origin
 	
 	//transform normal
-	vec3 normalEye = normalize(normalMatrix * fNormal);	
+	vec3 normalEye = surfaceNormalEye();	
 	
 	//compute light direction
-	vec3 lightDirN = normalize(lightDirMatrix * lightDir);	
+	vec3 lightDirN = normalize(mat3(lightDirMatrix) * lightDir.xyz);	
 
 	//compute view direction 
 	vec3 viewDirN = normalize(cameraPosEye - fPosEye.xyz);
@@ -70,58 +139,77 @@ vec3 computeLightComponents()
 	vec3 halfVector = normalize(lightDirN + viewDirN);
 		
 	//compute ambient light
-	ambient = ambientStrength * lightColor *2.0f;
+	ambient = ambientStrength * lightColor.rgb *2.0f;
 	
 	//compute diffuse light
-	diffuse = max(dot(normalEye, lightDirN), 0.0f) * lightColor;
+	diffuse = max(dot(normalEye, lightDirN), 0.0f) * lightColor.rgb;
 	
 	//compute specular light
 	float specCoeff = pow(max(dot(halfVector, normalEye), 0.0f), shininess);
-	specular = specularStrength * specCoeff * lightColor;
+	specular = specularStrength * specCoeff * lightColor.rgb;
 		
 	return (ambient + diffuse + specular);
 	
 }
 
 //pointLight
-vec3 computePointLight(vec4 lightPosEye)
+vec3 computePointLight(vec4 lightPosEye, vec3 pointLightColor, float radius)
 {
 	vec3 cameraPosEye = vec3(0.0f);
-	vec3 normalEye = normalize(normalMatrix * fNormal);
+	vec3 normalEye = surfaceNormalEye();
 	vec3 lightDirN = normalize(lightPosEye.xyz - fPosEye.xyz);
 	vec3 viewDirN = normalize(cameraPosEye - fPosEye.xyz);
-	vec3 ambient = 0.5 * lightColor;
-	vec3 diffuse = max(dot(normalEye, lightDirN), 0.0f) * lightColor;
+	vec3 ambient = 0.5 * pointLightColor;
+	vec3 diffuse = max(dot(normalEye, lightDirN), 0.0f) * pointLightColor;
 	vec3 halfVector = normalize(lightDirN + viewDirN);
 	vec3 reflection = reflect(-lightDirN, normalEye);
 	float specCoeff = pow(max(dot(normalEye, halfVector), 0.0f), 32);
-	vec3 specular = 0.5 * specCoeff * lightColor;
+	vec3 specular = 0.5 * specCoeff * pointLightColor;
 	float distance = length(lightPosEye.xyz - fPosEye.xyz);
 	float att = 1.0f / (1 + 0.00225 * distance + 0.00375 * distance * distance);
-	return (ambient + diffuse + specular) * att * vec3(1.0f,1.0f,1.0f);
+	//fade to zero at the light radius so the cluster culling is exact
+	float window = clamp(1.0f - pow(distance / radius, 4.0f), 0.0f, 1.0f);
+	return (ambient + diffuse + specular) * att * window * window;
+}
+
+vec3 computeClusterLights()
+{
+	ivec2 tile = ivec2(gl_FragCoord.xy / clusterParams.xy);
+	int slice = int(floor(log(max(-fPosEye.z, clusterParams.z) / clusterParams.z) * clusterParams.w));
+	ivec3 cluster = clamp(ivec3(tile, slice), ivec3(0), ivec3(CLUSTERS_X - 1, CLUSTERS_Y - 1, CLUSTERS_Z - 1));
+	uvec2 range = texelFetch(clusterGrid, cluster.x + CLUSTERS_X * (cluster.y + CLUSTERS_Y * cluster.z)).xy;
+
+	vec3 result = vec3(0.0f);
+	for (uint i = 0u; i < range.y; i++) {
+		int light = int(texelFetch(clusterIndices, int(range.x + i)).r);
+		vec4 positionRadius = texelFetch(clusterLights, 2 * light);
+		vec3 color = texelFetch(clusterLights, 2 * light + 1).rgb;
+		result += computePointLight(vec4(positionRadius.xyz, 1.0f), color, positionRadius.w);
+	}
+	return result;
 }
 
 //spotLight
-vec3 computeSpotLightComponents() {
+vec3 computeSpotLightComponents(vec3 albedo, vec3 specularColor) {
 	vec3 cameraPosEye = vec3(0.0f);
-	vec3 lightDir = normalize(spotLightPosition - fPosition);
-	vec3 normalEye = normalize(normalMatrix * fNormal);
-	vec3 lightDirN = normalize(lightDirMatrix * lightDir);
+	vec3 lightDir = normalize(spotLightPosition.xyz - fPosition);
+	vec3 normalEye = surfaceNormalEye();
+	vec3 lightDirN = normalize(mat3(lightDirMatrix) * lightDir);
 	vec3 viewDirN = normalize(cameraPosEye - fPosEye.xyz);
 	vec3 halfVector = normalize(lightDirN + viewDirN);
 
 	float diff = max(dot(fNormal, lightDir), 0.0f);
 	float spec = pow(max(dot(normalEye, halfVector), 0.0f), shininess);
-	float distance = length(spotLightPosition - fPosition);
+	float distance = length(spotLightPosition.xyz - fPosition);
 	float attenuation = 1.0f / (spotConstant + spotLinear * distance + spotQuadratic * distance * distance);
 
-	float theta = dot(lightDir, normalize(-spotLightDirection));
-	float epsilon = spotLight1-spotLight2;
-	float intensity = clamp((theta - spotLight2)/epsilon, 0.0, 1.0);
+	float theta = dot(lightDir, normalize(-spotLightDirection.xyz));
+	float epsilon = spotLightPosition.w - spotLightDirection.w;
+	float intensity = clamp((theta - spotLightDirection.w)/epsilon, 0.0, 1.0);
 
-	vec3 ambient = spotLightColor * spotLightAmbient * vec3(texture(diffuseTexture, fTexCoords));
-	vec3 diffuse = spotLightColor * spotLightSpecular * diff * vec3(texture(diffuseTexture, fTexCoords));
-	vec3 specular = spotLightColor * spotLightSpecular * spec * vec3(texture(specularTexture, fTexCoords));
+	vec3 ambient = spotLightColor * spotLightAmbient * albedo;
+	vec3 diffuse = spotLightColor * spotLightSpecular * diff * albedo;
+	vec3 specular = spotLightColor * spotLightSpecular * spec * specularColor;
 	ambient *= attenuation * intensity;
 	diffuse *= attenuation * intensity;
 	specular *= attenuation * intensity;
@@ -132,7 +220,7 @@ vec3 computeSpotLightComponents() {
 float computeFog()
 {
      float fragmentDistance = length(fPosEye);
-     float fogFactor = exp(-pow(fragmentDistance * fogDensity, 2));
+     float fogFactor = exp(-pow(fragmentDistance * fogAndShadow.x, 2));
 
      return clamp(fogFactor, 0.0f, 1.0f);
 }
@@ -146,45 +234,69 @@ float computeShadow()
     
 	// Transform to [0,1] range
     normalizedCoords = normalizedCoords * 0.5f + 0.5f;
-   
-   // Get closest depth value from light's perspective (using [0,1] range fragPosLight as coords)
-    float closestDepth = texture(shadowMap, normalizedCoords.xy).r;    
-   
-   // Get depth of current fragment from light's perspective
-    float currentDepth = normalizedCoords.z;
-   
-   // Check whether current frag pos is in shadow
-    float bias = 0.005f;
-    float shadow = currentDepth - bias> closestDepth  ? 1.0f : 0.0f;
-
-    return shadow;	
+
+	// rotate the kernel per pixel so the banding of the few taps turns into fine noise
+	float angle = 6.2831853f * fract(52.9829189f * fract(dot(gl_FragCoord.xy, vec2(0.06711056f, 0.00583715f))));
+	mat2 rotation = mat2(cos(angle), sin(angle), -sin(angle), cos(angle));
+
+	// every fetch is a hardware depth comparison, bilinearly filtered over 2x2 texels;
+	// the bias comes from the polygon offset of the depth pass
+	int taps = clamp(flags.z, 1, 16);
+	float lit = 0.0f;
+	for (int i = 0; i < taps; i++) {
+		vec2 offset = rotation * poissonDisk[i] * fogAndShadow.y;
+		lit += texture(shadowMap, vec3(normalizedCoords.xy + offset, normalizedCoords.z));
+	}
+
+    return 1.0f - lit / float(taps);
 }
 
 
+// the optional parts below are compiled in through the SPOT_LIGHT, POINT_LIGHTS, FOG, SHADOW,
+// SPECULAR_MAP, CROWD, IMPOSTOR and TEXTURE_ARRAY defines injected by gps::ShaderPermutations
 void main() 
 {
+    // modulate with diffuse map, sampled once for all lights
+#ifdef IMPOSTOR
+	vec3 albedo = impostorSurface();
+#elif defined(TEXTURE_ARRAY)
+	vec3 albedo = texture(diffuseArray, vec3(fTexCoords, float(fLayers.x))).rgb;
+#else
+	vec3 albedo = texture(diffuseTexture, fTexCoords).rgb;
+#endif
     vec3 light = computeLightComponents();
+#ifdef SHADOW
     float shadow = computeShadow();
+#else
+    float shadow = 0.0f;
+#endif
 
-    // modulate with diffuse map
-	ambient *= texture(diffuseTexture, fTexCoords).rgb;
-	diffuse *= texture(diffuseTexture, fTexCoords).rgb;
-	specular *= texture(specularTexture, fTexCoords).rgb;
-	
+#if defined(SPECULAR_MAP) && defined(TEXTURE_ARRAY)
+	vec3 specularColor = texture(specularArray, vec3(fTexCoords, float(fLayers.y))).rgb;
+#elif defined(SPECULAR_MAP)
+	vec3 specularColor = texture(specularTexture, fTexCoords).rgb;
+#else
+	vec3 specularColor = vec3(0.0f);
+#endif
+	ambient *= albedo;
+	diffuse *= albedo;
+	specular *= specularColor;
 
-	if(enablePointLight==1){
-		vec4 lightPosEye1 = view * vec4(posPointLight1, 1.0f);
-		light += computePointLight(lightPosEye1);
-		vec4 diffuseColor = texture(diffuseTexture, fTexCoords);
-	}
+#ifdef POINT_LIGHTS
+	light += computeClusterLights();
+#endif
 
 	// spotlight
-	if (enableSpotLight == 1){
-		light += computeSpotLightComponents();
-	}
+#ifdef SPOT_LIGHT
+	light += computeSpotLightComponents(albedo, specularColor);
+#endif
 
 	//calc fog
+#ifdef FOG
 	float fogFactor = computeFog();
+#else
+	float fogFactor = 1.0f;
+#endif
     vec4 fogColor = vec4(0.5f, 0.5f, 0.5f, 1.0);
 
 	//calc shadow
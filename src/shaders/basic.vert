@@ -11,19 +11,126 @@ out vec4 fPosLightSpace;
 out vec4 fPosEye;
 
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform	mat3 normalMatrix;
-uniform mat4 lightSpaceTrMatrix;
+layout(std140) uniform FrameData {
+	mat4 view;
+	mat4 projection;
+	mat4 lightSpaceTrMatrix;
+	mat4 lightDirMatrix;
+	vec4 lightDir;
+	vec4 lightColor;
+	vec4 spotLightPosition;		//w: cosine of the inner cone
+	vec4 spotLightDirection;	//w: cosine of the outer cone
+	vec4 fogAndShadow;			//x: fog density, y: PCF radius
+	vec4 clusterParams;			//pixels per cluster tile, near plane, cluster slices per log depth
+	ivec4 flags;				//x: spot light, y: point lights, z: PCF taps
+	vec4 crowdParams;			//x: animation time, y: crowd jump scale
+};
+
+layout(std140) uniform DrawData {
+	mat4 model;
+	mat4 normalMatrix;
+};
+
+#ifdef TEXTURE_ARRAY
+//layers of the diffuse and specular maps, per vertex since 4.1 has no draw index
+layout(location=5) in uvec2 vLayers;
+flat out uvec2 fLayers;
+#endif
+
+#if defined(CROWD) || defined(IMPOSTOR)
+out mat3 fCrowdNormalMatrix;
+
+//per instance attributes, see CrowdInstance
+layout(location=3) in vec4 instancePlacement;	//xyz: feet position, w: rotation around Y in radians
+layout(location=4) in uint instanceSeed;
+
+//lowbias32, the same hash as Crowd::hash
+uint hash(uint x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352dU;
+	x ^= x >> 15;
+	x *= 0x846ca68bU;
+	x ^= x >> 16;
+	return x;
+}
+
+float hashToUnit(uint x)
+{
+	return float(hash(x) >> 8) / 16777216.0;
+}
+
+//stateless jump: every person has its own phase, height and rate, only the time changes
+mat4 crowdModel()
+{
+	float phase = hashToUnit(instanceSeed);
+	float height = mix(0.2, 0.6, hashToUnit(instanceSeed + 1u));
+	float rate = mix(1.5, 2.5, hashToUnit(instanceSeed + 2u));
+	float jump = crowdParams.y * height * abs(sin(3.14159265 * (rate * crowdParams.x + phase)));
+	float c = cos(instancePlacement.w);
+	float s = sin(instancePlacement.w);
+	return mat4(vec4(c, 0.0, -s, 0.0), vec4(0.0, 1.0, 0.0, 0.0), vec4(s, 0.0, c, 0.0), vec4(instancePlacement.xyz + vec3(0.0, jump, 0.0), 1.0));
+}
+#endif
+
+#ifdef IMPOSTOR
+uniform vec4 impostorParams;	//x: half width, y: bottom, z: top, w: number of baked views
+out vec4 fImpostorCoords;		//atlas coordinates in the two baked views closest to the viewer
+out float fImpostorBlend;		//weight of the second one
+
+//world position of the unit quad corner turned around Y towards the viewer, like the views were baked
+vec3 impostorCorner(mat4 modelMatrix, vec3 towards)
+{
+	vec3 forward = vec3(towards.x, 0.0, towards.z);
+	forward = dot(forward, forward) > 1e-8 ? normalize(forward) : vec3(0.0, 0.0, 1.0);
+	vec3 right = vec3(forward.z, 0.0, -forward.x);
+
+	//view k was baked from k / count of a turn around the object
+	vec3 objectForward = transpose(mat3(modelMatrix)) * forward;
+	float view = atan(objectForward.x, objectForward.z) / 6.2831853 * impostorParams.w;
+	float first = floor(view);
+	float u = vPosition.x * 0.5 + 0.5;
+	fImpostorBlend = view - first;
+	fImpostorCoords = vec4((mod(first, impostorParams.w) + u) / impostorParams.w, vPosition.y,
+		(mod(first + 1.0, impostorParams.w) + u) / impostorParams.w, vPosition.y);
+
+	return modelMatrix[3].xyz + right * vPosition.x * impostorParams.x + vec3(0.0, mix(impostorParams.y, impostorParams.z, vPosition.y), 0.0);
+}
+#endif
 
 
 void main() 
 {
-	fPosEye = view * model * vec4(vPosition, 1.0f);
+#ifdef IMPOSTOR
+	//a quad facing the camera, the fragment shader reads the surface from the atlases
+	mat4 modelMatrix = crowdModel();
+	vec3 cameraPosition = -transpose(mat3(view)) * view[3].xyz;
+	vec3 worldPosition = impostorCorner(modelMatrix, cameraPosition - modelMatrix[3].xyz);
+	fCrowdNormalMatrix = mat3(view * modelMatrix);
+	fPosEye = view * vec4(worldPosition, 1.0f);
+	fPosition = worldPosition;
+	fNormal = normalize(-fPosEye.xyz);
+	fTexCoords = fImpostorCoords.xy;
+	fPosLightSpace = lightSpaceTrMatrix * vec4(worldPosition, 1.0f);
+	gl_Position = projection * fPosEye;
+#else
+#ifdef CROWD
+	//rotation and translation only, so the eye space normal matrix is the upper 3x3 of the model view
+	mat4 modelMatrix = crowdModel();
+	mat3 normalEye = mat3(view * modelMatrix);
+	fCrowdNormalMatrix = normalEye;
+#else
+	mat4 modelMatrix = model;
+	mat3 normalEye = mat3(normalMatrix);
+#endif
+	fPosEye = view * modelMatrix * vec4(vPosition, 1.0f);
 	fPosition = vPosition;
-	fNormal = normalize(normalMatrix * vNormal);
+	fNormal = normalize(normalEye * vNormal);
 	fTexCoords = vTexCoords;
-	fPosLightSpace = lightSpaceTrMatrix * model * vec4(vPosition, 1.0f);
-	gl_Position = projection * view * model * vec4(vPosition, 1.0f);
+	fPosLightSpace = lightSpaceTrMatrix * modelMatrix * vec4(vPosition, 1.0f);
+	gl_Position = projection * view * modelMatrix * vec4(vPosition, 1.0f);
+#endif
+#ifdef TEXTURE_ARRAY
+	fLayers = vLayers;
+#endif
 }
@@ -2,7 +2,19 @@
 //simple fragment shader that writes dummy output
 out vec4 fColor;
 
+#ifdef IMPOSTOR
+uniform sampler2D impostorColor;
+in vec4 fImpostorCoords;
+in float fImpostorBlend;
+#endif
+
 void main()
 {
+#ifdef IMPOSTOR
+	//only the covered part of the quad casts a shadow
+	float coverage = mix(texture(impostorColor, fImpostorCoords.xy).a, texture(impostorColor, fImpostorCoords.zw).a, fImpostorBlend);
+	if (coverage < 0.5f)
+		discard;
+#endif
 	fColor = vec4(1.0f);
 }
\ No newline at end of file
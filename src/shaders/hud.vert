@@ -0,0 +1,15 @@
+#version 410 core
+
+layout(location=0) in vec2 vPosition;
+layout(location=1) in vec2 vTexCoords;
+layout(location=2) in vec4 vColor;
+
+out vec2 fTexCoords;
+out vec4 fTint;
+
+void main()
+{
+	fTexCoords = vTexCoords;
+	fTint = vColor;
+	gl_Position = vec4(vPosition, 0.0f, 1.0f);
+}
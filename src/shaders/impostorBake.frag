@@ -0,0 +1,15 @@
+#version 410 core
+
+in vec3 fNormal;
+in vec2 fTexCoords;
+
+layout(location=0) out vec4 fColor;			//albedo and coverage
+layout(location=1) out vec4 fNormalDepth;	//object space normal and depth along the view
+
+uniform sampler2D diffuseTexture;
+
+void main()
+{
+	fColor = vec4(texture(diffuseTexture, fTexCoords).rgb, 1.0f);
+	fNormalDepth = vec4(normalize(fNormal) * 0.5f + 0.5f, gl_FragCoord.z);
+}
@@ -0,0 +1,18 @@
+#version 410 core
+//renders one view of a model into its tile of the impostor atlases
+
+layout(location=0) in vec3 vPosition;
+layout(location=1) in vec3 vNormal;
+layout(location=2) in vec2 vTexCoords;
+
+out vec3 fNormal;
+out vec2 fTexCoords;
+
+uniform mat4 bakeMatrix;	//orthographic projection of the view, the model stays in object space
+
+void main()
+{
+	fNormal = vNormal;
+	fTexCoords = vTexCoords;
+	gl_Position = bakeMatrix * vec4(vPosition, 1.0f);
+}
@@ -4,9 +4,25 @@ layout(location=0) in vec3 vPosition;
 layout(location=1) in vec3 vNormal;
 layout(location=2) in vec2 vTexCoords;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+layout(std140) uniform FrameData {
+	mat4 view;
+	mat4 projection;
+	mat4 lightSpaceTrMatrix;
+	mat4 lightDirMatrix;
+	vec4 lightDir;
+	vec4 lightColor;
+	vec4 spotLightPosition;		//w: cosine of the inner cone
+	vec4 spotLightDirection;	//w: cosine of the outer cone
+	vec4 fogAndShadow;			//x: fog density, y: PCF radius
+	vec4 clusterParams;			//pixels per cluster tile, near plane, cluster slices per log depth
+	ivec4 flags;				//x: spot light, y: point lights, z: PCF taps
+	vec4 crowdParams;			//x: animation time, y: crowd jump scale
+};
+
+layout(std140) uniform DrawData {
+	mat4 model;
+	mat4 normalMatrix;
+};
 
 void main() 
 {
@@ -3,13 +3,25 @@
 layout (location = 0) in vec3 vertexPosition;
 out vec3 textureCoordinates;
 
-uniform mat4 projection;
-uniform mat4 view;
-uniform mat4 model;
+layout(std140) uniform FrameData {
+	mat4 view;
+	mat4 projection;
+	mat4 lightSpaceTrMatrix;
+	mat4 lightDirMatrix;
+	vec4 lightDir;
+	vec4 lightColor;
+	vec4 spotLightPosition;		//w: cosine of the inner cone
+	vec4 spotLightDirection;	//w: cosine of the outer cone
+	vec4 fogAndShadow;			//x: fog density, y: PCF radius
+	vec4 clusterParams;			//pixels per cluster tile, near plane, cluster slices per log depth
+	ivec4 flags;				//x: spot light, y: point lights, z: PCF taps
+	vec4 crowdParams;			//x: animation time, y: crowd jump scale
+};
 
 void main()
 {
-    vec4 tempPos = projection * view * vec4(vertexPosition, 1.0);
+    //drop the translation so the box stays centered on the camera
+    vec4 tempPos = projection * mat4(mat3(view)) * vec4(vertexPosition, 1.0);
     gl_Position = tempPos.xyww;
     textureCoordinates = vertexPosition;
 }
\ No newline at end of file
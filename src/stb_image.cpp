@@ -1,2 +1,10 @@
+#include "AllocationTracker.hpp"
+
+#ifdef GPS_TRACK_ALLOCATIONS
+//decoded images are charged to the subsystem of the loading thread
+#define STBI_MALLOC(size) gps::AllocationTracker::allocate(size)
+#define STBI_REALLOC(block, size) gps::AllocationTracker::reallocate(block, size)
+#define STBI_FREE(block) gps::AllocationTracker::release(block)
+#endif
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
\ No newline at end of file